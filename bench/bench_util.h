@@ -0,0 +1,163 @@
+#pragma once
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <netinet/in.h>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Shared by the benchmarks: wall-clock timing plus one JSON object per
+// result on stdout, so runs can be diffed between releases.
+class BenchReport
+{
+public:
+  explicit BenchReport(const std::string &bench)
+  {
+    out_ << "{\"bench\":\"" << bench << "\"";
+  }
+
+  BenchReport &field(const char *key, const std::string &v)
+  {
+    out_ << ",\"" << key << "\":\"" << v << "\"";
+    return *this;
+  }
+
+  BenchReport &field(const char *key, const char *v)
+  {
+    return field(key, std::string(v));
+  }
+
+  BenchReport &field(const char *key, double v)
+  {
+    out_ << ",\"" << key << "\":" << v;
+    return *this;
+  }
+
+  BenchReport &field(const char *key, uint64_t v)
+  {
+    out_ << ",\"" << key << "\":" << v;
+    return *this;
+  }
+
+  void emit() { std::cout << out_.str() << "}" << std::endl; }
+
+private:
+  std::ostringstream out_;
+};
+
+// Runs fn() iters times and returns the mean nanoseconds per call.
+template <typename Fn>
+double time_per_op_ns(uint64_t iters, Fn &&fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iters; ++i)
+    fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(iters);
+}
+
+// Keeps the optimiser from discarding a computed value.
+template <typename T>
+inline void do_not_optimize(const T &v)
+{
+  asm volatile("" : : "g"(&v) : "memory");
+}
+
+// ---------- loopback clients ----------
+
+// Exits with perror(what) unless ok: for steps a run cannot go on without.
+inline void check(bool ok, const char *what)
+{
+  if (ok)
+    return;
+  std::perror(what);
+  std::exit(EXIT_FAILURE);
+}
+
+// Blocking TCP connection to addr; exits on failure.
+inline int connect_to(const sockaddr_in &addr)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  check(fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                             sizeof(addr)) == 0,
+        "connect");
+  return fd;
+}
+
+// Appends a v1 frame: [u32 length][msg].
+inline void append_frame(std::string &out, const std::string &msg)
+{
+  uint32_t len = htonl(static_cast<uint32_t>(msg.size()));
+  out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  out += msg;
+}
+
+// write() until all n bytes are taken; false on error. Works on files too.
+inline bool send_all(int fd, const char *data, size_t n)
+{
+  size_t sent = 0;
+  while (sent < n)
+  {
+    ssize_t w = ::write(fd, data + sent, n - sent);
+    if (w <= 0)
+      return false;
+    sent += static_cast<size_t>(w);
+  }
+  return true;
+}
+
+inline bool send_all(int fd, const std::string &bytes)
+{
+  return send_all(fd, bytes.data(), bytes.size());
+}
+
+// One v1 frame, built in a single allocation.
+inline bool send_frame(int fd, const std::string &msg)
+{
+  std::string frame;
+  frame.reserve(sizeof(uint32_t) + msg.size());
+  append_frame(frame, msg);
+  return send_all(fd, frame);
+}
+
+// read() until n bytes have arrived; false on error or EOF.
+inline bool read_exact(int fd, char *buf, size_t n)
+{
+  size_t got = 0;
+  while (got < n)
+  {
+    ssize_t r = ::read(fd, buf + got, n - got);
+    if (r <= 0)
+      return false;
+    got += static_cast<size_t>(r);
+  }
+  return true;
+}
+
+// ---------- allocation counting ----------
+
+// A bench that defines BENCH_COUNT_ALLOCATIONS before including this
+// header replaces the global operator new, so g_allocs counts every heap
+// allocation in the process, server threads included.
+#ifdef BENCH_COUNT_ALLOCATIONS
+inline std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(size_t size)
+{
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,542 @@
+// Fault injection under load, as a correctness and a performance gate.
+//
+// A real Server on 127.0.0.1 (epoll backend, run level- and then
+// edge-triggered) whose socket syscalls go through ChaosIo: a seeded
+// schedule of EAGAIN bursts, short reads and writes, ECONNRESET, EMFILE
+// from accept and failing epoll_ctl. One client thread drives
+// `connections` clients, `concurrent` at a time, each running a scenario
+// picked from the same seed:
+//
+//   pipeline     requests sent in random pieces, replies read as they come
+//   dribble      the same, one to three bytes per send
+//   slow_reader  a deep pipeline whose replies are read 256 bytes at a time
+//   half_close   everything sent, then SHUT_WR; replies read until EOF
+//   reset        part of a frame sent, then an RST (SO_LINGER 0)
+//   abandon      connect and close without a byte
+//   oversize     a length prefix over MAX_FRAME; the server must hang up
+//
+// Replies are checked byte for byte; a connection the server cut (an
+// injected reset, say) must still have received a correct prefix. Once
+// every client is gone the run checks the invariants:
+//
+//   accepted == closed, no active connections, buffer_bytes back to 0,
+//   as many open fds as before the first client, no corrupt reply, no
+//   client stuck, and peak buffer_bytes within the memory budget plus
+//   one event batch of slack.
+//
+// One JSON line per run; the exit status is non-zero if an invariant
+// failed. Usage: bench_chaos [seed] [connections] [concurrent]
+
+#include "bench_util.h"
+#include "config.h"
+#include "io_ops.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Per mille of calls. A read EAGAIN starts a burst of up to four.
+struct FaultPlan
+{
+  uint32_t read_eagain = 40;
+  uint32_t read_short = 150;
+  uint32_t read_reset = 1;
+  uint32_t write_eagain = 40;
+  uint32_t write_short = 150;
+  uint32_t write_reset = 1;
+  uint32_t accept_emfile = 30;
+  uint32_t ctl_fail = 1;
+};
+
+struct FaultCounts
+{
+  uint64_t eagain = 0;
+  uint64_t short_io = 0;
+  uint64_t reset = 0;
+  uint64_t emfile = 0;
+  uint64_t ctl_fail = 0;
+};
+
+// Called only from the reactor thread, so one generator gives the same
+// sequence of decisions for the same seed.
+class ChaosIo : public IoOps
+{
+public:
+  ChaosIo(uint64_t seed, const FaultPlan &plan) : rng_(seed), plan_(plan) {}
+
+  ssize_t readv(int fd, const iovec *iov, int cnt) override
+  {
+    if (eagain_left_ > 0)
+    {
+      --eagain_left_;
+      return fail(EAGAIN, faults.eagain);
+    }
+    uint32_t roll = this->roll();
+    if (roll < plan_.read_reset)
+      return fail(ECONNRESET, faults.reset);
+    roll -= plan_.read_reset;
+    if (roll < plan_.read_eagain)
+    {
+      eagain_left_ = static_cast<int>(rng_() % 4);
+      return fail(EAGAIN, faults.eagain);
+    }
+    roll -= plan_.read_eagain;
+    if (roll < plan_.read_short)
+      return shortened(fd, iov, cnt, 1 + rng_() % 64, &::readv);
+    return ::readv(fd, iov, cnt);
+  }
+
+  ssize_t writev(int fd, const iovec *iov, int cnt) override
+  {
+    uint32_t roll = this->roll();
+    if (roll < plan_.write_reset)
+      return fail(ECONNRESET, faults.reset);
+    roll -= plan_.write_reset;
+    if (roll < plan_.write_eagain)
+      return fail(EAGAIN, faults.eagain);
+    roll -= plan_.write_eagain;
+    if (roll < plan_.write_short)
+      return shortened(fd, iov, cnt, 1 + rng_() % 512, &::writev);
+    return ::writev(fd, iov, cnt);
+  }
+
+  int accept4(int fd, sockaddr *addr, socklen_t *len, int flags) override
+  {
+    if (roll() < plan_.accept_emfile)
+      return static_cast<int>(fail(EMFILE, faults.emfile));
+    return ::accept4(fd, addr, len, flags);
+  }
+
+  int epoll_ctl(int epfd, int op, int fd, epoll_event *ev) override
+  {
+    // DEL is part of closing; failing it would only leak the test.
+    if (op != EPOLL_CTL_DEL && roll() < plan_.ctl_fail)
+      return static_cast<int>(fail(ENOMEM, faults.ctl_fail));
+    return ::epoll_ctl(epfd, op, fd, ev);
+  }
+
+  FaultCounts faults;
+
+private:
+  uint32_t roll() { return static_cast<uint32_t>(rng_() % 1000); }
+
+  static ssize_t fail(int err, uint64_t &count)
+  {
+    ++count;
+    errno = err;
+    return -1;
+  }
+
+  // The same call over at most `limit` bytes of the iovecs.
+  template <typename Syscall>
+  ssize_t shortened(int fd, const iovec *iov, int cnt, size_t limit,
+                    Syscall call)
+  {
+    ++faults.short_io;
+    scratch_.clear();
+    for (int i = 0; i < cnt && limit > 0; ++i)
+    {
+      const size_t n = std::min(limit, iov[i].iov_len);
+      scratch_.push_back({iov[i].iov_base, n});
+      limit -= n;
+    }
+    return call(fd, scratch_.data(), static_cast<int>(scratch_.size()));
+  }
+
+  std::mt19937_64 rng_;
+  FaultPlan plan_;
+  int eagain_left_ = 0;
+  std::vector<iovec> scratch_;
+};
+
+// ---------- clients ----------
+
+enum class Scenario
+{
+  PIPELINE,
+  DRIBBLE,
+  SLOW_READER,
+  HALF_CLOSE,
+  RESET,
+  ABANDON,
+  OVERSIZE,
+  COUNT
+};
+
+struct Client
+{
+  int fd = -1;
+  Scenario scenario = Scenario::PIPELINE;
+  std::string out;    // every request, framed
+  std::string expect; // every reply, framed
+  std::string got;
+  size_t sent = 0;
+  size_t reset_at = 0; // RESET: bytes sent before the RST
+  bool shut_wr = false;
+  uint32_t events = 0; // registered with the client epoll
+};
+
+struct Outcome
+{
+  uint64_t completed = 0; // every reply received and checked
+  uint64_t cut = 0;       // the server hung up first; prefix checked
+  uint64_t corrupt = 0;   // a reply byte that does not match
+  uint64_t stuck = 0;     // still open at the deadline
+};
+
+static void add_frame(std::string &to, const std::string &payload)
+{
+  uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
+  to.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  to += payload;
+}
+
+static void build(Client &c, std::mt19937_64 &rng)
+{
+  if (c.scenario == Scenario::ABANDON)
+    return;
+  if (c.scenario == Scenario::OVERSIZE)
+  {
+    // First byte 0 (v1), length 15 MB: over MAX_FRAME. The server routes
+    // it on its first STREAM_PEEK bytes and, as XXXX does not stream,
+    // hangs up.
+    add_frame(c.out, std::string(Connection::STREAM_PEEK, 'X'));
+    c.out[1] = static_cast<char>(0xF0);
+    return;
+  }
+
+  const int requests =
+      c.scenario == Scenario::SLOW_READER ? 200 : 1 + static_cast<int>(rng() % 32);
+  for (int i = 0; i < requests; ++i)
+  {
+    if (rng() % 4 == 0)
+    {
+      add_frame(c.out, "PING");
+      add_frame(c.expect, "PONG");
+      continue;
+    }
+    // Mostly small; now and then over STREAM_THRESHOLD, which streams.
+    const size_t size = rng() % 50 == 0 ? 70 * 1024 + rng() % 4096
+                                        : 1 + rng() % 2048;
+    std::string body(size, static_cast<char>('a' + rng() % 26));
+    body[0] = static_cast<char>('0' + i % 10);
+    add_frame(c.out, "ECHO " + body);
+    add_frame(c.expect, body);
+  }
+  if (c.scenario == Scenario::RESET)
+    c.reset_at = rng() % c.out.size();
+}
+
+static void watch(int epfd, Client &c, uint32_t events)
+{
+  if (c.events == events)
+    return;
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.ptr = &c;
+  ::epoll_ctl(epfd, c.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c.fd, &ev);
+  c.events = events;
+}
+
+static void finish(int epfd, Client &c, bool rst = false)
+{
+  ::epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+  if (rst)
+  {
+    linger l{1, 0};
+    ::setsockopt(c.fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  ::close(c.fd);
+  c.fd = -1;
+}
+
+// Advances one client; false once it is done.
+static bool step(int epfd, Client &c, std::mt19937_64 &rng, Outcome &result)
+{
+  // ---------- send ----------
+  while (c.sent < c.out.size())
+  {
+    if (c.scenario == Scenario::RESET && c.sent >= c.reset_at)
+    {
+      ++result.completed;
+      finish(epfd, c, true);
+      return false;
+    }
+    size_t piece = c.scenario == Scenario::DRIBBLE ? 1 + rng() % 3
+                                                   : 1 + rng() % 16384;
+    piece = std::min(piece, c.out.size() - c.sent);
+    if (c.scenario == Scenario::RESET)
+      piece = std::min(piece, c.reset_at - c.sent);
+    ssize_t n = ::send(c.fd, c.out.data() + c.sent, piece, MSG_NOSIGNAL);
+    if (n <= 0)
+      break; // EAGAIN, or the server is gone: the read side will see it
+    c.sent += static_cast<size_t>(n);
+    if (c.scenario == Scenario::DRIBBLE)
+      break; // one piece per wakeup
+  }
+  if (c.sent == c.out.size() && c.scenario == Scenario::HALF_CLOSE &&
+      !c.shut_wr)
+  {
+    ::shutdown(c.fd, SHUT_WR);
+    c.shut_wr = true;
+  }
+
+  // ---------- receive ----------
+  char buf[64 * 1024];
+  const size_t want = c.scenario == Scenario::SLOW_READER ? 256 : sizeof(buf);
+  while (true)
+  {
+    ssize_t n = ::recv(c.fd, buf, want, 0);
+    if (n > 0)
+    {
+      const size_t at = c.got.size();
+      c.got.append(buf, static_cast<size_t>(n));
+      if (c.got.size() > c.expect.size() ||
+          c.expect.compare(at, static_cast<size_t>(n), buf,
+                           static_cast<size_t>(n)) != 0)
+      {
+        ++result.corrupt;
+        finish(epfd, c);
+        return false;
+      }
+      if (c.scenario == Scenario::SLOW_READER)
+        break;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    // EOF or reset from the server.
+    if (c.got.size() == c.expect.size() && c.sent == c.out.size())
+      ++result.completed;
+    else
+      ++result.cut;
+    finish(epfd, c);
+    return false;
+  }
+
+  if (c.got.size() == c.expect.size() && c.sent == c.out.size() &&
+      c.scenario != Scenario::OVERSIZE && c.scenario != Scenario::HALF_CLOSE)
+  {
+    ++result.completed;
+    finish(epfd, c);
+    return false;
+  }
+
+  uint32_t events = EPOLLIN;
+  if (c.sent < c.out.size())
+    events |= EPOLLOUT;
+  watch(epfd, c, events);
+  return true;
+}
+
+static size_t open_fds()
+{
+  size_t n = 0;
+  if (DIR *d = ::opendir("/proc/self/fd"))
+  {
+    while (::readdir(d))
+      ++n;
+    ::closedir(d);
+  }
+  return n;
+}
+
+static void raise_fd_limit()
+{
+  rlimit rl;
+  if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+// One run against a fresh Server; true if every invariant held.
+static bool run_chaos(uint64_t seed, int connections, int concurrent,
+                      bool edge_triggered)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.edge_triggered = edge_triggered;
+  cfg.max_frame_rate = 0;
+  cfg.backlog = concurrent;
+  cfg.max_connections = 2 * concurrent;
+  cfg.max_connections_per_ip = 0; // every client is 127.0.0.1
+  cfg.memory_budget_mb = 64;
+  cfg.zero_copy = false; // splice is not behind IoOps; copy instead
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  // perror() from the injected failures is expected; keep it off the
+  // report.
+  std::cout.flush();
+  const int saved_err = ::dup(STDERR_FILENO);
+  const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  ::dup2(null_fd, STDERR_FILENO);
+
+  // A real socket never returns EAGAIN with data or room available, and
+  // under edge triggering nothing would wake the connection after one:
+  // the spurious kind is injected level-triggered only.
+  FaultPlan plan;
+  if (edge_triggered)
+    plan.read_eagain = plan.write_eagain = 0;
+  ChaosIo chaos(seed, plan);
+  Server server(listen_fd, cfg, 0);
+  server.set_io_ops(chaos);
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  const size_t fds_before = open_fds();
+  std::mt19937_64 rng(seed ^ 0x9E3779B97F4A7C15ull);
+  Outcome result;
+  uint64_t peak_buffer = 0;
+
+  const int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+  std::vector<Client> clients(static_cast<size_t>(concurrent));
+  int started = 0;
+  auto start = std::chrono::steady_clock::now();
+  const auto deadline = start + std::chrono::seconds(60);
+
+  // Starts clients in every free slot; the number still open.
+  auto refill = [&] {
+    int open = 0;
+    for (Client &c : clients)
+    {
+      while (c.fd < 0 && started < connections)
+      {
+        c = Client{};
+        c.scenario =
+            static_cast<Scenario>(rng() % static_cast<int>(Scenario::COUNT));
+        build(c, rng);
+        c.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ::connect(c.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        ++started;
+        if (c.scenario == Scenario::ABANDON)
+        {
+          ++result.completed;
+          finish(epfd, c);
+          continue;
+        }
+        watch(epfd, c, EPOLLIN | EPOLLOUT);
+      }
+      open += c.fd >= 0;
+    }
+    return open;
+  };
+
+  epoll_event events[256];
+  while (refill() > 0)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      for (Client &c : clients)
+      {
+        if (c.fd >= 0)
+        {
+          ++result.stuck;
+          finish(epfd, c);
+        }
+      }
+      break;
+    }
+    int ready = ::epoll_wait(epfd, events, 256, 100);
+    for (int i = 0; i < ready; ++i)
+    {
+      Client &c = *static_cast<Client *>(events[i].data.ptr);
+      if (c.fd >= 0)
+        step(epfd, c, rng, result);
+    }
+    peak_buffer = std::max(peak_buffer, server.metrics().buffer_bytes);
+  }
+  const double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  ::close(epfd);
+
+  // Every client is gone; give the server time to see the last closes.
+  MetricsSnapshot m = server.metrics();
+  for (int i = 0; i < 500 && m.active_connections > 0; ++i)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    m = server.metrics();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  m = server.metrics();
+  const size_t fds_after = open_fds();
+
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+  ::dup2(saved_err, STDERR_FILENO);
+  ::close(saved_err);
+  ::close(null_fd);
+
+  // Pressure is checked once per loop iteration: each event of a batch
+  // may add a read and a reply's worth before it.
+  const uint64_t budget = static_cast<uint64_t>(cfg.memory_budget_mb) << 20;
+  const uint64_t slack = static_cast<uint64_t>(cfg.events_per_wait) *
+                         (Connection::WRITE_HIGH_WATER + Connection::MAX_FRAME);
+  const bool ok = m.connections_accepted == m.connections_closed &&
+                  m.active_connections == 0 && m.buffer_bytes == 0 &&
+                  fds_after == fds_before && result.corrupt == 0 &&
+                  result.stuck == 0 && peak_buffer <= budget + slack;
+
+  BenchReport("chaos")
+      .field("mode", edge_triggered ? "edge" : "level")
+      .field("seed", seed)
+      .field("connections", static_cast<uint64_t>(started))
+      .field("concurrent", static_cast<uint64_t>(concurrent))
+      .field("elapsed_s", elapsed)
+      .field("connections_per_sec", started / elapsed)
+      .field("completed", result.completed)
+      .field("cut", result.cut)
+      .field("corrupt", result.corrupt)
+      .field("stuck", result.stuck)
+      .field("faults_eagain", chaos.faults.eagain)
+      .field("faults_short", chaos.faults.short_io)
+      .field("faults_reset", chaos.faults.reset)
+      .field("faults_emfile", chaos.faults.emfile)
+      .field("faults_epoll_ctl", chaos.faults.ctl_fail)
+      .field("accepted", m.connections_accepted)
+      .field("closed", m.connections_closed)
+      .field("rejected", m.connections_rejected)
+      .field("shed", m.connections_shed)
+      .field("fd_delta", static_cast<double>(fds_after) -
+                             static_cast<double>(fds_before))
+      .field("peak_buffer_bytes", peak_buffer)
+      .field("ok", ok ? "true" : "false")
+      .emit();
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  const uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+  const int connections = argc > 2 ? std::atoi(argv[2]) : 5000;
+  const int concurrent = argc > 3 ? std::atoi(argv[3]) : 500;
+  raise_fd_limit();
+
+  bool ok = run_chaos(seed, connections, concurrent, false);
+  ok = run_chaos(seed, connections, concurrent, true) && ok;
+  return ok ? 0 : 1;
+}
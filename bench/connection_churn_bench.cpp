@@ -0,0 +1,176 @@
+// Heap allocations and time per connection under accept/close churn.
+//
+//   table:    open a connection, give it a read buffer and one queued
+//             reply, close it; std::unordered_map<int, Connection> versus
+//             the slab-backed ConnectionTable. No sockets involved.
+//   loopback: a real Server on 127.0.0.1; each client connects, sends
+//             PING, reads PONG and half-closes, then waits for the server
+//             to close its side. Allocations are counted process-wide.
+//
+// Allocations are counted by replacing the global operator new, and only
+// after a warm-up pass, so the numbers show steady-state churn.
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench_util.h"
+#include "config.h"
+#include "connection_table.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <new>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+static FrameBuffer REPLY("PONG");
+
+static void use_connection(Connection &conn)
+{
+  conn.read_buffer.reserve(16 * 1024);
+  conn.read_buffer.commit(8);
+  conn.write_queue.push(FrameRef::share(REPLY));
+}
+
+static void bench_table(uint64_t rounds, size_t concurrent)
+{
+  {
+    std::unordered_map<int, Connection> map;
+    auto churn = [&] {
+      for (size_t i = 0; i < concurrent; ++i)
+      {
+        auto [it, inserted] = map.try_emplace(static_cast<int>(i), static_cast<int>(i));
+        (void)inserted;
+        use_connection(it->second);
+      }
+      for (size_t i = 0; i < concurrent; ++i)
+        map.erase(static_cast<int>(i));
+    };
+    churn();
+
+    uint64_t before = g_allocs.load();
+    double ns = time_per_op_ns(rounds, churn);
+    uint64_t allocs = g_allocs.load() - before;
+    BenchReport("connection_churn")
+        .field("mode", "table")
+        .field("path", "unordered_map")
+        .field("connections", rounds * concurrent)
+        .field("allocs_per_connection",
+               static_cast<double>(allocs) / (rounds * concurrent))
+        .field("ns_per_connection", ns / concurrent)
+        .emit();
+  }
+
+  {
+    ConnectionTable table(concurrent);
+    auto churn = [&] {
+      for (size_t i = 0; i < concurrent; ++i)
+        use_connection(table.open(static_cast<int>(i)));
+      for (size_t i = 0; i < concurrent; ++i)
+        table.retire(*table.find(static_cast<int>(i)));
+      table.release_retired();
+    };
+    churn();
+
+    uint64_t before = g_allocs.load();
+    double ns = time_per_op_ns(rounds, churn);
+    uint64_t allocs = g_allocs.load() - before;
+    BenchReport("connection_churn")
+        .field("mode", "table")
+        .field("path", "slab")
+        .field("connections", rounds * concurrent)
+        .field("allocs_per_connection",
+               static_cast<double>(allocs) / (rounds * concurrent))
+        .field("ns_per_connection", ns / concurrent)
+        .emit();
+  }
+}
+
+static void ping_once(const sockaddr_in &addr)
+{
+  int fd = connect_to(addr);
+
+  const char frame[] = {0, 0, 0, 4, 'P', 'I', 'N', 'G'};
+  if (::write(fd, frame, sizeof(frame)) != sizeof(frame))
+  {
+    std::perror("write");
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Read the reply, half-close, then wait for the server's FIN so the
+  // connection is fully torn down on its side before the next one.
+  char buf[64];
+  size_t got = 0;
+  while (got < 8)
+  {
+    ssize_t n = ::read(fd, buf + got, sizeof(buf) - got);
+    if (n <= 0)
+      break;
+    got += static_cast<size_t>(n);
+  }
+  ::shutdown(fd, SHUT_WR);
+  while (::read(fd, buf, sizeof(buf)) > 0)
+  {
+  }
+  ::close(fd);
+}
+
+static void bench_loopback(uint64_t connections, ServerConfig::IoBackend backend)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.io_backend = backend;
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  // The server logs every accept and close; keep that out of the report.
+  auto *out = std::cout.rdbuf(nullptr);
+  auto *err = std::cerr.rdbuf(nullptr);
+
+  Server server(listen_fd, cfg);
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  for (uint64_t i = 0; i < connections / 10; ++i)
+    ping_once(addr);
+
+  uint64_t before = g_allocs.load();
+  double ns = time_per_op_ns(connections, [&] { ping_once(addr); });
+  uint64_t allocs = g_allocs.load() - before;
+
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+
+  BenchReport("connection_churn")
+      .field("mode", "loopback")
+      .field("backend", server.backend_name())
+      .field("connections", connections)
+      .field("allocs_per_connection", static_cast<double>(allocs) / connections)
+      .field("ns_per_connection", ns)
+      .emit();
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t connections = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000;
+
+  bench_table(200, 256);
+  bench_loopback(connections, ServerConfig::IoBackend::EPOLL);
+  bench_loopback(connections, ServerConfig::IoBackend::URING);
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Latency for a light client while others saturate the reactor.
+//
+// A real Server on 127.0.0.1 with one reactor. HOGS connections each
+// stream pipelined 4 KB ECHO frames as fast as the socket takes them
+// (and read the replies on a second thread); one probe connection does
+// `count` PING round trips meanwhile. Rows compare level-triggered epoll
+// with an effectively unlimited per-tick budget (every connection read
+// until EAGAIN, the old behaviour) against the default 64 KB budget, in
+// both epoll modes, and edge-triggered with a 16 KB budget.
+//
+// Reported: probe round-trip percentiles, epoll_wait() calls and events
+// per call, and how often a connection was deferred at its budget.
+
+#include "bench_util.h"
+#include "config.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static constexpr int HOGS = 4;
+static constexpr size_t HOG_FRAME = 4096;
+static const char PING_FRAME[] = {0, 0, 0, 4, 'P', 'I', 'N', 'G'};
+
+static void bench_fairness(const char *mode, bool edge_triggered,
+                           int io_budget, int count)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.max_frame_rate = 0;
+  cfg.edge_triggered = edge_triggered;
+  cfg.io_budget_bytes = io_budget;
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  Server server(listen_fd, cfg, 0);
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  // ---------- hogs ----------
+  std::string batch;
+  {
+    const std::string body = "ECHO " + std::string(HOG_FRAME, 'h');
+    const uint32_t n = htonl(static_cast<uint32_t>(body.size()));
+    for (int i = 0; i < 16; ++i)
+    {
+      batch.append(reinterpret_cast<const char *>(&n), sizeof(n));
+      batch += body;
+    }
+  }
+  std::atomic<bool> stop{false};
+  std::vector<int> hog_fds;
+  std::vector<std::thread> hogs;
+  for (int i = 0; i < HOGS; ++i)
+  {
+    const int fd = connect_to(addr);
+    set_nodelay(fd);
+    hog_fds.push_back(fd);
+    hogs.emplace_back([fd, &batch, &stop] {
+      while (!stop.load(std::memory_order_relaxed))
+      {
+        if (::send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) <= 0)
+          break;
+      }
+    });
+    hogs.emplace_back([fd] {
+      char buf[64 * 1024];
+      while (::read(fd, buf, sizeof(buf)) > 0)
+      {
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // ---------- probe ----------
+  const MetricsSnapshot before = server.metrics();
+  const int probe = connect_to(addr);
+  set_nodelay(probe);
+  std::vector<double> rtt_us;
+  rtt_us.reserve(static_cast<size_t>(count));
+  char reply[8];
+  for (int i = 0; i < count; ++i)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    if (::write(probe, PING_FRAME, sizeof(PING_FRAME)) != sizeof(PING_FRAME) ||
+        !read_exact(probe, reply, sizeof(reply)))
+      break;
+    rtt_us.push_back(std::chrono::duration<double, std::micro>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count());
+  }
+  const MetricsSnapshot after = server.metrics();
+
+  stop = true;
+  ::close(probe);
+  for (int fd : hog_fds)
+    ::shutdown(fd, SHUT_RDWR);
+  for (auto &t : hogs)
+    t.join();
+  for (int fd : hog_fds)
+    ::close(fd);
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+
+  std::sort(rtt_us.begin(), rtt_us.end());
+  auto pct = [&](double p) {
+    if (rtt_us.empty())
+      return 0.0;
+    size_t i = static_cast<size_t>(p / 100.0 * (rtt_us.size() - 1));
+    return rtt_us[i];
+  };
+  const uint64_t waits =
+      after.events_per_wait.count() - before.events_per_wait.count();
+  const uint64_t events = after.events_per_wait.sum - before.events_per_wait.sum;
+
+  BenchReport("fairness")
+      .field("mode", mode)
+      .field("io_budget", static_cast<uint64_t>(io_budget))
+      .field("hogs", static_cast<uint64_t>(HOGS))
+      .field("round_trips", static_cast<uint64_t>(rtt_us.size()))
+      .field("p50_us", pct(50))
+      .field("p99_us", pct(99))
+      .field("max_us", pct(100))
+      .field("epoll_waits", waits)
+      .field("events_per_wait",
+             waits ? static_cast<double>(events) / waits : 0.0)
+      .field("io_deferred", after.io_deferred - before.io_deferred)
+      .field("mb_echoed",
+             static_cast<double>(after.bytes_written - before.bytes_written) /
+                 (1024.0 * 1024.0))
+      .emit();
+}
+
+int main(int argc, char **argv)
+{
+  int count = argc > 1 ? std::atoi(argv[1]) : 2000;
+
+  // Connection logs stay off the report.
+  std::cout.flush();
+  const int saved_err = ::dup(STDERR_FILENO);
+  const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  ::dup2(null_fd, STDERR_FILENO);
+
+  bench_fairness("level", false, 1 << 30, count);
+  bench_fairness("level", false, 64 * 1024, count);
+  bench_fairness("edge", true, 64 * 1024, count);
+  bench_fairness("edge", true, 16 * 1024, count);
+
+  ::dup2(saved_err, STDERR_FILENO);
+  ::close(saved_err);
+  ::close(null_fd);
+  return 0;
+}
@@ -0,0 +1,191 @@
+// Key-value throughput through the framed protocol.
+//
+// Real Servers on 127.0.0.1 (one per reactor, sharing the port through
+// SO_REUSEPORT), so the numbers include framing, command dispatch and,
+// with more than one reactor, the mailbox hop for keys another reactor
+// owns. Each client thread keeps `pipeline` requests in flight on one
+// blocking connection: 90% GET, 10% SET over a preloaded key space.
+
+#include "bench_util.h"
+#include "config.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <netinet/in.h>
+#include <random>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static constexpr int KEYS = 10000;
+static constexpr size_t VALUE_BYTES = 32;
+
+// Reads `count` framed replies; false on error or an "ERR" reply.
+static bool read_replies(int fd, int count, std::string &buf)
+{
+  size_t pos = 0;
+  char chunk[16 * 1024];
+  while (count > 0)
+  {
+    if (buf.size() - pos >= 4)
+    {
+      uint32_t len;
+      std::memcpy(&len, buf.data() + pos, sizeof(len));
+      len = ntohl(len);
+      if (buf.size() - pos - 4 >= len)
+      {
+        if (buf.compare(pos + 4, 3, "ERR") == 0)
+          return false;
+        pos += 4 + len;
+        --count;
+        continue;
+      }
+    }
+    ssize_t n = ::read(fd, chunk, sizeof(chunk));
+    if (n <= 0)
+      return false;
+    buf.append(chunk, static_cast<size_t>(n));
+  }
+  buf.erase(0, pos);
+  return true;
+}
+
+static void preload(const sockaddr_in &addr)
+{
+  int fd = connect_to(addr);
+  const std::string value(VALUE_BYTES, 'v');
+  std::string reply;
+  for (int base = 0; base < KEYS; base += 500)
+  {
+    std::string batch;
+    for (int k = base; k < base + 500; ++k)
+      append_frame(batch, "SET key:" + std::to_string(k) + " " + value);
+    if (!send_all(fd, batch) || !read_replies(fd, 500, reply))
+    {
+      std::fprintf(stderr, "preload failed\n");
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  ::close(fd);
+}
+
+static void bench_kv(int reactors, int clients, int pipeline, double seconds)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.threads = reactors;
+  cfg.max_frame_rate = 0; // the benchmark is a deliberate flood
+
+  std::vector<int> listeners;
+  sockaddr_in addr{};
+  for (int r = 0; r < reactors; ++r)
+  {
+    uint16_t port = r == 0 ? 0 : ntohs(addr.sin_port);
+    int fd = create_listening_socket(port, cfg.backlog, cfg.recv_buffer_bytes,
+                                     cfg.send_buffer_bytes, true);
+    set_nonblocking(fd);
+    if (r == 0)
+    {
+      socklen_t len = sizeof(addr);
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+    listeners.push_back(fd);
+  }
+
+  // The server logs every accept and close; keep that out of the report.
+  auto *out = std::cout.rdbuf(nullptr);
+  auto *err = std::cerr.rdbuf(nullptr);
+
+  std::vector<std::unique_ptr<Server>> servers;
+  std::vector<Server *> raw;
+  for (int r = 0; r < reactors; ++r)
+  {
+    servers.push_back(std::make_unique<Server>(listeners[r], cfg, r));
+    raw.push_back(servers.back().get());
+  }
+  Server::install_reactors(raw);
+
+  std::vector<std::thread> loops;
+  for (Server *s : raw)
+    loops.emplace_back([s] { s->run(); });
+
+  preload(addr);
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> total_ops{0};
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> workers;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int c = 0; c < clients; ++c)
+  {
+    workers.emplace_back([&, c] {
+      int fd = connect_to(addr);
+      std::mt19937 rng(static_cast<unsigned>(c) + 1);
+      const std::string value(VALUE_BYTES, 'w');
+      std::string batch, reply;
+      uint64_t ops = 0;
+
+      while (!done.load(std::memory_order_relaxed))
+      {
+        batch.clear();
+        for (int i = 0; i < pipeline; ++i)
+        {
+          std::string key = "key:" + std::to_string(rng() % KEYS);
+          append_frame(batch, rng() % 10 == 0 ? "SET " + key + " " + value
+                                              : "GET " + key);
+        }
+        if (!send_all(fd, batch) || !read_replies(fd, pipeline, reply))
+        {
+          failed = true;
+          break;
+        }
+        ops += static_cast<uint64_t>(pipeline);
+      }
+      total_ops += ops;
+      ::close(fd);
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  done = true;
+  for (std::thread &t : workers)
+    t.join();
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  for (Server *s : raw)
+    s->stop();
+  for (std::thread &t : loops)
+    t.join();
+  Server::uninstall_reactors();
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+
+  BenchReport("kv")
+      .field("reactors", static_cast<uint64_t>(reactors))
+      .field("clients", static_cast<uint64_t>(clients))
+      .field("pipeline", static_cast<uint64_t>(pipeline))
+      .field("mix", "get=90,set=10")
+      .field("ops", total_ops.load())
+      .field("ops_per_sec", static_cast<double>(total_ops.load()) / elapsed)
+      .field("ok", failed ? "false" : "true")
+      .emit();
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 2.0;
+
+  for (int reactors : {1, 2, 4})
+    bench_kv(reactors, 4, 32, seconds);
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Cost of a log call on the reactor thread.
+//
+//   enabled   LOG_INFO with three arguments: one record copied into the
+//             thread's ring. Timed in bursts that fit the ring, with a
+//             pause between them for the logger thread to drain it.
+//   disabled  LOG_DEBUG while the runtime level is info: a relaxed load
+//             and a compare. Below NETLAB_LOG_MIN_LEVEL it is no code.
+//   overflow  A tight loop far faster than the logger drains: records
+//             are dropped and counted, and the caller never waits.
+//
+// Log lines go to /dev/null while the bench runs.
+
+#include "bench_util.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+int main()
+{
+  std::cout.flush();
+  const int saved_out = ::dup(STDOUT_FILENO);
+  const int saved_err = ::dup(STDERR_FILENO);
+  const int null_fd = ::open("/dev/null", O_WRONLY);
+  ::dup2(null_fd, STDOUT_FILENO);
+  ::dup2(null_fd, STDERR_FILENO);
+
+  Logger::start(LogLevel::INFO);
+
+  constexpr uint64_t BURST = 1024;
+  constexpr int BURSTS = 200;
+  double enabled_ns = 0;
+  uint64_t fd = 0;
+  for (int b = 0; b < BURSTS; ++b)
+  {
+    enabled_ns += time_per_op_ns(BURST, [&] {
+      LOG_INFO("[reactor {}] Accepted client fd={} (active={})", 0, fd, fd);
+      ++fd;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  enabled_ns /= BURSTS;
+  const uint64_t burst_drops = Logger::dropped();
+
+  constexpr uint64_t ITERS = 50'000'000;
+  double disabled_ns = time_per_op_ns(ITERS, [&] {
+    LOG_DEBUG("[reactor {}] never formatted fd={}", 0, fd);
+    do_not_optimize(fd);
+  });
+
+  constexpr uint64_t FLOOD = 1'000'000;
+  double overflow_ns = time_per_op_ns(FLOOD, [&] {
+    LOG_INFO("[CLOSE] fd={} reason={}", fd, "client FIN");
+  });
+  const uint64_t flood_drops = Logger::dropped() - burst_drops;
+
+  Logger::stop();
+  ::dup2(saved_out, STDOUT_FILENO);
+  ::dup2(saved_err, STDERR_FILENO);
+
+  BenchReport("logger")
+      .field("op", "enabled")
+      .field("ns_per_op", enabled_ns)
+      .field("dropped", burst_drops)
+      .emit();
+  BenchReport("logger")
+      .field("op", "disabled")
+      .field("ns_per_op", disabled_ns)
+      .emit();
+  BenchReport("logger")
+      .field("op", "overflow")
+      .field("records", FLOOD)
+      .field("ns_per_op", overflow_ns)
+      .field("dropped", flood_drops)
+      .emit();
+  return 0;
+}
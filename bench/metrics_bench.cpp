@@ -0,0 +1,41 @@
+// Hot-path cost of the reactor metrics: one counter add, one histogram
+// record, and the clock pair that brackets each command for service time.
+
+#include "bench_util.h"
+#include "metrics.h"
+
+#include <chrono>
+
+int main()
+{
+  constexpr uint64_t ITERS = 50'000'000;
+  Metrics m;
+
+  double add_ns = time_per_op_ns(ITERS, [&] { Metrics::add(m.frames_received); });
+  BenchReport("metrics").field("op", "counter_add").field("ns_per_op", add_ns).emit();
+
+  uint64_t v = 1;
+  double record_ns = time_per_op_ns(ITERS, [&] {
+    m.read_bytes.record(v);
+    v = v * 6364136223846793005ull + 1442695040888963407ull;
+  });
+  BenchReport("metrics")
+      .field("op", "histogram_record")
+      .field("ns_per_op", record_ns)
+      .emit();
+
+  double timed_ns = time_per_op_ns(ITERS / 10, [&] {
+    auto start = std::chrono::steady_clock::now();
+    m.service_ns.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count()));
+  });
+  BenchReport("metrics")
+      .field("op", "service_time_sample")
+      .field("ns_per_op", timed_ns)
+      .emit();
+
+  do_not_optimize(m.snapshot());
+  return 0;
+}
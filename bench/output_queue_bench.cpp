@@ -0,0 +1,139 @@
+// Bytes copied and time per ECHO response: the original contiguous
+// write_buffer path versus the refcounted OutputQueue + writev path.
+//
+// Both paths drain through the same fake socket, which accepts at most
+// SOCKET_ACCEPT bytes per call and copies nothing, so the numbers only
+// reflect user-space buffer management.
+
+#include "bench_util.h"
+#include "output_queue.h"
+
+#include <arpa/inet.h>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static constexpr size_t SOCKET_ACCEPT = 64 * 1024;
+
+static size_t fake_writev(const iovec *iov, int cnt)
+{
+  size_t total = 0;
+  for (int i = 0; i < cnt; ++i)
+    total += iov[i].iov_len;
+  return total < SOCKET_ACCEPT ? total : SOCKET_ACCEPT;
+}
+
+// Mirrors the pre-OutputQueue code: the frame is copied out of the read
+// buffer, into a command string, through substr() and a vector, then into
+// write_buffer, which is drained with erase-from-front.
+struct LegacyPath
+{
+  std::vector<uint8_t> write_buffer;
+  uint64_t copied = 0;
+
+  void respond(const std::vector<uint8_t> &read_buffer)
+  {
+    std::vector<uint8_t> frame(read_buffer.begin(), read_buffer.end());
+    copied += frame.size();
+
+    std::string cmd(reinterpret_cast<const char *>(frame.data()), frame.size());
+    copied += cmd.size();
+
+    const std::string payload = cmd.substr(5);
+    copied += payload.size();
+
+    std::vector<uint8_t> out(payload.begin(), payload.end());
+    copied += out.size();
+
+    uint32_t len = htonl(out.size());
+    size_t off = write_buffer.size();
+    write_buffer.resize(off + 4 + out.size());
+    std::memcpy(write_buffer.data() + off, &len, 4);
+    std::memcpy(write_buffer.data() + off + 4, out.data(), out.size());
+    copied += 4 + out.size();
+  }
+
+  void drain()
+  {
+    while (!write_buffer.empty())
+    {
+      iovec iov{write_buffer.data(), write_buffer.size()};
+      size_t n = fake_writev(&iov, 1);
+      copied += write_buffer.size() - n; // bytes shifted by erase()
+      write_buffer.erase(write_buffer.begin(), write_buffer.begin() + n);
+    }
+  }
+};
+
+struct QueuePath
+{
+  OutputQueue queue;
+  uint64_t copied = 0;
+
+  void respond(const std::vector<uint8_t> &read_buffer)
+  {
+    ConstByteSpan body{read_buffer.data() + 5, read_buffer.size() - 5};
+    queue.push(FrameRef(FrameBuffer::copy_of(body)));
+    copied += body.size;
+  }
+
+  void drain()
+  {
+    iovec iov[IOV_MAX];
+    while (!queue.empty())
+    {
+      int cnt = queue.fill_iov(iov, IOV_MAX);
+      queue.consume(fake_writev(iov, cnt));
+    }
+  }
+};
+
+template <typename Path>
+static void run(const char *variant, size_t payload, int pipeline)
+{
+  std::vector<uint8_t> request(5 + payload, 'x');
+  std::memcpy(request.data(), "ECHO ", 5);
+
+  const uint64_t target_bytes = 256ull * 1024 * 1024;
+  uint64_t iters = target_bytes / (payload * pipeline);
+  if (iters < 16)
+    iters = 16;
+  if (iters > 200000)
+    iters = 200000;
+
+  Path path;
+  double ns = time_per_op_ns(iters, [&] {
+    for (int i = 0; i < pipeline; ++i)
+      path.respond(request);
+    path.drain();
+  });
+
+  const uint64_t responses = iters * pipeline;
+  BenchReport("output_queue")
+      .field("variant", variant)
+      .field("payload_bytes", static_cast<uint64_t>(payload))
+      .field("pipeline", static_cast<uint64_t>(pipeline))
+      .field("bytes_copied_per_response",
+             static_cast<double>(path.copied) / responses)
+      .field("ns_per_response", ns / pipeline)
+      .emit();
+}
+
+int main()
+{
+  const size_t payloads[] = {4, 64, 1024, 16 * 1024, 256 * 1024, 1024 * 1024};
+  const int pipelines[] = {1, 64};
+
+  for (int pipeline : pipelines)
+  {
+    for (size_t payload : payloads)
+    {
+      if (payload * pipeline > 4 * 1024 * 1024)
+        continue;
+      run<LegacyPath>("legacy_contiguous", payload, pipeline);
+      run<QueuePath>("refcounted_writev", payload, pipeline);
+    }
+  }
+  return 0;
+}
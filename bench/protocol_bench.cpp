@@ -0,0 +1,242 @@
+// The request path piece by piece, without the network stack:
+//
+//   framing   Connection::next_frame() over a stream of ECHO frames
+//             delivered in 1-byte, MTU-sized and 64 KB coalesced reads,
+//             for both wire protocols.
+//   dispatch  CommandRouter::route() over the server's own command table:
+//             text frames and v2 opcodes.
+//   loopback  A real Server (epoll and io_uring) serving one end of a
+//             socketpair, so framing, dispatch, handlers and the output
+//             queue run together with only AF_UNIX copies beneath them.
+//
+// queue_frame() costs per payload size are in bench_output_queue.
+
+#include "bench_util.h"
+#include "command_router.h"
+#include "config.h"
+#include "connection.h"
+#include "protocol.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static constexpr size_t ECHO_BYTES = 32;
+
+static void append_v2(std::string &out, Opcode op, const std::string &payload,
+                      uint64_t id)
+{
+  V2Header h;
+  h.opcode = static_cast<uint8_t>(op);
+  h.length = static_cast<uint32_t>(payload.size());
+  h.request_id = id;
+  uint8_t header[V2Header::SIZE];
+  h.encode(header);
+  out.append(reinterpret_cast<const char *>(header), sizeof(header));
+  out += payload;
+}
+
+// ---------- framing ----------
+
+static void bench_framing(const char *protocol, const std::string &stream,
+                          uint64_t frames, size_t segment)
+{
+  Connection conn;
+  uint64_t parsed = 0;
+  bool ok = true;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t pos = 0; pos < stream.size() && ok; pos += segment)
+  {
+    size_t n = std::min(segment, stream.size() - pos);
+    conn.read_buffer.append(stream.data() + pos, n);
+
+    ConstByteSpan frame;
+    Connection::FrameStatus st;
+    while ((st = conn.next_frame(frame)) == Connection::FrameStatus::READY)
+    {
+      do_not_optimize(frame.data);
+      conn.finish_frame();
+      ++parsed;
+    }
+    ok = st == Connection::FrameStatus::NEED_MORE;
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  BenchReport("framing")
+      .field("protocol", protocol)
+      .field("segment_bytes", static_cast<uint64_t>(segment))
+      .field("frames", parsed)
+      .field("ns_per_frame", ns / static_cast<double>(parsed))
+      .field("mb_per_sec", static_cast<double>(stream.size()) / ns * 1e3)
+      .field("ok", ok && parsed == frames ? "true" : "false")
+      .emit();
+}
+
+static void framing()
+{
+  const std::string echo = "ECHO " + std::string(ECHO_BYTES, 'x');
+  const uint64_t frames = 200000;
+
+  std::string v1, v2;
+  for (uint64_t i = 0; i < frames; ++i)
+  {
+    append_frame(v1, echo);
+    append_v2(v2, Opcode::ECHO, std::string(ECHO_BYTES, 'x'), i);
+  }
+
+  // 1448: a full Ethernet segment's TCP payload.
+  for (size_t segment : {size_t{1}, size_t{1448}, size_t{64 * 1024}})
+  {
+    bench_framing("v1", v1, frames, segment);
+    bench_framing("v2", v2, frames, segment);
+  }
+}
+
+// ---------- dispatch ----------
+
+static void dispatch()
+{
+  const CommandRouter &router = Server::command_router();
+  const uint64_t iters = 2000000;
+
+  const std::string_view text[] = {
+      "PING",         "ECHO hello",   "GET user:1001",   "SET user:1001 v",
+      "DEL user:1001", "MGET a b c",  "EXPIRE k 10",     "STATS",
+      "PING\r\n",     "NOPE x",
+  };
+  const size_t n_text = sizeof(text) / sizeof(text[0]);
+  size_t i = 0;
+  double ns = time_per_op_ns(iters, [&] {
+    CommandRouter::Match m = router.route(text[i]);
+    do_not_optimize(m);
+    i = i + 1 == n_text ? 0 : i + 1;
+  });
+  BenchReport("dispatch")
+      .field("protocol", "v1")
+      .field("commands", static_cast<uint64_t>(n_text))
+      .field("ns_per_route", ns)
+      .emit();
+
+  const uint8_t ops[] = {1, 2, 6, 7, 8, 9, 10, 3, 0};
+  const size_t n_ops = sizeof(ops);
+  i = 0;
+  ns = time_per_op_ns(iters, [&] {
+    CommandRouter::Match m = router.route(ops[i], "user:1001");
+    do_not_optimize(m);
+    i = i + 1 == n_ops ? 0 : i + 1;
+  });
+  BenchReport("dispatch")
+      .field("protocol", "v2")
+      .field("commands", static_cast<uint64_t>(n_ops))
+      .field("ns_per_route", ns)
+      .emit();
+}
+
+// ---------- loopback ----------
+
+static void bench_loopback(ServerConfig::IoBackend backend,
+                           const char *command, size_t payload, int depth,
+                           uint64_t requests)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.max_frame_rate = 0;
+  cfg.io_backend = backend;
+
+  int sv[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+  {
+    std::perror("socketpair");
+    std::exit(EXIT_FAILURE);
+  }
+  set_nonblocking(sv[0]);
+
+  // The Server needs a listener; nothing connects to it.
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+
+  auto *out = std::cout.rdbuf(nullptr);
+  auto *err = std::cerr.rdbuf(nullptr);
+
+  Server server(listen_fd, cfg, 0);
+  Server::install_reactors({&server});
+  server.adopt(sv[0]);
+  std::thread loop([&server] { server.run(); });
+
+  std::string msg = command;
+  if (payload > 0)
+    msg += " " + std::string(payload, 'x');
+  std::string batch;
+  for (int i = 0; i < depth; ++i)
+    append_frame(batch, msg);
+  const size_t reply_bytes =
+      static_cast<size_t>(depth) * (4 + (payload > 0 ? payload : 4));
+  std::vector<char> replies(reply_bytes);
+
+  bool ok = true;
+  uint64_t done = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (done < requests && ok)
+  {
+    ok = send_all(sv[1], batch) &&
+         read_exact(sv[1], replies.data(), replies.size());
+    done += static_cast<uint64_t>(depth);
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  ::close(sv[1]);
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+
+  // Asked for io_uring, the server may have fallen back to epoll.
+  BenchReport("loopback")
+      .field("backend", server.backend_name())
+      .field("command", command)
+      .field("payload_bytes", static_cast<uint64_t>(payload))
+      .field("depth", static_cast<uint64_t>(depth))
+      .field("requests", done)
+      .field("req_per_sec", static_cast<double>(done) / elapsed)
+      .field("ns_per_request", elapsed * 1e9 / static_cast<double>(done))
+      .field("ok", ok ? "true" : "false")
+      .emit();
+}
+
+static void loopback(uint64_t requests)
+{
+  for (auto backend :
+       {ServerConfig::IoBackend::EPOLL, ServerConfig::IoBackend::URING})
+  {
+    for (int depth : {1, 32})
+    {
+      bench_loopback(backend, "PING", 0, depth, requests);
+      bench_loopback(backend, "ECHO", 1024, depth, requests);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+
+  framing();
+  dispatch();
+  loopback(requests);
+  return 0;
+}
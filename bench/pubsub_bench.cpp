@@ -0,0 +1,158 @@
+// Cost of one PUBLISH fanned out to many subscribers.
+//
+// A real Server on 127.0.0.1 with one reactor. `subscribers` connections
+// SUBSCRIBE to one topic; a publisher then sends `rounds` PUBLISH frames
+// one at a time and each round ends when every subscriber has read its
+// copy. Reported per round: heap allocations (process-wide, by replacing
+// the global operator new, less the one frame string send_frame() builds
+// per PUBLISH on the client side), time from send until the last
+// subscriber has the message, and that time per subscriber.
+//
+// The message is built once and every subscriber's output queue holds a
+// reference to it, so allocations per publish stay flat as the number
+// of subscribers grows.
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench_util.h"
+#include "config.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <new>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+  const int subscribers = argc > 1 ? std::atoi(argv[1]) : 5000;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+  const std::string publish = "PUBLISH bench " + std::string(64, 'm');
+  const size_t delivered = 4 + std::strlen("MESSAGE ") +
+                           publish.size() - std::strlen("PUBLISH ");
+
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.max_frame_rate = 0;
+  cfg.max_connections_per_ip = 0;
+  cfg.max_connections = 2 * subscribers + 64;
+  cfg.backlog = 1024;
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  // Connection logs stay off the report.
+  std::cout.flush();
+  const int saved_err = ::dup(STDERR_FILENO);
+  const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  ::dup2(null_fd, STDERR_FILENO);
+
+  Server server(listen_fd, cfg, 0);
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  const int ep = ::epoll_create1(0);
+  std::vector<int> subs;
+  char reply[64];
+  for (int i = 0; i < subscribers; ++i)
+  {
+    const int fd = connect_to(addr);
+    check(send_frame(fd, "SUBSCRIBE bench") && read_exact(fd, reply, 6),
+          "subscribe"); // ":1"
+    set_nonblocking(fd);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(subs.size());
+    ::epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    subs.push_back(fd);
+  }
+  const int pub = connect_to(addr);
+
+  std::vector<size_t> pending(subs.size());
+  std::vector<epoll_event> events(1024);
+  std::vector<char> buf(64 * 1024);
+  auto one_round = [&] {
+    std::fill(pending.begin(), pending.end(), delivered);
+    size_t left = subs.size();
+    check(send_frame(pub, publish) && read_exact(pub, reply, 6),
+          "publish"); // "OK"
+    while (left > 0)
+    {
+      int n = ::epoll_wait(ep, events.data(), static_cast<int>(events.size()),
+                           5000);
+      if (n <= 0)
+      {
+        std::cerr << "subscribers stalled\n";
+        std::exit(EXIT_FAILURE);
+      }
+      for (int e = 0; e < n; ++e)
+      {
+        const uint32_t i = events[e].data.u32;
+        ssize_t r;
+        while ((r = ::read(subs[i], buf.data(), buf.size())) > 0)
+        {
+          const size_t got = static_cast<size_t>(r);
+          const size_t before = pending[i];
+          pending[i] = got >= before ? 0 : before - got;
+          if (before > 0 && pending[i] == 0)
+            --left;
+        }
+      }
+    }
+  };
+
+  // send_frame() copies `publish` into a frame string each round; that
+  // one client-side allocation is counted and subtracted below.
+  for (int i = 0; i < 20; ++i)
+    one_round();
+
+  uint64_t allocs = 0;
+  double total_us = 0;
+  for (int i = 0; i < rounds; ++i)
+  {
+    const uint64_t a0 = g_allocs.load(std::memory_order_relaxed);
+    auto t0 = std::chrono::steady_clock::now();
+    one_round();
+    total_us += std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+    allocs += g_allocs.load(std::memory_order_relaxed) - a0 - 1;
+  }
+  const MetricsSnapshot m = server.metrics();
+
+  ::close(pub);
+  for (int fd : subs)
+    ::close(fd);
+  ::close(ep);
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+  ::dup2(saved_err, STDERR_FILENO);
+  ::close(saved_err);
+  ::close(null_fd);
+
+  BenchReport("pubsub")
+      .field("subscribers", static_cast<uint64_t>(subscribers))
+      .field("rounds", static_cast<uint64_t>(rounds))
+      .field("allocs_per_publish", static_cast<double>(allocs) / rounds)
+      .field("fanout_us", total_us / rounds)
+      .field("ns_per_subscriber", total_us * 1000.0 / rounds / subscribers)
+      .field("delivered", m.messages_delivered)
+      .field("dropped", m.messages_dropped)
+      .emit();
+  return 0;
+}
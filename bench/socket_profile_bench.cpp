@@ -0,0 +1,138 @@
+// Round-trip latency under each --socket-profile.
+//
+// A real Server on 127.0.0.1 with the profile's listener and accepted-
+// socket options. One client connection keeps `depth` PINGs in flight,
+// each sent with its own write() so small segments meet Nagle and
+// delayed ACKs the way a chatty client would produce them. Reported
+// latency is per request, from its write to its reply.
+//
+// Loopback has no NIC queue to busy-poll and a single receive CPU, so the
+// busy-poll and steering options show up here only as their syscall
+// cost; run against a remote client to see their effect.
+
+#include "bench_util.h"
+#include "config.h"
+#include "server.h"
+#include "socket_utils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char PING_FRAME[] = {0, 0, 0, 4, 'P', 'I', 'N', 'G'};
+static constexpr size_t PONG_FRAME = 8;
+
+static uint64_t percentile(std::vector<uint64_t> &v, double p)
+{
+  size_t i = static_cast<size_t>(p / 100.0 * static_cast<double>(v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + static_cast<long>(i), v.end());
+  return v[i];
+}
+
+static void bench_profile(const char *name, const ServerConfig::SocketTuning &t,
+                          int depth, int requests)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.max_frame_rate = 0;
+  cfg.sock = t;
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+  tune_listening_socket(listen_fd, cfg.sock, 0);
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  // The server logs every accept and close; keep that out of the report.
+  auto *out = std::cout.rdbuf(nullptr);
+  auto *err = std::cerr.rdbuf(nullptr);
+
+  Server server(listen_fd, cfg, 0);
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  int fd = connect_to(addr);
+  // The client side mirrors the server's Nagle choice.
+  int nodelay = t.nodelay ? 1 : 0;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  std::vector<uint64_t> latency_ns;
+  latency_ns.reserve(static_cast<size_t>(requests));
+  std::vector<std::chrono::steady_clock::time_point> sent(
+      static_cast<size_t>(depth));
+  char reply[PONG_FRAME];
+  bool ok = true;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int done = 0; done < requests && ok; done += depth)
+  {
+    for (int i = 0; i < depth; ++i)
+    {
+      sent[static_cast<size_t>(i)] = std::chrono::steady_clock::now();
+      ok = ok && ::write(fd, PING_FRAME, sizeof(PING_FRAME)) ==
+                     static_cast<ssize_t>(sizeof(PING_FRAME));
+    }
+    for (int i = 0; i < depth && ok; ++i)
+    {
+      ok = read_exact(fd, reply, sizeof(reply)) &&
+           std::memcmp(reply + 4, "PONG", 4) == 0;
+      latency_ns.push_back(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - sent[static_cast<size_t>(i)])
+              .count()));
+    }
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  ::close(fd);
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+
+  BenchReport("socket_profile")
+      .field("profile", name)
+      .field("depth", static_cast<uint64_t>(depth))
+      .field("requests", static_cast<uint64_t>(latency_ns.size()))
+      .field("req_per_sec", static_cast<double>(latency_ns.size()) / elapsed)
+      .field("p50_ns", percentile(latency_ns, 50))
+      .field("p99_ns", percentile(latency_ns, 99))
+      .field("ok", ok ? "true" : "false")
+      .emit();
+}
+
+int main(int argc, char **argv)
+{
+  int requests = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+  using P = ServerConfig::SocketProfile;
+  ServerConfig::SocketTuning nagle = ServerConfig::socket_profile(P::DEFAULT);
+  nagle.nodelay = false;
+
+  const std::pair<const char *, ServerConfig::SocketTuning> profiles[] = {
+      {"default", ServerConfig::socket_profile(P::DEFAULT)},
+      {"latency", ServerConfig::socket_profile(P::LATENCY)},
+      {"throughput", ServerConfig::socket_profile(P::THROUGHPUT)},
+      {"nagle", nagle}, // default with TCP_NODELAY off, for comparison
+  };
+
+  for (const auto &p : profiles)
+  {
+    for (int depth : {1, 8})
+      bench_profile(p.first, p.second, depth, requests);
+  }
+  return 0;
+}
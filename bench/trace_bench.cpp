@@ -0,0 +1,111 @@
+// Cost of sampled tracing on the request path.
+//
+// A real Server on 127.0.0.1 with one reactor and one client connection
+// sending PINGs in pipelined batches. The same run is repeated with
+// tracing off, at one frame in 1000, and with every frame that can be
+// traced (sample 1, which arms whenever the read buffer runs empty).
+// Reported per mode: nanoseconds per request and frames traced.
+//
+// Off, the only work left is a test of the reactor's trace ring per frame
+// and of the connection's trace stage per read and write, so "off" and
+// "1000" should be within noise of each other.
+
+#include "bench_util.h"
+#include "config.h"
+#include "server.h"
+#include "socket_utils.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+static void run(int sample, int batches, int batch)
+{
+  ServerConfig cfg = ServerConfig::defaults();
+  cfg.max_frame_rate = 0;
+  cfg.trace_sample = sample;
+
+  int listen_fd = create_listening_socket(0, cfg.backlog, cfg.recv_buffer_bytes,
+                                          cfg.send_buffer_bytes);
+  set_nonblocking(listen_fd);
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  const std::string path = "bench_trace." + std::to_string(::getpid());
+  TraceFile trace;
+  Server server(listen_fd, cfg, 0);
+  if (sample > 0)
+  {
+    if (!trace.open(path, 1, static_cast<uint32_t>(sample)))
+    {
+      std::perror("trace file");
+      std::exit(EXIT_FAILURE);
+    }
+    ::unlink(path.c_str()); // the mapping is all the run needs
+    server.set_trace(trace.ring(0));
+  }
+  Server::install_reactors({&server});
+  std::thread loop([&server] { server.run(); });
+
+  int fd = connect_to(addr);
+  set_nodelay(fd);
+
+  std::string request;
+  for (int i = 0; i < batch; ++i)
+    request += std::string("\0\0\0\4PING", 8);
+  const size_t reply = static_cast<size_t>(batch) * 8; // [len]PONG
+  std::string buf(reply, '\0');
+
+  auto one_batch = [&] {
+    check(send_all(fd, request) && read_exact(fd, &buf[0], reply), "request");
+  };
+
+  for (int i = 0; i < batches / 10; ++i)
+    one_batch();
+  const double ns = time_per_op_ns(static_cast<uint64_t>(batches), one_batch) /
+                    batch;
+  const MetricsSnapshot m = server.metrics();
+
+  ::close(fd);
+  server.stop();
+  loop.join();
+  Server::uninstall_reactors();
+
+  BenchReport("trace")
+      .field("sample", static_cast<uint64_t>(sample))
+      .field("requests", static_cast<uint64_t>(batches) * batch)
+      .field("ns_per_request", ns)
+      .field("frames_traced", m.frames_traced)
+      .emit();
+}
+
+int main(int argc, char **argv)
+{
+  const int batches = argc > 1 ? std::atoi(argv[1]) : 20000;
+  const int batch = argc > 2 ? std::atoi(argv[2]) : 32;
+
+  // Connection logs stay off the report.
+  std::cout.flush();
+  const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  const int saved_err = ::dup(STDERR_FILENO);
+  ::dup2(null_fd, STDERR_FILENO);
+
+  for (int sample : {0, 1000, 1})
+    run(sample, batches, batch);
+
+  ::dup2(saved_err, STDERR_FILENO);
+  ::close(saved_err);
+  ::close(null_fd);
+  return 0;
+}
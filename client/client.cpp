@@ -0,0 +1,494 @@
+#include "client.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <endian.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *const COMMAND_NAMES[COMMAND_KINDS] = {"ping", "echo",
+                                                         "stats"};
+
+uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// ---------- histogram ----------
+
+LatencyHistogram::LatencyHistogram() : counts_(BUCKETS, 0) {}
+
+size_t LatencyHistogram::index_of(uint64_t value) {
+  if (value < SUB_COUNT)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - (SUB_BITS - 1);
+  return static_cast<size_t>(shift) * HALF + (value >> shift);
+}
+
+uint64_t LatencyHistogram::highest_of(size_t index) {
+  if (index < SUB_COUNT)
+    return index;
+  size_t shift = index / HALF - 1;
+  uint64_t sub = index - shift * HALF;
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+  counts_[index_of(value)]++;
+  count_++;
+  sum_ += value;
+  if (value < min_)
+    min_ = value;
+  if (value > max_)
+    max_ = value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < BUCKETS; ++i)
+    counts_[i] += other.counts_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.min_ < min_)
+    min_ = other.min_;
+  if (other.max_ > max_)
+    max_ = other.max_;
+}
+
+double LatencyHistogram::mean() const {
+  return count_ ? static_cast<double>(sum_ / count_) : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  if (count_ == 0)
+    return 0;
+
+  uint64_t target = static_cast<uint64_t>(p / 100.0 * count_ + 0.5);
+  if (target < 1)
+    target = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += counts_[i];
+    if (seen >= target)
+      return highest_of(i) < max_ ? highest_of(i) : max_;
+  }
+  return max_;
+}
+
+void LoadStats::merge(const LoadStats &o) {
+  for (int k = 0; k < COMMAND_KINDS; ++k) {
+    sent[k] += o.sent[k];
+    received[k] += o.received[k];
+    by_command[k].merge(o.by_command[k]);
+  }
+  bytes_sent += o.bytes_sent;
+  bytes_received += o.bytes_received;
+  error_replies += o.error_replies;
+  disconnects += o.disconnects;
+  latency.merge(o.latency);
+}
+
+// ---------- worker ----------
+
+static std::string make_frame(const std::string &payload) {
+  uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
+  std::string frame(reinterpret_cast<const char *>(&len), sizeof(len));
+  frame += payload;
+  return frame;
+}
+
+// v2 header (see server/protocol.h): version, opcode, flags, length,
+// request id; big-endian.
+static constexpr size_t V2_HEADER = 16;
+static const uint8_t V2_OPCODES[COMMAND_KINDS] = {1, 2, 3}; // PING ECHO STATS
+
+static void append_v2_header(std::string &out, uint8_t opcode, uint32_t len,
+                             uint64_t request_id) {
+  uint8_t h[V2_HEADER] = {2, opcode, 0, 0};
+  uint32_t l = htobe32(len);
+  uint64_t id = htobe64(request_id);
+  std::memcpy(h + 4, &l, sizeof(l));
+  std::memcpy(h + 8, &id, sizeof(id));
+  out.append(reinterpret_cast<const char *>(h), sizeof(h));
+}
+
+LoadWorker::LoadWorker(const LoadConfig &cfg, int connections, double rate,
+                       uint64_t seed)
+    : cfg_(cfg), rate_(rate), rng_(seed | 1), conns_(connections) {
+  if (rate_ > 0 && connections > 0)
+    interval_ns_ = static_cast<uint64_t>(1e9 * connections / rate_);
+
+  frames_[static_cast<int>(Command::PING)] = make_frame("PING");
+  frames_[static_cast<int>(Command::ECHO)] =
+      make_frame("ECHO " + std::string(cfg.echo_bytes, 'x'));
+  frames_[static_cast<int>(Command::STATS)] = make_frame("STATS");
+  payloads_[static_cast<int>(Command::ECHO)] = std::string(cfg.echo_bytes, 'x');
+}
+
+LoadWorker::~LoadWorker() {
+  for (Conn &c : conns_) {
+    if (c.fd >= 0)
+      ::close(c.fd);
+  }
+  if (epoll_fd_ >= 0)
+    ::close(epoll_fd_);
+}
+
+bool LoadWorker::connect_all() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::perror("epoll_create1");
+    return false;
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  std::string port = std::to_string(cfg_.port);
+  int rc = getaddrinfo(cfg_.host.c_str(), port.c_str(), &hints, &res);
+  if (rc != 0) {
+    std::cerr << "getaddrinfo: " << gai_strerror(rc) << "\n";
+    return false;
+  }
+
+  bool ok = true;
+  for (Conn &c : conns_) {
+    c.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c.fd < 0 || ::connect(c.fd, res->ai_addr, res->ai_addrlen) < 0) {
+      std::perror("connect");
+      ok = false;
+      break;
+    }
+
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int flags = fcntl(c.fd, F_GETFL, 0);
+    fcntl(c.fd, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &c;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev) < 0) {
+      std::perror("epoll_ctl ADD");
+      ok = false;
+      break;
+    }
+  }
+
+  freeaddrinfo(res);
+  return ok;
+}
+
+Command LoadWorker::pick_command() {
+  // xorshift64: the mix only needs to be cheap and reproducible.
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 7;
+  rng_ ^= rng_ << 17;
+
+  int total = cfg_.mix[0] + cfg_.mix[1] + cfg_.mix[2];
+  int roll = static_cast<int>(rng_ % static_cast<uint64_t>(total));
+  for (int k = 0; k < COMMAND_KINDS; ++k) {
+    if (roll < cfg_.mix[k])
+      return static_cast<Command>(k);
+    roll -= cfg_.mix[k];
+  }
+  return Command::PING;
+}
+
+void LoadWorker::send_request(Conn &c, uint64_t start_ns) {
+  Command cmd = pick_command();
+  const int k = static_cast<int>(cmd);
+
+  if (cfg_.protocol == 2) {
+    const std::string &payload = payloads_[k];
+    uint64_t id = ++c.next_request_id;
+    append_v2_header(c.out, V2_OPCODES[k],
+                     static_cast<uint32_t>(payload.size()), id);
+    c.out += payload;
+    c.inflight.push_back({start_ns, cmd, id});
+    stats_.bytes_sent += V2_HEADER + payload.size();
+  } else {
+    const std::string &frame = frames_[k];
+    c.out += frame;
+    c.inflight.push_back({start_ns, cmd, 0});
+    stats_.bytes_sent += frame.size();
+  }
+  stats_.sent[k]++;
+}
+
+bool LoadWorker::flush(Conn &c) {
+  while (c.out_off < c.out.size()) {
+    ssize_t n = ::send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off,
+                       MSG_NOSIGNAL);
+    if (n > 0) {
+      c.out_off += static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    drop(c);
+    return false;
+  }
+
+  if (c.out_off == c.out.size()) {
+    c.out.clear();
+    c.out_off = 0;
+  }
+  update_interest(c);
+  return true;
+}
+
+void LoadWorker::update_interest(Conn &c) {
+  bool want = c.out_off < c.out.size();
+  if (want == c.want_write)
+    return;
+
+  epoll_event ev{};
+  ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+  ev.data.ptr = &c;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+  c.want_write = want;
+}
+
+void LoadWorker::drop(Conn &c) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c.fd, nullptr);
+  ::close(c.fd);
+  c.fd = -1;
+  c.inflight.clear();
+  stats_.disconnects++;
+}
+
+bool LoadWorker::on_readable(Conn &c, uint64_t now_ns) {
+  uint8_t buf[64 * 1024];
+  while (true) {
+    ssize_t n = ::read(c.fd, buf, sizeof(buf));
+    if (n > 0) {
+      stats_.bytes_received += static_cast<uint64_t>(n);
+      c.in.insert(c.in.end(), buf, buf + n);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    drop(c);
+    return false;
+  }
+
+  const size_t header = cfg_.protocol == 2 ? V2_HEADER : 4;
+  while (c.in.size() - c.in_off >= header) {
+    const uint8_t *h = c.in.data() + c.in_off;
+    uint32_t len;
+    uint64_t id = 0;
+    if (cfg_.protocol == 2) {
+      std::memcpy(&len, h + 4, sizeof(len));
+      std::memcpy(&id, h + 8, sizeof(id));
+      len = be32toh(len);
+      id = be64toh(id);
+    } else {
+      std::memcpy(&len, h, sizeof(len));
+      len = ntohl(len);
+    }
+    if (c.in.size() - c.in_off < header + len)
+      break;
+
+    complete(c, id, h + header, len, now_ns);
+    c.in_off += header + len;
+  }
+
+  if (c.in_off == c.in.size()) {
+    c.in.clear();
+    c.in_off = 0;
+  } else if (c.in_off > 64 * 1024) {
+    c.in.erase(c.in.begin(), c.in.begin() + static_cast<long>(c.in_off));
+    c.in_off = 0;
+  }
+  return true;
+}
+
+void LoadWorker::complete(Conn &c, uint64_t request_id, const uint8_t *payload,
+                          uint32_t len, uint64_t now_ns) {
+  if (len >= 3 && std::memcmp(payload, "ERR", 3) == 0)
+    stats_.error_replies++;
+
+  // v1 responses arrive in request order: match the oldest request in
+  // flight. v2 responses may overtake each other; match by request id
+  // (nearly always the front entry, so the search is short).
+  auto it = c.inflight.begin();
+  if (cfg_.protocol == 2)
+    it = std::find_if(c.inflight.begin(), c.inflight.end(),
+                      [&](const Pending &p) { return p.request_id == request_id; });
+  if (it == c.inflight.end())
+    return;
+  Pending p = *it;
+  c.inflight.erase(it);
+
+  uint64_t latency = now_ns > p.start_ns ? now_ns - p.start_ns : 0;
+  stats_.latency.record(latency);
+  stats_.by_command[static_cast<int>(p.cmd)].record(latency);
+  stats_.received[static_cast<int>(p.cmd)]++;
+}
+
+void LoadWorker::run(uint64_t start_ns, uint64_t end_ns) {
+  const size_t pipeline = static_cast<size_t>(cfg_.pipeline);
+
+  // Spread the open-loop schedules so connections do not fire in lockstep.
+  for (size_t i = 0; i < conns_.size(); ++i)
+    conns_[i].next_send_ns = start_ns + interval_ns_ * i / conns_.size();
+
+  std::vector<epoll_event> events(conns_.size() + 1);
+
+  while (true) {
+    uint64_t now = monotonic_ns();
+    if (now >= end_ns)
+      break;
+
+    // ---------- issue requests ----------
+    uint64_t next_due = end_ns;
+    for (Conn &c : conns_) {
+      if (c.fd < 0)
+        continue;
+
+      if (interval_ns_ == 0) {
+        while (c.inflight.size() < pipeline)
+          send_request(c, now);
+      } else {
+        // A request whose slot has passed keeps its scheduled start
+        // time while it waits for a free pipeline slot.
+        while (c.next_send_ns <= now && c.inflight.size() < pipeline) {
+          send_request(c, c.next_send_ns);
+          c.next_send_ns += interval_ns_;
+        }
+        // A full pipeline is woken by its next response instead.
+        if (c.inflight.size() < pipeline && c.next_send_ns < next_due)
+          next_due = c.next_send_ns;
+      }
+
+      if (!c.out.empty() && !c.want_write)
+        flush(c);
+    }
+
+    // ---------- wait ----------
+    timespec timeout{};
+    uint64_t wait_ns = next_due > now ? next_due - now : 0;
+    timeout.tv_sec = static_cast<time_t>(wait_ns / 1000000000ull);
+    timeout.tv_nsec = static_cast<long>(wait_ns % 1000000000ull);
+
+    int ready = epoll_pwait2(epoll_fd_, events.data(),
+                             static_cast<int>(events.size()), &timeout, nullptr);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      std::perror("epoll_pwait2");
+      return;
+    }
+
+    now = monotonic_ns();
+    for (int i = 0; i < ready; ++i) {
+      Conn &c = *static_cast<Conn *>(events[i].data.ptr);
+      if (c.fd < 0)
+        continue;
+      if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+          !on_readable(c, now))
+        continue;
+      if (events[i].events & EPOLLOUT)
+        flush(c);
+    }
+  }
+}
+
+// ---------- report ----------
+
+static double us(uint64_t ns) { return static_cast<double>(ns) / 1000.0; }
+
+static void json_latency(std::ostream &os, const LatencyHistogram &h) {
+  os << "{\"count\":" << h.count() << ",\"mean_us\":" << h.mean() / 1000.0
+     << ",\"p50_us\":" << us(h.percentile(50))
+     << ",\"p99_us\":" << us(h.percentile(99))
+     << ",\"p999_us\":" << us(h.percentile(99.9))
+     << ",\"max_us\":" << us(h.max()) << "}";
+}
+
+void print_report(const LoadConfig &cfg, const LoadStats &stats,
+                  double elapsed_s, bool json) {
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  for (int k = 0; k < COMMAND_KINDS; ++k) {
+    sent += stats.sent[k];
+    received += stats.received[k];
+  }
+  double rps = elapsed_s > 0 ? received / elapsed_s : 0;
+  double mb_in = elapsed_s > 0 ? stats.bytes_received / elapsed_s / 1e6 : 0;
+  double mb_out = elapsed_s > 0 ? stats.bytes_sent / elapsed_s / 1e6 : 0;
+  const LatencyHistogram &h = stats.latency;
+
+  if (json) {
+    std::cout << std::fixed << std::setprecision(3) << "{\"host\":\""
+              << cfg.host << "\",\"port\":" << cfg.port
+              << ",\"threads\":" << cfg.threads
+              << ",\"connections\":" << cfg.connections
+              << ",\"pipeline\":" << cfg.pipeline
+              << ",\"protocol\":" << cfg.protocol << ",\"mode\":\""
+              << (cfg.rate > 0 ? "open" : "closed")
+              << "\",\"target_rate\":" << cfg.rate
+              << ",\"echo_bytes\":" << cfg.echo_bytes
+              << ",\"duration_s\":" << elapsed_s << ",\"sent\":" << sent
+              << ",\"received\":" << received
+              << ",\"error_replies\":" << stats.error_replies
+              << ",\"disconnects\":" << stats.disconnects
+              << ",\"throughput_rps\":" << rps << ",\"rx_mb_s\":" << mb_in
+              << ",\"tx_mb_s\":" << mb_out << ",\"latency\":";
+    json_latency(std::cout, h);
+    std::cout << ",\"commands\":{";
+    bool first = true;
+    for (int k = 0; k < COMMAND_KINDS; ++k) {
+      if (stats.sent[k] == 0)
+        continue;
+      std::cout << (first ? "" : ",") << "\"" << COMMAND_NAMES[k] << "\":";
+      json_latency(std::cout, stats.by_command[k]);
+      first = false;
+    }
+    std::cout << "}}" << std::endl;
+    return;
+  }
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Target:      " << cfg.host << ":" << cfg.port << " ("
+            << cfg.threads << " threads, " << cfg.connections
+            << " connections, pipeline " << cfg.pipeline << ", protocol v"
+            << cfg.protocol << ", "
+            << (cfg.rate > 0 ? "open loop" : "closed loop") << ")\n";
+  std::cout << "Duration:    " << elapsed_s << " s\n";
+  std::cout << "Requests:    " << received << " completed, " << sent
+            << " sent, " << stats.error_replies << " ERR replies, "
+            << stats.disconnects << " disconnects\n";
+  std::cout << "Throughput:  " << rps << " req/s, " << std::setprecision(2)
+            << mb_out << " MB/s out, " << mb_in << " MB/s in\n";
+  std::cout << "Latency (us): p50 " << us(h.percentile(50)) << "  p99 "
+            << us(h.percentile(99)) << "  p99.9 " << us(h.percentile(99.9))
+            << "  max " << us(h.max()) << "  mean " << h.mean() / 1000.0
+            << "\n";
+  for (int k = 0; k < COMMAND_KINDS; ++k) {
+    if (stats.sent[k] == 0)
+      continue;
+    const LatencyHistogram &c = stats.by_command[k];
+    std::cout << "  " << std::left << std::setw(6) << COMMAND_NAMES[k]
+              << std::right << " n=" << c.count() << "  p50 "
+              << us(c.percentile(50)) << "  p99 " << us(c.percentile(99))
+              << "  p99.9 " << us(c.percentile(99.9)) << "  max "
+              << us(c.max()) << "\n";
+  }
+}
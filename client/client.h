@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 128 are exact, above that each power of two is split into 64 linear
+// sub-buckets, so any recorded value is reported within 1/64 (~1.6%).
+// Fixed size, no allocation after construction, cheap to merge.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void record(uint64_t value);
+  void merge(const LatencyHistogram &other);
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+
+  // Highest value equivalent to the p-th percentile (0 < p <= 100).
+  uint64_t percentile(double p) const;
+
+private:
+  static constexpr int SUB_BITS = 7;
+  static constexpr uint64_t SUB_COUNT = uint64_t{1} << SUB_BITS;
+  static constexpr uint64_t HALF = SUB_COUNT / 2;
+  static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * HALF + HALF;
+
+  static size_t index_of(uint64_t value);
+  static uint64_t highest_of(size_t index);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+  long double sum_ = 0;
+};
+
+enum class Command { PING, ECHO, STATS };
+constexpr int COMMAND_KINDS = 3;
+
+struct LoadConfig {
+  std::string host = "127.0.0.1";
+  uint16_t port = 8080;
+  int threads = 1;
+  int connections = 1;
+  int pipeline = 1;   // max requests in flight per connection
+  int echo_bytes = 64; // ECHO payload size
+  int mix[COMMAND_KINDS] = {100, 0, 0}; // relative weights, by Command
+  double rate = 0;     // total requests/s; 0 = closed loop
+  double duration_s = 10;
+  int protocol = 1;    // 1: length + text, 2: binary header + request id
+};
+
+// Results of one worker thread; merged for the report.
+struct LoadStats {
+  uint64_t sent[COMMAND_KINDS] = {};
+  uint64_t received[COMMAND_KINDS] = {};
+  uint64_t bytes_sent = 0;
+  uint64_t bytes_received = 0;
+  uint64_t error_replies = 0; // "ERR ..." responses
+  uint64_t disconnects = 0;   // connections the server closed on us
+  LatencyHistogram latency;   // nanoseconds, all commands
+  LatencyHistogram by_command[COMMAND_KINDS];
+
+  void merge(const LoadStats &other);
+};
+
+// Drives a share of the connections from one thread with its own epoll
+// instance. Closed loop keeps `pipeline` requests in flight on every
+// connection. Open loop issues requests on a fixed schedule, and latency
+// is measured from the scheduled time rather than the actual send, so a
+// stalled server shows up as queueing delay instead of being hidden
+// (coordinated omission).
+class LoadWorker {
+public:
+  LoadWorker(const LoadConfig &cfg, int connections, double rate,
+             uint64_t seed);
+  ~LoadWorker();
+  LoadWorker(const LoadWorker &) = delete;
+  LoadWorker &operator=(const LoadWorker &) = delete;
+
+  // Connects every socket; returns false (with a message) on failure.
+  bool connect_all();
+
+  // Runs until the deadline (CLOCK_MONOTONIC nanoseconds).
+  void run(uint64_t start_ns, uint64_t end_ns);
+
+  const LoadStats &stats() const { return stats_; }
+
+private:
+  struct Pending {
+    uint64_t start_ns;
+    Command cmd;
+    uint64_t request_id; // v2 only
+  };
+
+  struct Conn {
+    int fd = -1;
+    bool want_write = false;
+    std::string out;    // unsent request bytes
+    size_t out_off = 0;
+    std::vector<uint8_t> in;
+    size_t in_off = 0;
+    std::deque<Pending> inflight;
+    uint64_t next_request_id = 0;
+    uint64_t next_send_ns = 0; // open loop schedule
+  };
+
+  Command pick_command();
+  void send_request(Conn &c, uint64_t start_ns);
+  bool flush(Conn &c);
+  bool on_readable(Conn &c, uint64_t now_ns);
+  void complete(Conn &c, uint64_t request_id, const uint8_t *payload,
+                uint32_t len, uint64_t now_ns);
+  void drop(Conn &c);
+  void update_interest(Conn &c);
+
+  const LoadConfig &cfg_;
+  double rate_;
+  uint64_t interval_ns_ = 0;
+  uint64_t rng_;
+  int epoll_fd_ = -1;
+  std::vector<Conn> conns_;
+  std::string frames_[COMMAND_KINDS];   // v1: complete frames
+  std::string payloads_[COMMAND_KINDS]; // v2: payload after the header
+  LoadStats stats_;
+};
+
+uint64_t monotonic_ns();
+
+// Human-readable summary, or a single JSON object for regression tracking.
+void print_report(const LoadConfig &cfg, const LoadStats &stats,
+                  double elapsed_s, bool json);
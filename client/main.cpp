@@ -1,9 +1,209 @@
+#include "client.h"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static void print_usage(const char *prog) {
+  std::cerr << "Usage: " << prog << " [options]\n"
+            << "Options:\n"
+            << "  --host <addr>              Server address (127.0.0.1)\n"
+            << "  --port <port>              Server port (8080)\n"
+            << "  --threads <num>            Worker threads, one epoll each\n"
+            << "  --connections <num>        Total connections\n"
+            << "  --pipeline <num>           Requests in flight per connection\n"
+            << "  --mix ping=W,echo=W,stats=W  Command weights (ping=100)\n"
+            << "  --echo-bytes <num>         ECHO payload size\n"
+            << "  --rate <req/s>             Open loop at this total rate\n"
+            << "                             (default: closed loop)\n"
+            << "  --duration <seconds>       Run time (10)\n"
+            << "  --protocol <v1|v2>         Wire format; v2 tags requests\n"
+            << "                             with ids (v1)\n"
+            << "  --json                     Print one JSON object\n";
+}
+
+static bool parse_int(const char *s, int &out) {
+  char *end = nullptr;
+  long v = std::strtol(s, &end, 10);
+  if (!s || *end != '\0') {
+    return false;
+  }
+  out = static_cast<int>(v);
+  return true;
+}
+
+static bool parse_double(const char *s, double &out) {
+  char *end = nullptr;
+  double v = std::strtod(s, &end);
+  if (!s || *end != '\0') {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+// "ping=80,echo=15,stats=5"; unnamed commands get weight 0.
+static bool parse_mix(const char *s, int mix[COMMAND_KINDS]) {
+  static const char *const names[COMMAND_KINDS] = {"ping", "echo", "stats"};
+  for (int k = 0; k < COMMAND_KINDS; ++k)
+    mix[k] = 0;
+
+  std::string spec(s);
+  size_t pos = 0;
+  while (pos <= spec.size()) {
+    size_t comma = spec.find(',', pos);
+    std::string item = spec.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    if (eq == std::string::npos)
+      return false;
+
+    std::string name = item.substr(0, eq);
+    int weight = 0;
+    if (!parse_int(item.c_str() + eq + 1, weight) || weight < 0)
+      return false;
+
+    int k = 0;
+    while (k < COMMAND_KINDS && name != names[k])
+      ++k;
+    if (k == COMMAND_KINDS)
+      return false;
+    mix[k] = weight;
+
+    if (comma == std::string::npos)
+      break;
+    pos = comma + 1;
+  }
+  return mix[0] + mix[1] + mix[2] > 0;
+}
+
+static bool validate_config(const LoadConfig &cfg) {
+  if (cfg.threads < 1 || cfg.threads > 256) {
+    std::cerr << "threads must be in [1, 256]\n";
+    return false;
+  }
+
+  if (cfg.connections < cfg.threads) {
+    std::cerr << "connections must be >= threads\n";
+    return false;
+  }
+
+  if (cfg.pipeline < 1) {
+    std::cerr << "pipeline must be >= 1\n";
+    return false;
+  }
+
+  if (cfg.echo_bytes < 1 || cfg.echo_bytes > 1024 * 1024 - 5) {
+    std::cerr << "echo-bytes must fit in a 1 MB frame\n";
+    return false;
+  }
+
+  if (cfg.rate < 0 || cfg.duration_s <= 0) {
+    std::cerr << "rate must be >= 0 and duration > 0\n";
+    return false;
+  }
+
+  return true;
+}
 
 int main(int argc, char *argv[]) {
-  (void)argc;
-  (void)argv;
+  LoadConfig cfg;
+  bool json = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *opt = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+
+    if (std::strcmp(opt, "--host") == 0) {
+      ok = val != nullptr;
+      if (ok)
+        cfg.host = val;
+      ++i;
+    } else if (std::strcmp(opt, "--port") == 0) {
+      int port = 0;
+      ok = val && parse_int(val, port) && port > 0 && port <= 65535;
+      cfg.port = static_cast<uint16_t>(port);
+      ++i;
+    } else if (std::strcmp(opt, "--threads") == 0) {
+      ok = val && parse_int(val, cfg.threads);
+      ++i;
+    } else if (std::strcmp(opt, "--connections") == 0) {
+      ok = val && parse_int(val, cfg.connections);
+      ++i;
+    } else if (std::strcmp(opt, "--pipeline") == 0) {
+      ok = val && parse_int(val, cfg.pipeline);
+      ++i;
+    } else if (std::strcmp(opt, "--mix") == 0) {
+      ok = val && parse_mix(val, cfg.mix);
+      ++i;
+    } else if (std::strcmp(opt, "--echo-bytes") == 0) {
+      ok = val && parse_int(val, cfg.echo_bytes);
+      ++i;
+    } else if (std::strcmp(opt, "--rate") == 0) {
+      ok = val && parse_double(val, cfg.rate);
+      ++i;
+    } else if (std::strcmp(opt, "--duration") == 0) {
+      ok = val && parse_double(val, cfg.duration_s);
+      ++i;
+    } else if (std::strcmp(opt, "--protocol") == 0) {
+      ok = val && (std::strcmp(val, "v1") == 0 || std::strcmp(val, "v2") == 0);
+      if (ok)
+        cfg.protocol = val[1] - '0';
+      ++i;
+    } else if (std::strcmp(opt, "--json") == 0) {
+      json = true;
+    } else if (std::strcmp(opt, "--help") == 0) {
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    } else {
+      std::cerr << "Unknown option: " << opt << "\n";
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+    if (!ok) {
+      std::cerr << "Invalid " << opt << " value\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!validate_config(cfg)) {
+    return EXIT_FAILURE;
+  }
+
+  // Split connections and rate evenly; the first threads take the rest.
+  std::vector<std::unique_ptr<LoadWorker>> workers;
+  for (int t = 0; t < cfg.threads; ++t) {
+    int conns = cfg.connections / cfg.threads +
+                (t < cfg.connections % cfg.threads ? 1 : 0);
+    double rate = cfg.rate * conns / cfg.connections;
+    workers.push_back(
+        std::make_unique<LoadWorker>(cfg, conns, rate, 0x9E3779B97F4A7C15ull * (t + 1)));
+    if (!workers.back()->connect_all()) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t start = monotonic_ns();
+  uint64_t end = start + static_cast<uint64_t>(cfg.duration_s * 1e9);
+
+  std::vector<std::thread> threads;
+  for (auto &w : workers) {
+    LoadWorker *worker = w.get();
+    threads.emplace_back([worker, start, end] { worker->run(start, end); });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  double elapsed = static_cast<double>(monotonic_ns() - start) / 1e9;
+
+  LoadStats total;
+  for (auto &w : workers) {
+    total.merge(w->stats());
+  }
 
-  std::cout << "network_client starting (stub)\n";
-  return 0;
+  print_report(cfg, total, elapsed, json);
+  return total.disconnects > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,50 @@
+#include "buffer_pool.h"
+#include <new>
+
+BufferPool &BufferPool::local()
+{
+  thread_local BufferPool pool;
+  return pool;
+}
+
+BufferPool::~BufferPool()
+{
+  for (auto &list : free_)
+  {
+    for (uint8_t *buf : list)
+      ::operator delete(buf);
+  }
+}
+
+int BufferPool::class_of(size_t size)
+{
+  int shift = MIN_SHIFT;
+  while ((size_t{1} << shift) < size)
+    ++shift;
+  return shift > MAX_SHIFT ? -1 : shift - MIN_SHIFT;
+}
+
+uint8_t *BufferPool::acquire(size_t size)
+{
+  int cls = class_of(size);
+  if (cls >= 0 && !free_[cls].empty())
+  {
+    uint8_t *buf = free_[cls].back();
+    free_[cls].pop_back();
+    cached_bytes_ -= size;
+    return buf;
+  }
+  return static_cast<uint8_t *>(::operator new(size));
+}
+
+void BufferPool::release(uint8_t *buf, size_t size)
+{
+  int cls = class_of(size);
+  if (cls < 0 || (free_[cls].size() + 1) * size > MAX_CACHED_PER_CLASS)
+  {
+    ::operator delete(buf);
+    return;
+  }
+  free_[cls].push_back(buf);
+  cached_bytes_ += size;
+}
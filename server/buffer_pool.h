@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Size-classed free lists for connection buffers: powers of two from
+// 4 KB to 2 MB. One pool per thread, so reactors never contend and a
+// buffer released by a closed connection is handed straight to the next
+// one that needs the same size. Larger requests bypass the pool.
+class BufferPool
+{
+public:
+  static BufferPool &local();
+
+  BufferPool() = default;
+  ~BufferPool();
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // size must be a power of two >= MIN_SIZE.
+  uint8_t *acquire(size_t size);
+  void release(uint8_t *buf, size_t size);
+
+  size_t cached_bytes() const { return cached_bytes_; }
+
+  static constexpr size_t MIN_SIZE = 4096;
+
+private:
+  static constexpr int MIN_SHIFT = 12;
+  static constexpr int MAX_SHIFT = 21;
+  static constexpr int CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+  // Idle memory kept per size class before buffers go back to the heap.
+  static constexpr size_t MAX_CACHED_PER_CLASS = 4 * 1024 * 1024;
+
+  static int class_of(size_t size);
+
+  std::vector<uint8_t *> free_[CLASSES];
+  size_t cached_bytes_ = 0;
+};
@@ -0,0 +1,111 @@
+#include "command_router.h"
+#include <cstring>
+
+uint32_t CommandRouter::key_of(std::string_view word)
+{
+  uint32_t key = 0;
+  std::memcpy(&key, word.data(), word.size() < 4 ? word.size() : 4);
+  return key;
+}
+
+void CommandRouter::add(std::string_view name, Opcode op, Handler handler,
+                        Args args, Handler stream)
+{
+  by_opcode_[static_cast<uint8_t>(op)] = static_cast<int>(commands_.size());
+  commands_.push_back({name, handler, args, stream, key_of(name), -1});
+  rebuild();
+}
+
+void CommandRouter::rebuild()
+{
+  std::vector<uint32_t> keys;
+  for (const Command &c : commands_)
+  {
+    bool seen = false;
+    for (uint32_t k : keys)
+      seen = seen || k == c.key;
+    if (!seen)
+      keys.push_back(c.key);
+  }
+
+  // Smallest table (load <= 1/2) with a collision-free multiplier. A
+  // handful of keys always settles within a few tries.
+  for (int bits = 3;; ++bits)
+  {
+    const size_t size = size_t{1} << bits;
+    if (size < keys.size() * 2)
+      continue;
+
+    uint32_t mult = 0x9E3779B1u; // golden-ratio start, then odd steps
+    for (int attempt = 0; attempt < 4096; ++attempt, mult += 0x7F4A7C16u)
+    {
+      mult_ = mult | 1;
+      shift_ = 32 - bits;
+      slots_.assign(size, -1);
+
+      bool ok = true;
+      for (uint32_t k : keys)
+      {
+        int &slot = slots_[slot_of(k)];
+        if (slot != -1)
+        {
+          ok = false;
+          break;
+        }
+        slot = 0; // occupied; filled in below
+      }
+      if (!ok)
+        continue;
+
+      slots_.assign(size, -1);
+      for (int i = static_cast<int>(commands_.size()) - 1; i >= 0; --i)
+      {
+        Command &c = commands_[i];
+        int &slot = slots_[slot_of(c.key)];
+        c.next = slot;
+        slot = i;
+      }
+      return;
+    }
+  }
+}
+
+CommandRouter::Match CommandRouter::route(std::string_view frame) const
+{
+  while (!frame.empty() &&
+         (frame.back() == '\n' || frame.back() == '\r' || frame.back() == ' '))
+    frame.remove_suffix(1);
+
+  const size_t space = frame.find(' ');
+  const std::string_view word = frame.substr(0, space);
+  const uint32_t key = key_of(word);
+
+  if (!slots_.empty())
+  {
+    for (int i = slots_[slot_of(key)]; i != -1; i = commands_[i].next)
+    {
+      const Command &c = commands_[i];
+      if (c.key != key || c.name != word)
+        continue;
+      if ((c.args == Args::REQUIRED) != (space != std::string_view::npos))
+        break;
+      return {c.handler,
+              c.args == Args::REQUIRED ? frame.substr(space + 1)
+                                       : std::string_view(),
+              c.stream};
+    }
+  }
+  return {fallback_, frame};
+}
+
+CommandRouter::Match CommandRouter::route(uint8_t opcode,
+                                          std::string_view payload) const
+{
+  const int i = by_opcode_[opcode];
+  if (i == -1)
+    return {fallback_, payload};
+
+  const Command &c = commands_[i];
+  return {c.handler, c.args == Args::REQUIRED ? payload : std::string_view(),
+          c.stream};
+}
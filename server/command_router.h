@@ -0,0 +1,82 @@
+#pragma once
+#include "protocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class Server;
+struct Connection;
+
+// Maps the command word of a text frame, or the opcode of a v2 frame, to
+// a Server member handler.
+//
+// Lookup packs the first four bytes of the command word into a uint32_t
+// and indexes a small table through a multiplicative hash whose
+// multiplier is searched at registration time until no two registered
+// prefixes collide (a perfect hash). Commands sharing a 4-byte prefix
+// are chained and told apart by the full word. route() only slices the
+// frame: no allocation, no copy. A v2 opcode is a direct array index.
+class CommandRouter
+{
+public:
+  // Returns false once the handler has closed the connection.
+  using Handler = bool (Server::*)(Connection &conn, std::string_view args);
+
+  enum class Args
+  {
+    NONE,     // "NAME" only
+    REQUIRED  // "NAME <args>"
+  };
+
+  struct Command
+  {
+    std::string_view name;
+    Handler handler;
+    Args args;
+    Handler stream; // body chunk by chunk for large frames; may be null
+    uint32_t key;
+    int next; // next command with the same key, or -1
+  };
+
+  struct Match
+  {
+    Handler handler;
+    std::string_view args; // points into the frame
+    Handler stream = nullptr;
+  };
+
+  // name must outlive the router (use string literals). A command with a
+  // stream handler accepts frames over Connection::STREAM_THRESHOLD (and
+  // over MAX_FRAME) without buffering them: the handler is called with
+  // each piece of the body as it arrives (Connection::Stream).
+  void add(std::string_view name, Opcode op, Handler handler,
+           Args args = Args::NONE, Handler stream = nullptr);
+
+  // Handler for frames that match no command.
+  void set_fallback(Handler handler) { fallback_ = handler; }
+
+  // Trims trailing CR/LF/space, splits "NAME args" at the first space
+  // and finds NAME. Falls back when nothing (or the wrong arity) matches.
+  Match route(std::string_view frame) const;
+
+  // v2: the payload is passed through whole (empty for Args::NONE).
+  Match route(uint8_t opcode, std::string_view payload) const;
+
+  size_t size() const { return commands_.size(); }
+
+private:
+  static uint32_t key_of(std::string_view word);
+  size_t slot_of(uint32_t key) const
+  {
+    return static_cast<uint32_t>(key * mult_) >> shift_;
+  }
+  void rebuild();
+
+  std::vector<Command> commands_;
+  std::vector<int> slots_; // first command per slot, or -1
+  std::vector<int> by_opcode_ = std::vector<int>(256, -1); // index, or -1
+  uint32_t mult_ = 1;
+  int shift_ = 32;
+  Handler fallback_ = nullptr;
+};
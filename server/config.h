@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 struct ServerConfig {
   uint16_t port;
@@ -9,9 +10,98 @@ struct ServerConfig {
   int backlog;
   int recv_buffer_bytes;
   int send_buffer_bytes;
+  int threads; // reactors; >1 shards the port with SO_REUSEPORT
+  // Token-bucket limits (one second of burst); 0 = off. A client over
+  // its limit stops being read until the bucket refills. The per-IP
+  // limits cover all of one source address's connections and, like
+  // max_connections, are split evenly across reactors.
+  int max_frame_rate;         // frames/s per connection
+  int max_byte_rate;          // frame payload bytes/s per connection
+  int ip_frame_rate;          // frames/s per source IP
+  int ip_byte_rate;           // frame payload bytes/s per source IP
+  int max_connections_per_ip; // concurrent connections per source IP
+  int metrics_port;   // Prometheus scrape port on 127.0.0.1; 0 = off
+  int drain_timeout_ms; // graceful drain before remaining clients are cut
+  // Read buffers + write queues, whole process, in MB; 0 = off. Split
+  // across reactors like max_connections.
+  int memory_budget_mb;
+
+  // Large payloads. With zero_copy, a streamed ECHO is relayed socket to
+  // socket with splice() and BLOB replies go out with sendfile() (epoll
+  // backend); otherwise both are copied through user space in pieces.
+  bool zero_copy;
+  std::string blob_dir; // files served by BLOB <name>; empty = off
+
+  // Syscall layer under each reactor. URING falls back to EPOLL at
+  // startup if the kernel cannot provide it.
+  enum class IoBackend { EPOLL, URING } io_backend;
+
+  // epoll backend. Edge-triggered mode registers each connection once for
+  // both directions; one with data left after its budget waits on a
+  // ready list for the next tick instead of being polled for again.
+  bool edge_triggered;
+  int events_per_wait; // epoll_wait() batch
+  int io_budget_bytes; // read, and write, per connection per loop tick
+  int accept_budget;   // accept4() calls per listener wakeup
+
+  // Placement. Reactor r runs on cpu_affinity[r % size] (empty = not
+  // pinned) and allocates under numa_policy: LOCAL prefers the node of
+  // its CPU, BIND insists on it, INTERLEAVE spreads over every node.
+  std::vector<int> cpu_affinity;
+  enum class NumaPolicy { NONE, LOCAL, BIND, INTERLEAVE } numa_policy;
+
+  // Pub/sub: what a PUBLISH does for a subscriber whose unsent replies
+  // are over WRITE_HIGH_WATER. DROP skips the message for it; DISCONNECT
+  // closes it, as an ordinary reply would.
+  enum class SlowSubscriber { DROP, DISCONNECT } slow_subscriber;
+
+  // Sampled request tracing (trace.h): about one frame in trace_sample
+  // per reactor is followed from first byte read to last byte written,
+  // into a ring file at trace_file. 0 = off.
+  int trace_sample;
+  std::string trace_file;
 
   enum class LogLevel { DEBUG, INFO, WARN, ERROR } log_level;
 
+  // Kernel socket options, applied by socket_utils. A profile sets all of
+  // them; individual flags given after --socket-profile override it.
+  struct SocketTuning {
+    bool nodelay;          // TCP_NODELAY on accepted sockets
+    bool quickack;         // TCP_QUICKACK, re-armed after every read
+    int defer_accept_s;    // TCP_DEFER_ACCEPT: accept once data arrives
+    int busy_poll_us;      // SO_BUSY_POLL, inherited from the listener
+    bool prefer_busy_poll; // SO_PREFER_BUSY_POLL
+    int fastopen_queue;    // TCP_FASTOPEN pending-request queue; 0 = off
+    bool incoming_cpu;     // steer each flow to the reactor of its RX CPU
+  } sock;
+
+  enum class SocketProfile { DEFAULT, LATENCY, THROUGHPUT };
+
+  static SocketTuning socket_profile(SocketProfile p) {
+    // Every profile keeps Nagle off: replies are already coalesced per
+    // loop iteration, and a reply finished by another reactor would
+    // otherwise wait for the client's delayed ACK.
+    SocketTuning t{};
+    t.nodelay = true;
+    switch (p) {
+    case SocketProfile::DEFAULT:
+      break;
+    case SocketProfile::LATENCY:
+      t.quickack = true;
+      t.busy_poll_us = 50;
+      t.prefer_busy_poll = true;
+      t.fastopen_queue = 256;
+      t.incoming_cpu = true;
+      break;
+    case SocketProfile::THROUGHPUT:
+      t.defer_accept_s = 1;
+      t.fastopen_queue = 256;
+      t.incoming_cpu = true;
+      break;
+    }
+    return t;
+  }
+
   static ServerConfig defaults() {
     ServerConfig cfg{};
     cfg.port = 8080;
@@ -19,7 +109,27 @@ struct ServerConfig {
     cfg.backlog = 1024;
     cfg.recv_buffer_bytes = 64 * 1024;
     cfg.send_buffer_bytes = 64 * 1024;
+    cfg.threads = 1;
+    cfg.max_frame_rate = 1000;
+    cfg.max_byte_rate = 0;
+    cfg.ip_frame_rate = 0;
+    cfg.ip_byte_rate = 0;
+    cfg.max_connections_per_ip = 1024;
+    cfg.metrics_port = 0;
+    cfg.drain_timeout_ms = 5000;
+    cfg.memory_budget_mb = 1024;
+    cfg.zero_copy = true;
+    cfg.io_backend = IoBackend::EPOLL;
+    cfg.edge_triggered = false;
+    cfg.events_per_wait = 16;
+    cfg.io_budget_bytes = 64 * 1024;
+    cfg.accept_budget = 64;
+    cfg.numa_policy = NumaPolicy::NONE;
+    cfg.slow_subscriber = SlowSubscriber::DROP;
+    cfg.trace_sample = 0;
+    cfg.trace_file = "netlab.trace";
     cfg.log_level = LogLevel::INFO;
+    cfg.sock = socket_profile(SocketProfile::DEFAULT);
     return cfg;
   }
 };
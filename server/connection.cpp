@@ -0,0 +1,188 @@
+#include "connection.h"
+#include <arpa/inet.h>
+
+void Connection::reset(int fd_)
+{
+  if (idle_timer.wheel)
+    idle_timer.wheel->cancel(idle_timer);
+  if (throttle_timer.wheel)
+    throttle_timer.wheel->cancel(throttle_timer);
+
+  fd = fd_;
+  write_blocked = false;
+  flush_queued = false;
+  epoll_events = 0;
+  read_ready = false;
+  write_ready = true;
+  ready_queued = false;
+  last_activity = Clock::now();
+  read_buffer.reset();
+  write_queue.clear();
+  protocol = Protocol::UNKNOWN;
+  state = ReadState::READ_LEN;
+  expected_len = 0;
+  tag = FrameTag{};
+  buffer_whole = false;
+  stream = Stream{};
+  frame_tokens.reset();
+  byte_tokens.reset();
+  ip = nullptr;
+  throttled = false;
+  accounted = 0;
+  memory_paused = false;
+  subscriptions.clear();
+  trace = FrameTrace{};
+  half_closed = false;
+  generation = 0;
+  ops_in_flight = 0;
+  recv_armed = false;
+  recv_cancelling = false;
+  closing = false;
+  send_in_flight = false;
+  send_msg = msghdr{};
+}
+
+Connection::FrameStatus Connection::next_frame(ConstByteSpan &frame)
+{
+  // Step 0: the first byte picks the protocol for the connection's life.
+  if (protocol == Protocol::UNKNOWN)
+  {
+    if (read_buffer.size() < 1)
+      return FrameStatus::NEED_MORE;
+
+    uint8_t first;
+    read_buffer.peek(&first, sizeof(first));
+    if (first == 0)
+    {
+      protocol = Protocol::V1;
+    }
+    else if (first == V2Header::VERSION)
+    {
+      // So is a v1 frame of 32-48 MB. The first v2 header must be a
+      // plain request, which such a frame is only if its length is a
+      // multiple of 64 KB whose second byte is a request opcode.
+      if (read_buffer.size() < V2Header::SIZE)
+        return FrameStatus::NEED_MORE;
+      uint8_t raw[V2Header::SIZE];
+      read_buffer.peek(raw, sizeof(raw));
+      const V2Header h = V2Header::decode(raw);
+      if (h.flags != 0 || h.opcode < static_cast<uint8_t>(Opcode::PING) ||
+          h.opcode > static_cast<uint8_t>(Opcode::PUBLISH))
+        return FrameStatus::PROTOCOL_ERROR;
+      protocol = Protocol::V2;
+      state = ReadState::READ_HEADER;
+    }
+    else
+    {
+      return FrameStatus::PROTOCOL_ERROR;
+    }
+  }
+
+  // A streamed body: whatever part of it has arrived, in pieces no larger
+  // than STREAM_THRESHOLD however much was held back meanwhile.
+  if (state == ReadState::READ_STREAM)
+  {
+    if (read_buffer.empty())
+      return FrameStatus::NEED_MORE;
+    frame = read_buffer.readable();
+    if (frame.size > stream.body_left)
+      frame.size = stream.body_left;
+    if (frame.size > STREAM_THRESHOLD)
+      frame.size = STREAM_THRESHOLD;
+    return FrameStatus::CHUNK;
+  }
+
+  // Step 1 (v1): read length
+  if (state == ReadState::READ_LEN)
+  {
+    if (read_buffer.size() < sizeof(uint32_t))
+      return FrameStatus::NEED_MORE;
+
+    uint32_t netlen;
+    read_buffer.peek(&netlen, sizeof(netlen));
+    expected_len = ntohl(netlen);
+
+    // Defensive limit; frames over MAX_FRAME must stream (LARGE below).
+    if (expected_len == 0)
+      return FrameStatus::PROTOCOL_ERROR;
+
+    read_buffer.consume(sizeof(uint32_t));
+    state = ReadState::READ_BODY;
+  }
+
+  // Step 1 (v2): read header
+  if (state == ReadState::READ_HEADER)
+  {
+    if (read_buffer.size() < V2Header::SIZE)
+      return FrameStatus::NEED_MORE;
+
+    uint8_t raw[V2Header::SIZE];
+    read_buffer.peek(raw, sizeof(raw));
+    const V2Header h = V2Header::decode(raw);
+
+    if (h.version != V2Header::VERSION ||
+        (h.flags & V2Header::FLAG_RESPONSE))
+      return FrameStatus::PROTOCOL_ERROR;
+
+    read_buffer.consume(V2Header::SIZE);
+    expected_len = h.length;
+    tag = FrameTag{h.opcode, h.request_id};
+    state = ReadState::READ_BODY;
+  }
+
+  // Step 2: read payload. A large one is routed on its first bytes before
+  // any room is reserved for it.
+  if (expected_len > STREAM_THRESHOLD && !buffer_whole)
+  {
+    const size_t peek = expected_len < STREAM_PEEK ? expected_len : STREAM_PEEK;
+    if (read_buffer.size() < peek)
+      return FrameStatus::NEED_MORE;
+    frame.data = read_buffer.contiguous(peek);
+    frame.size = peek;
+    return FrameStatus::LARGE;
+  }
+
+  if (read_buffer.size() < expected_len)
+  {
+    // Make sure the whole body will fit without another round of growth.
+    read_buffer.reserve(expected_len);
+    return FrameStatus::NEED_MORE;
+  }
+
+  frame.data = read_buffer.contiguous(expected_len);
+  frame.size = expected_len;
+  return FrameStatus::READY;
+}
+
+void Connection::finish_frame()
+{
+  read_buffer.consume(expected_len);
+  state = protocol == Protocol::V2 ? ReadState::READ_HEADER : ReadState::READ_LEN;
+  expected_len = 0;
+  buffer_whole = false;
+}
+
+void Connection::begin_stream(CommandRouter::Handler handler, size_t skip)
+{
+  read_buffer.consume(skip);
+  stream.handler = handler;
+  stream.body_total = expected_len - skip;
+  stream.body_left = stream.body_total;
+  state = ReadState::READ_STREAM;
+}
+
+void Connection::finish_chunk(size_t n)
+{
+  read_buffer.consume(n);
+  body_consumed(n);
+}
+
+void Connection::body_consumed(size_t n)
+{
+  stream.body_left -= n;
+  if (stream.body_left > 0)
+    return;
+  state = protocol == Protocol::V2 ? ReadState::READ_HEADER : ReadState::READ_LEN;
+  expected_len = 0;
+  stream.handler = nullptr;
+}
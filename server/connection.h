@@ -1,6 +1,16 @@
 #pragma once
+#include "command_router.h"
+#include "output_queue.h"
+#include "rate_limiter.h"
+#include "ring_buffer.h"
+#include "timer_wheel.h"
+#include "topic_registry.h"
+#include "trace.h"
 #include <cstddef>
 #include <cstdint>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <utility>
 #include <vector>
 #include <chrono>
 
@@ -9,30 +19,170 @@ struct Connection
   using Clock = std::chrono::steady_clock;
 
   int fd;
-  bool write_blocked = false;
+  bool write_blocked = false; // last flush left bytes queued
+  bool flush_queued = false;  // on the reactor's flush list
+  uint32_t epoll_events = 0;  // interest currently registered with epoll
+
+  // Edge-triggered epoll: what the socket may still allow. Set by events,
+  // cleared only by EAGAIN, since no new edge comes until then.
+  bool read_ready = false;
+  bool write_ready = true;
+  bool ready_queued = false; // on the reactor's ready list
 
   Clock::time_point last_activity;
+  TimerNode idle_timer{this}; // re-armed on activity, fires when idle
 
-  std::vector<uint8_t> read_buffer;
-  std::vector<uint8_t> write_buffer;
+  RingBuffer read_buffer;
+  OutputQueue write_queue;
 
   static constexpr size_t WRITE_HIGH_WATER = 512 * 1024; // 512 KB
   static constexpr size_t WRITE_LOW_WATER = 128 * 1024;  // 128 KB
+  static constexpr uint32_t MAX_FRAME = 1024 * 1024;     // 1 MB
+  // Larger frames are routed on their first STREAM_PEEK bytes; a command
+  // that can stream them gets the body in pieces instead (Stream).
+  static constexpr uint32_t STREAM_THRESHOLD = 64 * 1024;
+  static constexpr size_t STREAM_PEEK = 16; // > longest "NAME "
+
+  // Fixed by the first byte the client sends (see protocol.h).
+  enum class Protocol : uint8_t
+  {
+    UNKNOWN,
+    V1,
+    V2
+  };
+  Protocol protocol = Protocol::UNKNOWN;
 
   enum class ReadState
   {
-    READ_LEN,
-    READ_BODY
+    READ_LEN,    // v1 length prefix
+    READ_HEADER, // v2 header
+    READ_BODY,
+    READ_STREAM  // body of a streamed frame
   };
   ReadState state;
   uint32_t expected_len;
+  FrameTag tag; // v2: opcode and request id of the current frame
+  bool buffer_whole = false; // large frame that does not stream
+
+  enum class FrameStatus
+  {
+    NEED_MORE,
+    READY,
+    LARGE, // over STREAM_THRESHOLD: begin_stream() or buffer_whole
+    CHUNK, // the next piece of a streamed body
+    PROTOCOL_ERROR
+  };
 
-  explicit Connection(int fd_)
+  // Advances the framing state machine over read_buffer. On READY, `frame`
+  // points at the payload inside read_buffer (no copy); it stays valid
+  // until finish_frame() consumes it. A v2 frame's opcode and request id
+  // are in `tag`; v2 payloads may be empty.
+  //
+  // On LARGE, `frame` holds just the first STREAM_PEEK bytes, enough to
+  // route it. The caller either streams it with begin_stream() or sets
+  // buffer_whole (allowed up to MAX_FRAME) and calls again. While
+  // streaming, CHUNK hands out whatever part of the body is buffered;
+  // finish_chunk() consumes it.
+  FrameStatus next_frame(ConstByteSpan &frame);
+  void finish_frame();
+  void begin_stream(CommandRouter::Handler handler, size_t skip);
+  void finish_chunk(size_t n);
+  // n body bytes taken off the socket without passing read_buffer.
+  void body_consumed(size_t n);
+
+  // A large request body or reply in flight. The request side feeds
+  // `handler` with the body as it arrives, so a connection never buffers
+  // more than a read's worth of it. The reply side has its header queued
+  // (reply_open) while the payload follows in pieces, is spliced from the
+  // socket through a pipe and back (relay), or is sent from a file.
+  // Nothing else may be queued in between: unordered v2 replies that
+  // arrive meanwhile wait in `deferred`.
+  struct Stream
+  {
+    CommandRouter::Handler handler = nullptr;
+    uint64_t body_total = 0; // streamed bytes, command word excluded
+    uint64_t body_left = 0;  // not yet handed out (or spliced)
+    bool reply_open = false;
+    bool relay = false; // the reply is the body verbatim
+    int pipe_rd = -1;   // splice relay: socket -> pipe -> socket
+    int pipe_wr = -1;
+    size_t in_pipe = 0;
+    int file_fd = -1; // file-backed reply
+    off_t file_offset = 0;
+    uint64_t file_left = 0;
+    std::vector<std::pair<FrameRef, FrameTag>> deferred;
+    size_t deferred_bytes = 0; // wire size of `deferred`
+  } stream;
+
+  // Reply bytes not yet written: queued, plus held back behind a
+  // streamed reply. What WRITE_HIGH_WATER bounds.
+  size_t unsent_bytes() const
+  {
+    return write_queue.size() + stream.deferred_bytes;
+  }
+
+  // The reply is being written from a pipe or a file: later frames wait.
+  bool streaming_out() const
+  {
+    return stream.pipe_rd >= 0 || stream.file_fd >= 0;
+  }
+
+  // Part of a streamed body was held back while its reply drained.
+  bool body_buffered() const
+  {
+    return state == ReadState::READ_STREAM && !read_buffer.empty();
+  }
+
+  explicit Connection(int fd_ = -1)
       : fd(fd_),
         write_blocked(false),
         last_activity(Clock::now()),
         state(ReadState::READ_LEN),
         expected_len(0) {}
-  uint32_t frames_in_window = 0;
-  Clock::time_point window_start = Clock::now();
+
+  // Returns a recycled object to its freshly-constructed state for a new
+  // fd. Buffers go back to the pool; queue storage is kept.
+  void reset(int fd_);
+
+  // Rate limiting. While throttled the connection is not read (EPOLLIN
+  // dropped, or the uring recv cancelled) and frames already buffered
+  // wait for throttle_timer.
+  TokenBucket frame_tokens;
+  TokenBucket byte_tokens;
+  IpTable::Entry *ip = nullptr; // source address; nullptr if untracked
+  bool throttled = false;
+  TimerNode throttle_timer{this};
+
+  // Memory budget. `accounted` is what this connection last added to
+  // Metrics::buffer_bytes (read buffer capacity + unsent reply bytes);
+  // memory_paused stops reading from it while the reactor is over budget.
+  size_t accounted = 0;
+  bool memory_paused = false;
+
+  // Pub/sub: the topics this connection receives (TopicRegistry).
+  std::vector<Subscription> subscriptions;
+
+  // Sampled tracing: where the frame being followed has got to.
+  FrameTrace trace;
+
+  // Drain: our side is shut down (SHUT_WR); whatever still arrives is
+  // discarded until the client closes.
+  bool half_closed = false;
+
+  // Set once close_connection() has run. Events or completions that still
+  // reference the object afterwards are ignored.
+  bool closing = false;
+
+  // Tells completions and cross-reactor replies addressed to a reused fd
+  // number apart from this connection's own.
+  uint32_t generation = 0;
+
+  // io_uring backend bookkeeping (unused with epoll). A closing connection
+  // keeps its fd until every in-flight operation has completed.
+  uint16_t ops_in_flight = 0;
+  bool recv_armed = false; // multishot recv outstanding
+  bool recv_cancelling = false; // pausing: cancel submitted
+  bool send_in_flight = false;
+  std::vector<iovec> send_iov;
+  msghdr send_msg{};
 };
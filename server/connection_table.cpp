@@ -0,0 +1,76 @@
+#include "connection_table.h"
+
+ConnectionTable::ConnectionTable(size_t expected)
+    // A process holds a handful of fds before the first client arrives.
+    : by_fd_(expected + 64, nullptr)
+{
+  free_.reserve(expected);
+  retired_.reserve(CHUNK);
+}
+
+// A copy with the same capacity, so later pushes do not reallocate.
+static std::vector<Connection *> copy(const std::vector<Connection *> &v)
+{
+  std::vector<Connection *> out;
+  out.reserve(v.capacity());
+  out.assign(v.begin(), v.end());
+  return out;
+}
+
+void ConnectionTable::rehome()
+{
+  by_fd_ = copy(by_fd_);
+  free_ = copy(free_);
+  retired_ = copy(retired_);
+}
+
+Connection &ConnectionTable::open(int fd)
+{
+  if (free_.empty())
+  {
+    chunks_.emplace_back(new Connection[CHUNK]);
+    Connection *chunk = chunks_.back().get();
+    for (size_t i = CHUNK; i-- > 0;)
+      free_.push_back(&chunk[i]);
+  }
+
+  Connection *conn = free_.back();
+  free_.pop_back();
+  conn->reset(fd);
+
+  if (static_cast<size_t>(fd) >= by_fd_.size())
+    by_fd_.resize(static_cast<size_t>(fd) * 2, nullptr);
+  by_fd_[fd] = conn;
+  ++live_;
+  return *conn;
+}
+
+void ConnectionTable::retire(Connection &conn)
+{
+  if (find(conn.fd) != &conn)
+    return;
+  by_fd_[conn.fd] = nullptr;
+  --live_;
+  retired_.push_back(&conn);
+}
+
+void ConnectionTable::release_retired()
+{
+  for (Connection *conn : retired_)
+  {
+    // Hand the buffers back now rather than when the slot is next used.
+    conn->reset(-1);
+    free_.push_back(conn);
+  }
+  retired_.clear();
+}
+
+void ConnectionTable::clear()
+{
+  for (Connection *conn : by_fd_)
+  {
+    if (conn)
+      retire(*conn);
+  }
+  release_retired();
+}
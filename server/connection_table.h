@@ -0,0 +1,61 @@
+#pragma once
+#include "connection.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// fd-indexed connection table. Lookup is a bounds check and one array
+// load. Connection objects live in fixed-size chunks (a slab) and are
+// recycled through a free list rather than destroyed, so once the table
+// has warmed up, accepting and closing connections allocates nothing.
+class ConnectionTable
+{
+public:
+  // expected: the connection limit, used to size the index up front.
+  explicit ConnectionTable(size_t expected);
+  ConnectionTable(const ConnectionTable &) = delete;
+  ConnectionTable &operator=(const ConnectionTable &) = delete;
+
+  Connection *find(int fd) const
+  {
+    return static_cast<size_t>(fd) < by_fd_.size() ? by_fd_[fd] : nullptr;
+  }
+
+  // Takes a recycled object (or carves a new chunk) and indexes it by fd.
+  Connection &open(int fd);
+
+  // Unindexes the connection, so find() misses and the fd number may be
+  // reused at once, but keeps the object intact until release_retired():
+  // events already returned by the kernel may still point at it.
+  void retire(Connection &conn);
+  void release_retired();
+
+  // Retires and releases everything.
+  void clear();
+
+  // Moves the index and free lists into memory allocated (and first
+  // touched) by the calling thread. The reactor calls it once pinned;
+  // the constructor ran on the main thread.
+  void rehome();
+
+  size_t size() const { return live_; }
+
+  template <typename Fn>
+  void for_each(Fn &&fn)
+  {
+    for (Connection *c : by_fd_)
+    {
+      if (c)
+        fn(*c);
+    }
+  }
+
+private:
+  static constexpr size_t CHUNK = 64;
+
+  std::vector<Connection *> by_fd_;
+  std::vector<std::unique_ptr<Connection[]>> chunks_;
+  std::vector<Connection *> free_;
+  std::vector<Connection *> retired_;
+  size_t live_ = 0;
+};
@@ -0,0 +1,190 @@
+#include "handoff.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static const char HANDOFF_ENV[] = "NETLAB_HANDOFF_FD";
+
+// The channel's fd number in the new image, whatever it was in the old.
+static constexpr int CHILD_CHANNEL_FD = 3;
+
+// The kernel accepts at most SCM_MAX_FD (253) descriptors per message.
+static constexpr size_t FDS_PER_MSG = 250;
+
+static std::vector<std::string> g_argv;
+static std::string g_exe;
+
+void handoff_init(int argc, char **argv) {
+  g_argv.assign(argv, argv + argc);
+
+  // The path, not the image: /proc/self/exe keeps naming the inode this
+  // process runs, so once a new binary is installed over the path it
+  // would only ever restart the old code.
+  char path[PATH_MAX];
+  ssize_t n = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (n > 0) {
+    g_exe.assign(path, static_cast<size_t>(n));
+  } else if (argc > 0 && ::realpath(argv[0], path)) {
+    g_exe = path;
+  }
+}
+
+static bool send_fds(int channel, const int *fds, size_t count,
+                     uint32_t total) {
+  char control[CMSG_SPACE(sizeof(int) * FDS_PER_MSG)] = {};
+  iovec iov{&total, sizeof(total)};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+  return ::sendmsg(channel, &msg, MSG_NOSIGNAL) == sizeof(total);
+}
+
+int handoff_spawn(const std::vector<int> &fds, pid_t &child) {
+  if (g_argv.empty() || g_exe.empty() || fds.empty()) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int sv[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    return -1;
+
+  // Everything the child needs is built before fork(): between fork and
+  // exec only async-signal-safe calls are allowed.
+  std::vector<char *> argv;
+  for (std::string &a : g_argv)
+    argv.push_back(&a[0]);
+  argv.push_back(nullptr);
+
+  std::string channel_var =
+      std::string(HANDOFF_ENV) + "=" + std::to_string(CHILD_CHANNEL_FD);
+  std::vector<char *> envp;
+  for (char **e = environ; *e; ++e) {
+    if (std::strncmp(*e, HANDOFF_ENV, sizeof(HANDOFF_ENV) - 1) != 0)
+      envp.push_back(*e);
+  }
+  envp.push_back(&channel_var[0]);
+  envp.push_back(nullptr);
+
+  const long max_fd = ::sysconf(_SC_OPEN_MAX);
+
+  child = ::fork();
+  if (child < 0) {
+    int saved = errno;
+    ::close(sv[0]);
+    ::close(sv[1]);
+    errno = saved;
+    return -1;
+  }
+
+  if (child == 0) {
+    // Nothing but stdio and the channel crosses exec: client sockets
+    // must not outlive the old process in the new one.
+    if (::dup2(sv[1], CHILD_CHANNEL_FD) < 0 ||
+        ::fcntl(CHILD_CHANNEL_FD, F_SETFD, 0) < 0)
+      ::_exit(127);
+#ifdef SYS_close_range
+    if (::syscall(SYS_close_range, CHILD_CHANNEL_FD + 1, ~0U, 0) < 0)
+#endif
+      for (long fd = CHILD_CHANNEL_FD + 1; fd < max_fd; ++fd)
+        ::close(static_cast<int>(fd));
+
+    ::execve(g_exe.c_str(), argv.data(), envp.data());
+    ::_exit(127);
+  }
+
+  ::close(sv[1]);
+
+  const uint32_t total = static_cast<uint32_t>(fds.size());
+  for (size_t i = 0; i < fds.size(); i += FDS_PER_MSG) {
+    size_t n = fds.size() - i < FDS_PER_MSG ? fds.size() - i : FDS_PER_MSG;
+    if (!send_fds(sv[0], fds.data() + i, n, total)) {
+      int saved = errno;
+      ::close(sv[0]);
+      errno = saved;
+      return -1;
+    }
+  }
+  return sv[0];
+}
+
+std::vector<int> handoff_receive(int &channel) {
+  std::vector<int> fds;
+  channel = -1;
+
+  const char *var = std::getenv(HANDOFF_ENV);
+  if (!var)
+    return fds;
+  channel = std::atoi(var);
+  ::unsetenv(HANDOFF_ENV);
+
+  uint32_t total = 0;
+  do {
+    char control[CMSG_SPACE(sizeof(int) * FDS_PER_MSG)] = {};
+    iovec iov{&total, sizeof(total)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = ::recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    if (n != sizeof(total) || (msg.msg_flags & MSG_CTRUNC)) {
+      if (n >= 0)
+        errno = EPROTO;
+      std::perror("handoff recvmsg");
+      std::exit(EXIT_FAILURE);
+    }
+
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const unsigned char *data = CMSG_DATA(c);
+      for (size_t i = 0; i < count; ++i) {
+        int fd;
+        std::memcpy(&fd, data + i * sizeof(int), sizeof(int));
+        fds.push_back(fd);
+      }
+    }
+  } while (fds.size() < total);
+
+  return fds;
+}
+
+void handoff_ack(int channel) {
+  const char ready = 'R';
+  if (::send(channel, &ready, 1, MSG_NOSIGNAL) != 1)
+    std::perror("handoff ack");
+  ::close(channel);
+}
+
+int handoff_poll(int channel) {
+  char ready;
+  ssize_t n = ::recv(channel, &ready, 1, MSG_DONTWAIT);
+  if (n == 1)
+    return 1;
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+  return -1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <sys/types.h>
+#include <vector>
+
+// Zero-downtime restart. On SIGHUP the running process re-executes its own
+// binary with the same arguments and passes its listening sockets to the
+// new image over a Unix socket (SCM_RIGHTS). Both processes then share
+// the same kernel sockets, so connections queued in the accept backlog
+// survive the switch. Once the new process acknowledges that its reactors
+// are set up, the old one stops accepting and drains.
+
+// Remembers the command line for handoff_spawn(), and the path of the
+// executable as it was at startup: a restart runs whatever is installed
+// at that path by then. Call once from main().
+void handoff_init(int argc, char **argv);
+
+// New process: the listeners handed over by its predecessor, or empty
+// when started normally. channel receives the socket to acknowledge on.
+// Exits the program if a handoff was announced but cannot be received.
+std::vector<int> handoff_receive(int &channel);
+
+// New process: tells the old one it may drain. Closes the channel.
+void handoff_ack(int channel);
+
+// Old process: starts the new image and sends it fds. Returns the
+// channel to poll for the acknowledgement, or -1 (errno set).
+int handoff_spawn(const std::vector<int> &fds, pid_t &child);
+
+// Old process: 1 once acknowledged, 0 while the new process is still
+// starting, -1 if it exited or closed the channel first.
+int handoff_poll(int channel);
@@ -0,0 +1,46 @@
+#pragma once
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// The socket syscalls the epoll backend makes per connection, behind one
+// interface so a harness can stand between the server and the kernel
+// (bench/chaos_bench.cpp injects EAGAIN bursts, short transfers, resets
+// and EMFILE). Each returns what the syscall would, errno included.
+// Setup calls (listener, eventfd) and the io_uring backend go straight
+// to the kernel.
+class IoOps
+{
+public:
+  virtual ~IoOps() = default;
+
+  virtual ssize_t readv(int fd, const iovec *iov, int cnt)
+  {
+    return ::readv(fd, iov, cnt);
+  }
+  // Only for a read whose SO_TIMESTAMPING stamp is wanted (trace.h).
+  virtual ssize_t recvmsg(int fd, msghdr *msg, int flags)
+  {
+    return ::recvmsg(fd, msg, flags);
+  }
+  virtual ssize_t writev(int fd, const iovec *iov, int cnt)
+  {
+    return ::writev(fd, iov, cnt);
+  }
+  virtual int accept4(int fd, sockaddr *addr, socklen_t *len, int flags)
+  {
+    return ::accept4(fd, addr, len, flags);
+  }
+  virtual int epoll_ctl(int epfd, int op, int fd, epoll_event *ev)
+  {
+    return ::epoll_ctl(epfd, op, fd, ev);
+  }
+
+  // Straight to the kernel; what every Server starts with.
+  static IoOps &system()
+  {
+    static IoOps ops;
+    return ops;
+  }
+};
@@ -0,0 +1,285 @@
+#include "kv_store.h"
+#include <chrono>
+#include <cstring>
+#include <new>
+
+// ---------- arena ----------
+
+KvArena::~KvArena()
+{
+  for (char *c : chunks_)
+    ::operator delete(c);
+}
+
+void *KvArena::allocate(size_t bytes, size_t &got)
+{
+  int shift = MIN_SHIFT;
+  while ((size_t{1} << shift) < bytes)
+    ++shift;
+
+  if (shift > MAX_SHIFT)
+  {
+    got = bytes;
+    return ::operator new(bytes);
+  }
+
+  const size_t size = size_t{1} << shift;
+  got = size;
+
+  FreeBlock *&head = free_[shift - MIN_SHIFT];
+  if (head)
+  {
+    FreeBlock *b = head;
+    head = b->next;
+    return b;
+  }
+
+  if (bump_left_ < size)
+  {
+    // The tail of the old chunk is abandoned; at most one block per chunk.
+    chunks_.push_back(static_cast<char *>(::operator new(CHUNK)));
+    bump_ = chunks_.back();
+    bump_left_ = CHUNK;
+  }
+
+  void *b = bump_;
+  bump_ += size;
+  bump_left_ -= size;
+  return b;
+}
+
+void KvArena::free(void *block, size_t size)
+{
+  if (size > (size_t{1} << MAX_SHIFT))
+  {
+    ::operator delete(block);
+    return;
+  }
+
+  int shift = MIN_SHIFT;
+  while ((size_t{1} << shift) < size)
+    ++shift;
+
+  FreeBlock *b = static_cast<FreeBlock *>(block);
+  b->next = free_[shift - MIN_SHIFT];
+  free_[shift - MIN_SHIFT] = b;
+}
+
+// ---------- store ----------
+
+static constexpr size_t INITIAL_SLOTS = 1024;
+
+KvStore::KvStore() : slots_(INITIAL_SLOTS, Slot{0, nullptr}), mask_(INITIAL_SLOTS - 1)
+{
+}
+
+void KvStore::rehome()
+{
+  std::vector<Slot>(slots_).swap(slots_);
+}
+
+KvStore::~KvStore()
+{
+  // Large items live outside the arena chunks and must be freed one by one.
+  for (Slot &s : slots_)
+  {
+    if (s.hash)
+      free_item(s.item);
+  }
+}
+
+uint64_t KvStore::hash(std::string_view key)
+{
+  // FNV-1a with a final avalanche so low bits are usable as an index.
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : key)
+  {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h ? h : 1; // 0 marks an empty slot
+}
+
+int64_t KvStore::now_ms()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t KvStore::find(std::string_view key, uint64_t h) const
+{
+  for (size_t i = h & mask_;; i = (i + 1) & mask_)
+  {
+    const Slot &s = slots_[i];
+    if (s.hash == 0)
+      return SIZE_MAX;
+    if (s.hash == h && s.item->key() == key)
+      return i;
+  }
+}
+
+const KvItem *KvStore::get(std::string_view key, uint64_t h, int64_t now)
+{
+  size_t i = find(key, h);
+  if (i == SIZE_MAX)
+    return nullptr;
+
+  if (expired(slots_[i].item, now))
+  {
+    erase_at(i); // lazy expiry
+    return nullptr;
+  }
+  return slots_[i].item;
+}
+
+void KvStore::set(std::string_view key, uint64_t h, std::string_view value)
+{
+  const size_t need = key.size() + value.size();
+  size_t i = find(key, h);
+
+  if (i != SIZE_MAX)
+  {
+    KvItem *item = slots_[i].item;
+    if (item->expires_at != 0)
+      --volatile_;
+    item->expires_at = 0;
+
+    // Overwrite in place when the block is big enough.
+    if (need <= item->capacity)
+    {
+      std::memcpy(item->data() + item->key_len, value.data(), value.size());
+      item->value_len = static_cast<uint32_t>(value.size());
+      return;
+    }
+    erase_at(i);
+  }
+
+  if ((size_ + 1) * 10 > slots_.size() * 7)
+    grow();
+
+  size_t got = 0;
+  void *block = arena_.allocate(sizeof(KvItem) + need, got);
+  KvItem *item = static_cast<KvItem *>(block);
+  item->key_len = static_cast<uint32_t>(key.size());
+  item->value_len = static_cast<uint32_t>(value.size());
+  item->capacity = static_cast<uint32_t>(got - sizeof(KvItem));
+  item->expires_at = 0;
+  std::memcpy(item->data(), key.data(), key.size());
+  std::memcpy(item->data() + key.size(), value.data(), value.size());
+
+  size_t j = h & mask_;
+  while (slots_[j].hash != 0)
+    j = (j + 1) & mask_;
+  slots_[j] = {h, item};
+  ++size_;
+}
+
+bool KvStore::del(std::string_view key, uint64_t h, int64_t now)
+{
+  size_t i = find(key, h);
+  if (i == SIZE_MAX)
+    return false;
+
+  bool live = !expired(slots_[i].item, now);
+  erase_at(i);
+  return live;
+}
+
+bool KvStore::expire(std::string_view key, uint64_t h, int64_t at, int64_t now)
+{
+  size_t i = find(key, h);
+  if (i == SIZE_MAX)
+    return false;
+
+  KvItem *item = slots_[i].item;
+  if (expired(item, now))
+  {
+    erase_at(i);
+    return false;
+  }
+
+  if (at <= now)
+  {
+    erase_at(i);
+    return true;
+  }
+
+  if (item->expires_at == 0)
+    ++volatile_;
+  item->expires_at = at;
+  return true;
+}
+
+size_t KvStore::expire_step(int64_t now, size_t budget)
+{
+  if (volatile_ == 0)
+    return 0;
+
+  size_t removed = 0;
+  for (size_t n = 0; n < budget; ++n)
+  {
+    size_t i = cursor_ & mask_;
+    const Slot &s = slots_[i];
+    if (s.hash != 0 && expired(s.item, now))
+    {
+      // The run behind shifts into slot i; look at it again.
+      erase_at(i);
+      ++removed;
+      continue;
+    }
+    cursor_ = i + 1;
+  }
+  return removed;
+}
+
+void KvStore::erase_at(size_t i)
+{
+  free_item(slots_[i].item);
+  --size_;
+
+  // Backward-shift deletion: pull later members of the probe run into
+  // the hole whenever the hole lies between their home slot and them.
+  size_t hole = i;
+  for (size_t j = (i + 1) & mask_;; j = (j + 1) & mask_)
+  {
+    const Slot &s = slots_[j];
+    if (s.hash == 0)
+      break;
+    size_t home = s.hash & mask_;
+    if (((j - home) & mask_) >= ((j - hole) & mask_))
+    {
+      slots_[hole] = s;
+      hole = j;
+    }
+  }
+  slots_[hole] = {0, nullptr};
+}
+
+void KvStore::grow()
+{
+  std::vector<Slot> old(slots_.size() * 2, Slot{0, nullptr});
+  old.swap(slots_);
+  mask_ = slots_.size() - 1;
+  cursor_ = 0;
+
+  for (const Slot &s : old)
+  {
+    if (s.hash == 0)
+      continue;
+    size_t j = s.hash & mask_;
+    while (slots_[j].hash != 0)
+      j = (j + 1) & mask_;
+    slots_[j] = s;
+  }
+}
+
+void KvStore::free_item(KvItem *item)
+{
+  if (item->expires_at != 0)
+    --volatile_;
+  arena_.free(item, sizeof(KvItem) + item->capacity);
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Key and value stored back to back in one arena block.
+struct KvItem
+{
+  uint32_t key_len;
+  uint32_t value_len;
+  uint32_t capacity;  // bytes available after the header
+  int64_t expires_at; // steady-clock ms; 0 = no TTL
+
+  char *data() { return reinterpret_cast<char *>(this + 1); }
+  const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+  std::string_view key() const { return {data(), key_len}; }
+  std::string_view value() const { return {data() + key_len, value_len}; }
+};
+
+// Size-classed slab for KvItems: 64 B to 64 KB in powers of two, carved
+// from 1 MB chunks and recycled through per-class free lists. Larger
+// items come straight from the heap.
+class KvArena
+{
+public:
+  KvArena() = default;
+  ~KvArena();
+  KvArena(const KvArena &) = delete;
+  KvArena &operator=(const KvArena &) = delete;
+
+  // Block of at least `bytes`; the usable size is written to `got`.
+  void *allocate(size_t bytes, size_t &got);
+  void free(void *block, size_t size);
+
+  size_t chunk_bytes() const { return chunks_.size() * CHUNK; }
+
+private:
+  static constexpr int MIN_SHIFT = 6;
+  static constexpr int MAX_SHIFT = 16;
+  static constexpr size_t CHUNK = 1024 * 1024;
+
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  FreeBlock *free_[MAX_SHIFT - MIN_SHIFT + 1] = {};
+  std::vector<char *> chunks_;
+  char *bump_ = nullptr;
+  size_t bump_left_ = 0;
+};
+
+// One shard of the key-value store, owned by a single reactor and never
+// locked. Open addressing with linear probing over 16-byte slots (full
+// hash + item pointer), so a probe touches one cache line and compares
+// keys only on a hash match. Deletion shifts the following run back
+// instead of leaving tombstones.
+//
+// TTLs expire lazily (a lookup that finds an expired item removes it) and
+// incrementally: expire_step() visits a bounded number of slots per call
+// from a rotating cursor.
+class KvStore
+{
+public:
+  KvStore();
+  ~KvStore();
+  KvStore(const KvStore &) = delete;
+  KvStore &operator=(const KvStore &) = delete;
+
+  static uint64_t hash(std::string_view key);
+  static int64_t now_ms();
+
+  // nullptr when missing or expired. The item stays valid until the next
+  // call that modifies the store.
+  const KvItem *get(std::string_view key, uint64_t h, int64_t now);
+
+  // Inserts or overwrites; clears any TTL.
+  void set(std::string_view key, uint64_t h, std::string_view value);
+  bool del(std::string_view key, uint64_t h, int64_t now);
+  // Sets an absolute expiry; false if the key does not exist.
+  bool expire(std::string_view key, uint64_t h, int64_t at, int64_t now);
+
+  // Removes expired items among the next `budget` slots. Returns the
+  // number removed.
+  size_t expire_step(int64_t now, size_t budget);
+
+  size_t size() const { return size_; }
+  size_t volatile_count() const { return volatile_; }
+
+  // Reallocates the slot array from the calling thread (see
+  // ConnectionTable::rehome). Items stay where they are.
+  void rehome();
+
+  static constexpr size_t MAX_KEY = 512;
+
+private:
+  struct Slot
+  {
+    uint64_t hash; // 0 = empty
+    KvItem *item;
+  };
+
+  size_t find(std::string_view key, uint64_t h) const; // index or SIZE_MAX
+  void erase_at(size_t i);
+  void grow();
+  void free_item(KvItem *item);
+  bool expired(const KvItem *item, int64_t now) const
+  {
+    return item->expires_at != 0 && item->expires_at <= now;
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_;
+  size_t size_ = 0;
+  size_t volatile_ = 0; // items with a TTL
+  size_t cursor_ = 0;   // expire_step() position
+  KvArena arena_;
+};
@@ -0,0 +1,260 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Single producer (the thread that owns it), single consumer (the logger
+// thread). Indices only grow; head_ and tail_ sit on separate lines.
+struct Logger::Ring
+{
+  static constexpr size_t CAPACITY = 4096; // power of two
+
+  bool push(const LogRecord &r)
+  {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == CAPACITY)
+    {
+      // Single writer: a relaxed load/store pair, as in Metrics::add().
+      dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      return false;
+    }
+    slots_[head & (CAPACITY - 1)] = r;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: copies out everything published so far.
+  void pop_all(std::vector<LogRecord> &out)
+  {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    for (uint64_t i = tail; i != head; ++i)
+      out.push_back(slots_[i & (CAPACITY - 1)]);
+    tail_.store(head, std::memory_order_release);
+  }
+
+  alignas(64) std::atomic<uint64_t> head_{0};
+  std::atomic<uint64_t> dropped{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  LogRecord slots_[CAPACITY];
+};
+
+std::atomic<int> Logger::min_level_{INT_MAX}; // nothing until start()
+std::atomic<bool> Logger::running_{false};
+std::mutex Logger::rings_mutex_;
+std::vector<std::unique_ptr<Logger::Ring>> Logger::rings_;
+std::thread Logger::thread_;
+
+static const char *level_name(uint8_t level)
+{
+  static const char *const names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+  return level < 4 ? names[level] : "?    ";
+}
+
+void Logger::start(LogLevel level)
+{
+  if (running_.exchange(true))
+    return;
+  thread_ = std::thread(drain_loop);
+  min_level_.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void Logger::stop()
+{
+  min_level_.store(INT_MAX, std::memory_order_relaxed);
+  if (!running_.exchange(false))
+    return;
+  thread_.join();
+  drain_once(); // anything that raced with the last pass
+}
+
+uint64_t Logger::dropped()
+{
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  uint64_t total = 0;
+  for (const auto &ring : rings_)
+    total += ring->dropped.load(std::memory_order_relaxed);
+  return total;
+}
+
+uint64_t Logger::now_ns()
+{
+  timespec ts;
+  ::clock_gettime(CLOCK_REALTIME, &ts); // vDSO, no syscall
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void Logger::submit(const LogRecord &r)
+{
+  thread_local Ring *ring = register_thread();
+  ring->push(r);
+}
+
+Logger::Ring *Logger::register_thread()
+{
+  // Once per thread; rings live until exit, so the consumer never races
+  // with a thread that has gone away.
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  rings_.push_back(std::make_unique<Ring>());
+  return rings_.back().get();
+}
+
+void Logger::drain_loop()
+{
+  // Producers never signal (that would be a syscall on the hot path), so
+  // an idle logger polls. A few milliseconds of latency is fine for logs.
+  constexpr auto IDLE_SLEEP = std::chrono::milliseconds(5);
+  while (running_.load(std::memory_order_relaxed))
+  {
+    if (drain_once() == 0)
+      std::this_thread::sleep_for(IDLE_SLEEP);
+  }
+}
+
+static void format_record(std::string &out, const LogRecord &r)
+{
+  const time_t sec = static_cast<time_t>(r.time_ns / 1000000000ull);
+  tm t;
+  ::gmtime_r(&sec, &t);
+  char stamp[48];
+  std::snprintf(stamp, sizeof(stamp), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ ",
+                t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour,
+                t.tm_min, t.tm_sec,
+                static_cast<unsigned>(r.time_ns % 1000000000ull / 1000));
+  out += stamp;
+  out += level_name(r.level);
+  out += ' ';
+
+  int arg = 0;
+  for (const char *p = r.fmt; *p; ++p)
+  {
+    if (p[0] != '{' || p[1] != '}' || arg == r.nargs)
+    {
+      out += *p;
+      continue;
+    }
+    const LogRecord::Arg &a = r.args[arg];
+    switch (r.kinds[arg++])
+    {
+    case LogRecord::INT:
+      out += std::to_string(a.i);
+      break;
+    case LogRecord::UINT:
+      out += std::to_string(a.u);
+      break;
+    case LogRecord::STR:
+      out += a.s ? a.s : "(null)";
+      break;
+    case LogRecord::ERRNO:
+      out += std::strerror(static_cast<int>(a.i));
+      break;
+    }
+    ++p;
+  }
+  out += '\n';
+}
+
+static void write_all(int fd, iovec *iov, size_t count)
+{
+  while (count > 0)
+  {
+    const int batch = static_cast<int>(std::min<size_t>(count, IOV_MAX));
+    ssize_t n = ::writev(fd, iov, batch);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return; // nowhere left to report it
+    }
+    // Skip what went out; a short write resumes mid-entry.
+    size_t left = static_cast<size_t>(n);
+    while (count > 0 && left >= iov->iov_len)
+    {
+      left -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+}
+
+size_t Logger::drain_once()
+{
+  static std::vector<LogRecord> batch; // logger thread (or stop()) only
+  static uint64_t reported_drops = 0;
+  batch.clear();
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (const auto &ring : rings_)
+      ring->pop_all(batch);
+  }
+
+  const uint64_t drops = dropped();
+  if (batch.empty() && drops == reported_drops)
+    return 0;
+
+  // Rings are drained one after another; put the threads' records back
+  // in time order.
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const LogRecord &a, const LogRecord &b) {
+                     return a.time_ns < b.time_ns;
+                   });
+
+  // Every line goes into one buffer; each stream's lines are then
+  // gathered into a single writev().
+  static std::string text;
+  static std::vector<size_t> ends;
+  static std::vector<iovec> out, err;
+  text.clear();
+  ends.clear();
+  for (const LogRecord &r : batch)
+  {
+    format_record(text, r);
+    ends.push_back(text.size());
+  }
+  if (drops != reported_drops)
+  {
+    text += "[logger] dropped " + std::to_string(drops - reported_drops) +
+            " records (rings full)\n";
+    reported_drops = drops;
+  }
+
+  out.clear();
+  err.clear();
+  size_t begin = 0;
+  for (size_t i = 0; i <= batch.size(); ++i)
+  {
+    // The last entry is the drop note, if any.
+    const size_t end = i < batch.size() ? ends[i] : text.size();
+    if (end == begin)
+      continue;
+    const bool is_err =
+        i == batch.size() ||
+        batch[i].level >= static_cast<uint8_t>(LogLevel::WARN);
+    std::vector<iovec> &iov = is_err ? err : out;
+    // Adjacent lines for the same stream share an entry.
+    if (!iov.empty() &&
+        static_cast<char *>(iov.back().iov_base) + iov.back().iov_len ==
+            &text[begin])
+      iov.back().iov_len += end - begin;
+    else
+      iov.push_back({&text[begin], end - begin});
+    begin = end;
+  }
+  write_all(STDOUT_FILENO, out.data(), out.size());
+  write_all(STDERR_FILENO, err.data(), err.size());
+  return batch.size();
+}
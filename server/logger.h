@@ -0,0 +1,152 @@
+#pragma once
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Levels below this are compiled out: their LOG_* calls, arguments
+// included, generate no code. Set with -DNETLAB_LOG_MIN_LEVEL=<0..3>
+// (0 = debug ... 3 = error).
+#ifndef NETLAB_LOG_MIN_LEVEL
+#define NETLAB_LOG_MIN_LEVEL 0
+#endif
+
+using LogLevel = ServerConfig::LogLevel;
+
+// errno captured at the call site; formatted with strerror() on the
+// logger thread.
+struct LogErrno
+{
+  int value;
+};
+
+// One log call, stored as is: the format string and up to MAX_ARGS raw
+// arguments. Strings must outlive the process (literals), which the
+// argument overloads below enforce for std::string.
+struct LogRecord
+{
+  static constexpr int MAX_ARGS = 8;
+  enum Kind : uint8_t
+  {
+    INT,
+    UINT,
+    STR,
+    ERRNO
+  };
+
+  uint64_t time_ns;
+  const char *fmt; // "{}" marks each argument
+  uint8_t level;
+  uint8_t nargs;
+  uint8_t kinds[MAX_ARGS];
+  union Arg
+  {
+    int64_t i;
+    uint64_t u;
+    const char *s;
+  } args[MAX_ARGS];
+};
+
+// Leveled, asynchronous logging. A LOG_* call copies one fixed-size
+// record into its thread's single-producer ring and returns; it never
+// locks, allocates or blocks. A background thread drains every ring,
+// formats the records in time order and writes each batch with one
+// writev() per stream (debug/info to stdout, warn/error to stderr).
+// When a ring is full the record is dropped and counted.
+//
+// Until start() runs (benchmarks, tools), every call is a no-op.
+class Logger
+{
+public:
+  static void start(LogLevel level);
+  // Writes out everything logged so far, then joins the thread.
+  static void stop();
+
+  static bool enabled(LogLevel level)
+  {
+    return static_cast<int>(level) >=
+           min_level_.load(std::memory_order_relaxed);
+  }
+
+  template <typename... Args>
+  static void log(LogLevel level, const char *fmt, const Args &...args)
+  {
+    static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS,
+                  "too many log arguments");
+    LogRecord r;
+    r.time_ns = now_ns();
+    r.fmt = fmt;
+    r.level = static_cast<uint8_t>(level);
+    r.nargs = 0;
+    (put(r, args), ...);
+    submit(r);
+  }
+
+  // Records lost to full rings since start.
+  static uint64_t dropped();
+
+private:
+  struct Ring;
+
+  template <typename T>
+  static void put(LogRecord &r, T v)
+  {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "log arguments are integers, literals or LogErrno");
+    if (std::is_signed<T>::value)
+    {
+      r.kinds[r.nargs] = LogRecord::INT;
+      r.args[r.nargs++].i = static_cast<int64_t>(v);
+    }
+    else
+    {
+      r.kinds[r.nargs] = LogRecord::UINT;
+      r.args[r.nargs++].u = static_cast<uint64_t>(v);
+    }
+  }
+  static void put(LogRecord &r, const char *s)
+  {
+    r.kinds[r.nargs] = LogRecord::STR;
+    r.args[r.nargs++].s = s;
+  }
+  static void put(LogRecord &r, LogErrno e)
+  {
+    r.kinds[r.nargs] = LogRecord::ERRNO;
+    r.args[r.nargs++].i = e.value;
+  }
+  // Its buffer may be gone by the time the record is formatted.
+  static void put(LogRecord &r, const std::string &) = delete;
+
+  static uint64_t now_ns();
+  static void submit(const LogRecord &r);
+  static Ring *register_thread();
+  static void drain_loop();
+  static size_t drain_once();
+
+  static std::atomic<int> min_level_;
+  static std::atomic<bool> running_;
+  static std::mutex rings_mutex_; // never taken by a LOG call
+  static std::vector<std::unique_ptr<Ring>> rings_;
+  static std::thread thread_;
+};
+
+#define NETLAB_LOG(level, ...)                                            \
+  do                                                                      \
+  {                                                                       \
+    if constexpr (static_cast<int>(level) >= NETLAB_LOG_MIN_LEVEL)        \
+    {                                                                     \
+      if (Logger::enabled(level))                                         \
+        Logger::log(level, __VA_ARGS__);                                  \
+    }                                                                     \
+  } while (0)
+
+#define LOG_DEBUG(...) NETLAB_LOG(LogLevel::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) NETLAB_LOG(LogLevel::INFO, __VA_ARGS__)
+#define LOG_WARN(...) NETLAB_LOG(LogLevel::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) NETLAB_LOG(LogLevel::ERROR, __VA_ARGS__)
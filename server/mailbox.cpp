@@ -0,0 +1,57 @@
+#include "mailbox.h"
+
+Mailbox::Mailbox() : head_(&stub_), tail_(&stub_) {}
+
+Mailbox::~Mailbox()
+{
+  while (ReactorTask *t = pop())
+    delete t;
+}
+
+void Mailbox::enqueue(ReactorTask *task)
+{
+  task->next.store(nullptr, std::memory_order_relaxed);
+  ReactorTask *prev = tail_.exchange(task, std::memory_order_acq_rel);
+  prev->next.store(task, std::memory_order_release);
+}
+
+bool Mailbox::push(ReactorTask *task)
+{
+  enqueue(task);
+  return !signaled_.exchange(true, std::memory_order_acq_rel);
+}
+
+ReactorTask *Mailbox::pop()
+{
+  ReactorTask *head = head_;
+  ReactorTask *next = head->next.load(std::memory_order_acquire);
+
+  if (head == &stub_)
+  {
+    if (!next)
+      return nullptr;
+    head_ = next;
+    head = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+
+  if (next)
+  {
+    head_ = next;
+    return head;
+  }
+
+  // head is the last node. Unless a producer is mid-push, put the stub
+  // back behind it so head can be handed out.
+  if (head != tail_.load(std::memory_order_acquire))
+    return nullptr;
+
+  enqueue(&stub_);
+  next = head->next.load(std::memory_order_acquire);
+  if (next)
+  {
+    head_ = next;
+    return head;
+  }
+  return nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+
+class Server;
+
+// Work handed from one reactor to another. Allocated by the sender, run
+// and deleted by the receiving reactor on its own thread.
+struct ReactorTask
+{
+  virtual ~ReactorTask() = default;
+  virtual void run(Server &server) = 0;
+
+  std::atomic<ReactorTask *> next{nullptr};
+};
+
+// Intrusive multi-producer, single-consumer queue (Vyukov). push() is one
+// atomic exchange plus a store and never blocks or locks; only the owning
+// reactor pops. The signalled flag collapses a burst of posts into a
+// single eventfd wake-up.
+class Mailbox
+{
+public:
+  Mailbox();
+  ~Mailbox(); // deletes anything never delivered
+  Mailbox(const Mailbox &) = delete;
+  Mailbox &operator=(const Mailbox &) = delete;
+
+  // Any thread. Returns true when the consumer must be woken.
+  bool push(ReactorTask *task);
+
+  // Consumer only: re-arms the wake-up signal before draining, so a push
+  // racing with the drain is either seen by pop() or wakes us again.
+  void begin_drain() { signaled_.exchange(false, std::memory_order_acq_rel); }
+
+  // Consumer only. nullptr when empty (or a push is half-way through; its
+  // producer has not signalled yet and will).
+  ReactorTask *pop();
+
+private:
+  struct Stub : ReactorTask
+  {
+    void run(Server &) override {}
+  };
+
+  void enqueue(ReactorTask *task);
+
+  Stub stub_;
+  ReactorTask *head_;                // consumer side
+  std::atomic<ReactorTask *> tail_;  // producer side
+  std::atomic<bool> signaled_{false};
+};
@@ -1,10 +1,19 @@
 #include "config.h"
+#include "handoff.h"
+#include "metrics.h"
 #include "server.h"
 #include "socket_utils.h"
+#include "topology.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 static void print_usage(const char *prog) {
   std::cerr << "Usage: " << prog << " [options]\n"
@@ -14,6 +23,40 @@ static void print_usage(const char *prog) {
             << "  --backlog <num>             listen() backlog\n"
             << "  --recv-buffer <bytes>       Socket receive buffer size\n"
             << "  --send-buffer <bytes>       Socket send buffer size\n"
+            << "  --threads <num>             Event loops (SO_REUSEPORT shards)\n"
+            << "  --io-backend <epoll|uring>  Syscall layer (uring falls back)\n"
+            << "  --edge-triggered <0|1>      epoll: EPOLLET plus a ready list\n"
+            << "  --events-per-wait <num>     epoll_wait() batch size\n"
+            << "  --io-budget <bytes>         Read/write per connection per tick\n"
+            << "  --accept-budget <num>       Connections accepted per wakeup\n"
+            << "  --cpu-affinity <list|auto>  Pin reactor r to the r-th CPU of\n"
+            << "                              a list (\"0-3,8\"); auto = all allowed\n"
+            << "  --numa-policy <none|local|bind|interleave>\n"
+            << "                              Reactor memory placement\n"
+            << "  --max-frame-rate <num>      Frames/s per connection (0 = off)\n"
+            << "  --max-byte-rate <num>       Bytes/s per connection (0 = off)\n"
+            << "  --ip-frame-rate <num>       Frames/s per source IP (0 = off)\n"
+            << "  --ip-byte-rate <num>        Bytes/s per source IP (0 = off)\n"
+            << "  --max-conns-per-ip <num>    Connections per source IP (0 = off)\n"
+            << "  --metrics-port <port>       Prometheus endpoint on 127.0.0.1\n"
+            << "  --drain-timeout <ms>        Graceful drain on SIGTERM/SHUTDOWN\n"
+            << "  --memory-budget <MB>        Buffer memory cap (0 = off)\n"
+            << "  --zero-copy <0|1>           splice/sendfile for large payloads\n"
+            << "  --blob-dir <path>           Directory served by BLOB <name>\n"
+            << "  --slow-subscriber <drop|disconnect>\n"
+            << "                              Pub/sub subscriber over high water\n"
+            << "  --trace-sample <num>        Trace ~1 frame in num (0 = off)\n"
+            << "  --trace-file <path>         Trace ring file (netlab.trace)\n"
+            << "  --socket-profile <default|latency|throughput>\n"
+            << "                              Socket option preset; the flags\n"
+            << "                              below, given after it, override\n"
+            << "  --tcp-nodelay <0|1>         TCP_NODELAY on accepted sockets\n"
+            << "  --tcp-quickack <0|1>        TCP_QUICKACK, re-armed per read\n"
+            << "  --defer-accept <sec>        TCP_DEFER_ACCEPT (0 = off)\n"
+            << "  --busy-poll <usec>          SO_BUSY_POLL (needs CAP_NET_ADMIN)\n"
+            << "  --prefer-busy-poll <0|1>    SO_PREFER_BUSY_POLL\n"
+            << "  --tcp-fastopen <qlen>       TCP_FASTOPEN queue (0 = off)\n"
+            << "  --incoming-cpu <0|1>        Steer flows to reactor = RX CPU\n"
             << "  --log-level <debug|info|warn|error>\n";
 }
 
@@ -27,6 +70,14 @@ static bool parse_int(const char *s, int &out) {
   return true;
 }
 
+static bool parse_bool(const char *s, bool &out) {
+  if (std::strcmp(s, "0") == 0 || std::strcmp(s, "1") == 0) {
+    out = s[0] == '1';
+    return true;
+  }
+  return false;
+}
+
 static bool validate_config(const ServerConfig &cfg) {
   if (cfg.port < 1024) {
     std::cerr << "Invalid port: must be >= 1024\n";
@@ -53,12 +104,86 @@ static bool validate_config(const ServerConfig &cfg) {
     return false;
   }
 
+  if (cfg.threads < 1 || cfg.threads > 256) {
+    std::cerr << "threads must be in [1, 256]\n";
+    return false;
+  }
+
+  if (cfg.max_frame_rate < 0 || cfg.max_byte_rate < 0 ||
+      cfg.ip_frame_rate < 0 || cfg.ip_byte_rate < 0 ||
+      cfg.max_connections_per_ip < 0) {
+    std::cerr << "rate and per-IP limits must be >= 0\n";
+    return false;
+  }
+
+  if (cfg.sock.defer_accept_s < 0 || cfg.sock.busy_poll_us < 0 ||
+      cfg.sock.fastopen_queue < 0) {
+    std::cerr << "socket option values must be >= 0\n";
+    return false;
+  }
+
+  if (cfg.drain_timeout_ms < 0) {
+    std::cerr << "drain_timeout must be >= 0\n";
+    return false;
+  }
+
+  if (cfg.events_per_wait < 1 || cfg.events_per_wait > 4096) {
+    std::cerr << "events_per_wait must be in [1, 4096]\n";
+    return false;
+  }
+
+  if (cfg.accept_budget < 1) {
+    std::cerr << "accept_budget must be >= 1\n";
+    return false;
+  }
+
+  if (cfg.trace_sample < 0) {
+    std::cerr << "trace_sample must be >= 0\n";
+    return false;
+  }
+
+  if (cfg.io_budget_bytes < 4096) {
+    std::cerr << "io_budget must be >= 4096 bytes\n";
+    return false;
+  }
+
+  if (cfg.memory_budget_mb < 0) {
+    std::cerr << "memory_budget must be >= 0\n";
+    return false;
+  }
+
+  if (!cfg.cpu_affinity.empty()) {
+    const std::vector<int> allowed = allowed_cpus();
+    for (int cpu : cfg.cpu_affinity) {
+      if (!std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+        std::cerr << "cpu_affinity: CPU " << cpu
+                  << " is not available to this process (allowed "
+                  << format_cpu_list(allowed) << ")\n";
+        return false;
+      }
+    }
+  }
+
+  if (cfg.numa_policy == ServerConfig::NumaPolicy::BIND &&
+      cfg.cpu_affinity.empty()) {
+    std::cerr << "numa_policy bind needs --cpu-affinity\n";
+    return false;
+  }
+
+  if (cfg.metrics_port != 0 &&
+      (cfg.metrics_port < 1024 || cfg.metrics_port > 65535 ||
+       cfg.metrics_port == cfg.port)) {
+    std::cerr << "metrics_port must be 0 or a free port >= 1024\n";
+    return false;
+  }
+
   return true;
 }
 
 int main(int argc, char *argv[]) {
 
   ServerConfig cfg = ServerConfig::defaults();
+  handoff_init(argc, argv); // SIGHUP re-executes the same command line
 
   for (int i = 1; i < argc; ++i) {
     if (std::strcmp(argv[i], "--port") == 0) {
@@ -101,6 +226,200 @@ int main(int argc, char *argv[]) {
         std::cerr << "Invalid --send-buffer value\n";
         return EXIT_FAILURE;
       }
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.threads)) {
+        std::cerr << "Invalid --threads value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--max-frame-rate") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.max_frame_rate)) {
+        std::cerr << "Invalid --max-frame-rate value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--max-byte-rate") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.max_byte_rate)) {
+        std::cerr << "Invalid --max-byte-rate value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--ip-frame-rate") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.ip_frame_rate)) {
+        std::cerr << "Invalid --ip-frame-rate value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--ip-byte-rate") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.ip_byte_rate)) {
+        std::cerr << "Invalid --ip-byte-rate value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--max-conns-per-ip") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.max_connections_per_ip)) {
+        std::cerr << "Invalid --max-conns-per-ip value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--metrics-port") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.metrics_port)) {
+        std::cerr << "Invalid --metrics-port value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--drain-timeout") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.drain_timeout_ms)) {
+        std::cerr << "Invalid --drain-timeout value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--memory-budget") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.memory_budget_mb)) {
+        std::cerr << "Invalid --memory-budget value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--socket-profile") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --socket-profile value\n";
+        return EXIT_FAILURE;
+      }
+      if (std::strcmp(argv[i], "default") == 0) {
+        cfg.sock = ServerConfig::socket_profile(
+            ServerConfig::SocketProfile::DEFAULT);
+      } else if (std::strcmp(argv[i], "latency") == 0) {
+        cfg.sock = ServerConfig::socket_profile(
+            ServerConfig::SocketProfile::LATENCY);
+      } else if (std::strcmp(argv[i], "throughput") == 0) {
+        cfg.sock = ServerConfig::socket_profile(
+            ServerConfig::SocketProfile::THROUGHPUT);
+      } else {
+        std::cerr << "Invalid socket profile\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--tcp-nodelay") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.sock.nodelay)) {
+        std::cerr << "Invalid --tcp-nodelay value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--tcp-quickack") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.sock.quickack)) {
+        std::cerr << "Invalid --tcp-quickack value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--defer-accept") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.sock.defer_accept_s)) {
+        std::cerr << "Invalid --defer-accept value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--busy-poll") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.sock.busy_poll_us)) {
+        std::cerr << "Invalid --busy-poll value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--prefer-busy-poll") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.sock.prefer_busy_poll)) {
+        std::cerr << "Invalid --prefer-busy-poll value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--tcp-fastopen") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.sock.fastopen_queue)) {
+        std::cerr << "Invalid --tcp-fastopen value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--incoming-cpu") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.sock.incoming_cpu)) {
+        std::cerr << "Invalid --incoming-cpu value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--zero-copy") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.zero_copy)) {
+        std::cerr << "Invalid --zero-copy value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--blob-dir") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --blob-dir value\n";
+        return EXIT_FAILURE;
+      }
+      cfg.blob_dir = argv[i];
+    } else if (std::strcmp(argv[i], "--io-backend") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --io-backend value\n";
+        return EXIT_FAILURE;
+      }
+      if (std::strcmp(argv[i], "epoll") == 0) {
+        cfg.io_backend = ServerConfig::IoBackend::EPOLL;
+      } else if (std::strcmp(argv[i], "uring") == 0) {
+        cfg.io_backend = ServerConfig::IoBackend::URING;
+      } else {
+        std::cerr << "Invalid io backend\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--edge-triggered") == 0) {
+      if (++i >= argc || !parse_bool(argv[i], cfg.edge_triggered)) {
+        std::cerr << "Invalid --edge-triggered value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--events-per-wait") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.events_per_wait)) {
+        std::cerr << "Invalid --events-per-wait value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--io-budget") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.io_budget_bytes)) {
+        std::cerr << "Invalid --io-budget value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--accept-budget") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.accept_budget)) {
+        std::cerr << "Invalid --accept-budget value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--trace-sample") == 0) {
+      if (++i >= argc || !parse_int(argv[i], cfg.trace_sample)) {
+        std::cerr << "Invalid --trace-sample value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--trace-file") == 0) {
+      if (++i >= argc || argv[i][0] == '\0') {
+        std::cerr << "Missing --trace-file value\n";
+        return EXIT_FAILURE;
+      }
+      cfg.trace_file = argv[i];
+    } else if (std::strcmp(argv[i], "--slow-subscriber") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --slow-subscriber value\n";
+        return EXIT_FAILURE;
+      }
+      if (std::strcmp(argv[i], "drop") == 0) {
+        cfg.slow_subscriber = ServerConfig::SlowSubscriber::DROP;
+      } else if (std::strcmp(argv[i], "disconnect") == 0) {
+        cfg.slow_subscriber = ServerConfig::SlowSubscriber::DISCONNECT;
+      } else {
+        std::cerr << "Invalid slow subscriber policy\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--cpu-affinity") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --cpu-affinity value\n";
+        return EXIT_FAILURE;
+      }
+      if (std::strcmp(argv[i], "auto") == 0) {
+        cfg.cpu_affinity = allowed_cpus();
+      } else if (!parse_cpu_list(argv[i], cfg.cpu_affinity)) {
+        std::cerr << "Invalid --cpu-affinity value\n";
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--numa-policy") == 0) {
+      if (++i >= argc) {
+        std::cerr << "Missing --numa-policy value\n";
+        return EXIT_FAILURE;
+      }
+      if (std::strcmp(argv[i], "none") == 0) {
+        cfg.numa_policy = ServerConfig::NumaPolicy::NONE;
+      } else if (std::strcmp(argv[i], "local") == 0) {
+        cfg.numa_policy = ServerConfig::NumaPolicy::LOCAL;
+      } else if (std::strcmp(argv[i], "bind") == 0) {
+        cfg.numa_policy = ServerConfig::NumaPolicy::BIND;
+      } else if (std::strcmp(argv[i], "interleave") == 0) {
+        cfg.numa_policy = ServerConfig::NumaPolicy::INTERLEAVE;
+      } else {
+        std::cerr << "Invalid numa policy\n";
+        return EXIT_FAILURE;
+      }
     } else if (std::strcmp(argv[i], "--log-level") == 0) {
       if (++i >= argc) {
         std::cerr << "Missing --log-level value\n";
@@ -130,18 +449,113 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  std::cout << "network_server starting with validated configuration\n";
-  std::cout << "port=" << cfg.port << " backlog=" << cfg.backlog
-            << " max_connections=" << cfg.max_connections << "\n";
+  // From here on the reactors log; keep everything on the logger so the
+  // lines stay in order.
+  Logger::start(cfg.log_level);
+  LOG_INFO("network_server starting with validated configuration");
+  LOG_INFO("port={} backlog={} max_connections={} threads={}", cfg.port,
+           cfg.backlog, cfg.max_connections, cfg.threads);
+
+  // Started by a restart: serve the predecessor's listeners, one reactor
+  // each, instead of binding new ones.
+  int handoff_channel = -1;
+  const std::vector<int> inherited = handoff_receive(handoff_channel);
+  if (!inherited.empty() &&
+      inherited.size() != static_cast<size_t>(cfg.threads)) {
+    LOG_INFO("Inherited {} listeners, running that many reactors",
+             inherited.size());
+    cfg.threads = static_cast<int>(inherited.size());
+  }
+
+  const bool reuse_port = cfg.threads > 1;
+
+  std::vector<std::unique_ptr<Server>> servers;
+  std::vector<Server *> reactors;
+  int first_listener = -1;
+  // The CPU each reactor's flows should arrive on: its pinned one, or CPU
+  // r when reactors are not pinned.
+  std::vector<int> steering_cpus;
+  for (int r = 0; r < cfg.threads; ++r) {
+    steering_cpus.push_back(cfg.cpu_affinity.empty() ? r
+                                                     : reactor_cpu(cfg, r));
+    int listen_fd;
+    if (inherited.empty()) {
+      listen_fd =
+          create_listening_socket(cfg.port, cfg.backlog, cfg.recv_buffer_bytes,
+                                  cfg.send_buffer_bytes, reuse_port);
+      set_nonblocking(listen_fd);
+      LOG_INFO("Listening socket created, fd={} reactor={}", listen_fd, r);
+    } else {
+      listen_fd = inherited[static_cast<size_t>(r)];
+      LOG_INFO("Listening socket inherited, fd={} reactor={}", listen_fd, r);
+    }
+
+    // Inherited listeners are tuned again: this binary's flags win.
+    tune_listening_socket(listen_fd, cfg.sock, steering_cpus.back());
+    if (r == 0) {
+      first_listener = listen_fd;
+    }
+
+    servers.push_back(std::make_unique<Server>(listen_fd, cfg, r));
+    reactors.push_back(servers.back().get());
+  }
+
+  // Group index r is reactor r's listener, in the order they were bound.
+  if (cfg.sock.incoming_cpu && cfg.threads > 1) {
+    attach_cpu_steering(first_listener, steering_cpus);
+  }
+
+  // Sized for the reactor count actually running, so after the inherited
+  // listeners are counted.
+  TraceFile trace;
+  if (cfg.trace_sample > 0) {
+    if (!trace.open(cfg.trace_file, static_cast<uint32_t>(cfg.threads),
+                    static_cast<uint32_t>(cfg.trace_sample))) {
+      std::perror("trace file");
+      Logger::stop();
+      return EXIT_FAILURE;
+    }
+    for (size_t r = 0; r < servers.size(); ++r) {
+      servers[r]->set_trace(trace.ring(static_cast<uint32_t>(r)));
+    }
+    LOG_INFO("Tracing one frame in {} per reactor", cfg.trace_sample);
+  }
+
+  Server::install_reactors(reactors);
 
-  int listen_fd = create_listening_socket(
-      cfg.port, cfg.backlog, cfg.recv_buffer_bytes, cfg.send_buffer_bytes);
-  set_nonblocking(listen_fd);
-  std::cout << "Listening socket created, fd=" << listen_fd << "\n";
+  MetricsExporter exporter;
+  if (cfg.metrics_port != 0) {
+    if (!exporter.start(static_cast<uint16_t>(cfg.metrics_port),
+                        &Server::prometheus_text)) {
+      std::perror("metrics endpoint");
+      Logger::stop();
+      return EXIT_FAILURE;
+    }
+    LOG_INFO("Metrics endpoint on 127.0.0.1:{}/metrics", cfg.metrics_port);
+  }
 
-  Server server(listen_fd, cfg.max_connections);
+  std::vector<std::thread> workers;
+  for (size_t r = 1; r < servers.size(); ++r) {
+    workers.emplace_back([&servers, r] { servers[r]->run(); });
+  }
 
-  server.run();
+  // Connections queue on the shared listeners until the loops pick them
+  // up, so the old process may stop accepting from here on.
+  if (handoff_channel >= 0) {
+    handoff_ack(handoff_channel);
+  }
+
+  servers[0]->run();
+
+  for (auto &t : workers) {
+    t.join();
+  }
+  // The exporter renders from the reactor set, so it stops first; then
+  // the set is dropped before `servers` is, and a late signal finds no
+  // reactor to touch.
+  exporter.stop();
+  Server::uninstall_reactors();
+  Logger::stop();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,387 @@
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// ---------- histograms ----------
+
+uint64_t HistogramSnapshot::count() const
+{
+  uint64_t n = 0;
+  for (uint64_t b : buckets)
+    n += b;
+  return n;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+  const uint64_t total = count();
+  if (total == 0)
+    return 0;
+
+  uint64_t target = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+  if (target < 1)
+    target = 1;
+
+  uint64_t seen = 0;
+  for (int b = 0; b < BUCKETS; ++b)
+  {
+    seen += buckets[b];
+    if (seen >= target)
+      return b == 0 ? 0 : (b == 64 ? UINT64_MAX : (uint64_t{1} << b) - 1);
+  }
+  return UINT64_MAX;
+}
+
+HistogramSnapshot &HistogramSnapshot::operator+=(const HistogramSnapshot &o)
+{
+  for (int b = 0; b < BUCKETS; ++b)
+    buckets[b] += o.buckets[b];
+  sum += o.sum;
+  return *this;
+}
+
+HistogramSnapshot LogHistogram::snapshot() const
+{
+  HistogramSnapshot s;
+  for (int b = 0; b < HistogramSnapshot::BUCKETS; ++b)
+    s.buckets[b] = buckets_[b].load(std::memory_order_relaxed);
+  s.sum = sum_.load(std::memory_order_relaxed);
+  return s;
+}
+
+// ---------- counters ----------
+
+MetricsSnapshot &MetricsSnapshot::operator+=(const MetricsSnapshot &o)
+{
+  connections_accepted += o.connections_accepted;
+  connections_closed += o.connections_closed;
+  active_connections += o.active_connections;
+  bytes_read += o.bytes_read;
+  bytes_written += o.bytes_written;
+  frames_received += o.frames_received;
+  connections_rejected += o.connections_rejected;
+  throttle_events += o.throttle_events;
+  zero_copy_bytes += o.zero_copy_bytes;
+  buffer_bytes += o.buffer_bytes;
+  memory_pressured += o.memory_pressured;
+  memory_pressure_events += o.memory_pressure_events;
+  connections_shed += o.connections_shed;
+  io_deferred += o.io_deferred;
+  subscriptions += o.subscriptions;
+  messages_published += o.messages_published;
+  messages_delivered += o.messages_delivered;
+  messages_dropped += o.messages_dropped;
+  subscribers_evicted += o.subscribers_evicted;
+  accept_rate += o.accept_rate;
+  accept_paused += o.accept_paused;
+  accept_pauses += o.accept_pauses;
+  accept_fd_exhausted += o.accept_fd_exhausted;
+  frames_traced += o.frames_traced;
+  service_ns += o.service_ns;
+  read_bytes += o.read_bytes;
+  write_queue_bytes += o.write_queue_bytes;
+  events_per_wait += o.events_per_wait;
+  accepts_per_wakeup += o.accepts_per_wakeup;
+  return *this;
+}
+
+MetricsSnapshot Metrics::snapshot() const
+{
+  MetricsSnapshot s;
+  s.connections_accepted = connections_accepted.load(std::memory_order_relaxed);
+  s.connections_closed = connections_closed.load(std::memory_order_relaxed);
+  s.active_connections = active_connections.load(std::memory_order_relaxed);
+  s.bytes_read = bytes_read.load(std::memory_order_relaxed);
+  s.bytes_written = bytes_written.load(std::memory_order_relaxed);
+  s.frames_received = frames_received.load(std::memory_order_relaxed);
+  s.connections_rejected = connections_rejected.load(std::memory_order_relaxed);
+  s.throttle_events = throttle_events.load(std::memory_order_relaxed);
+  s.zero_copy_bytes = zero_copy_bytes.load(std::memory_order_relaxed);
+  s.buffer_bytes = buffer_bytes.load(std::memory_order_relaxed);
+  s.memory_pressured = memory_pressured.load(std::memory_order_relaxed);
+  s.memory_pressure_events =
+      memory_pressure_events.load(std::memory_order_relaxed);
+  s.connections_shed = connections_shed.load(std::memory_order_relaxed);
+  s.io_deferred = io_deferred.load(std::memory_order_relaxed);
+  s.subscriptions = subscriptions.load(std::memory_order_relaxed);
+  s.messages_published = messages_published.load(std::memory_order_relaxed);
+  s.messages_delivered = messages_delivered.load(std::memory_order_relaxed);
+  s.messages_dropped = messages_dropped.load(std::memory_order_relaxed);
+  s.subscribers_evicted = subscribers_evicted.load(std::memory_order_relaxed);
+  s.accept_rate = accept_rate.load(std::memory_order_relaxed);
+  s.accept_paused = accept_paused.load(std::memory_order_relaxed);
+  s.accept_pauses = accept_pauses.load(std::memory_order_relaxed);
+  s.accept_fd_exhausted = accept_fd_exhausted.load(std::memory_order_relaxed);
+  s.frames_traced = frames_traced.load(std::memory_order_relaxed);
+  s.service_ns = service_ns.snapshot();
+  s.read_bytes = read_bytes.snapshot();
+  s.write_queue_bytes = write_queue_bytes.snapshot();
+  s.events_per_wait = events_per_wait.snapshot();
+  s.accepts_per_wakeup = accepts_per_wakeup.snapshot();
+  return s;
+}
+
+// ---------- Prometheus text ----------
+
+namespace
+{
+void header(std::string &out, const char *name, const char *type,
+            const char *help)
+{
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+void sample(std::string &out, const char *name, const char *suffix,
+            size_t reactor, const char *le, double value)
+{
+  char line[256];
+  if (le)
+    std::snprintf(line, sizeof(line), "%s%s{reactor=\"%zu\",le=\"%s\"} %.17g\n",
+                  name, suffix, reactor, le, value);
+  else
+    std::snprintf(line, sizeof(line), "%s%s{reactor=\"%zu\"} %.17g\n", name,
+                  suffix, reactor, value);
+  out += line;
+}
+
+template <typename Get>
+void counter(std::string &out, const std::vector<MetricsSnapshot> &reactors,
+             const char *name, const char *type, const char *help, Get get)
+{
+  header(out, name, type, help);
+  for (size_t r = 0; r < reactors.size(); ++r)
+    sample(out, name, "", r, nullptr, static_cast<double>(get(reactors[r])));
+}
+
+// Emits buckets up to 2^max_bucket; larger values land in +Inf only.
+// scale converts the recorded unit (e.g. ns to seconds).
+template <typename Get>
+void histogram(std::string &out, const std::vector<MetricsSnapshot> &reactors,
+               const char *name, const char *help, int max_bucket,
+               double scale, Get get)
+{
+  header(out, name, "histogram", help);
+  for (size_t r = 0; r < reactors.size(); ++r)
+  {
+    const HistogramSnapshot &h = get(reactors[r]);
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= max_bucket; ++b)
+    {
+      cumulative += h.buckets[b];
+      // Bucket b holds integers below 2^b.
+      char le[32];
+      std::snprintf(le, sizeof(le), "%.9g",
+                    b == 0 ? 0.0 : ((uint64_t{1} << b) - 1) * scale);
+      sample(out, name, "_bucket", r, le, static_cast<double>(cumulative));
+    }
+    sample(out, name, "_bucket", r, "+Inf", static_cast<double>(h.count()));
+    sample(out, name, "_sum", r, nullptr, h.sum * scale);
+    sample(out, name, "_count", r, nullptr, static_cast<double>(h.count()));
+  }
+}
+} // namespace
+
+std::string format_prometheus(const std::vector<MetricsSnapshot> &reactors)
+{
+  using S = MetricsSnapshot;
+  std::string out;
+  out.reserve(16 * 1024);
+
+  counter(out, reactors, "netlab_connections_accepted_total", "counter",
+          "Connections accepted.",
+          [](const S &s) { return s.connections_accepted; });
+  counter(out, reactors, "netlab_connections_closed_total", "counter",
+          "Connections closed.",
+          [](const S &s) { return s.connections_closed; });
+  counter(out, reactors, "netlab_connections_active", "gauge",
+          "Connections currently open.",
+          [](const S &s) { return s.active_connections; });
+  counter(out, reactors, "netlab_frame_bytes_read_total", "counter",
+          "Payload bytes of received frames.",
+          [](const S &s) { return s.bytes_read; });
+  counter(out, reactors, "netlab_bytes_written_total", "counter",
+          "Bytes written to clients.",
+          [](const S &s) { return s.bytes_written; });
+  counter(out, reactors, "netlab_frames_received_total", "counter",
+          "Frames received.", [](const S &s) { return s.frames_received; });
+  counter(out, reactors, "netlab_connections_rejected_total", "counter",
+          "Connections refused at accept by a connection limit.",
+          [](const S &s) { return s.connections_rejected; });
+  counter(out, reactors, "netlab_throttle_events_total", "counter",
+          "Times a connection was paused by a rate limit.",
+          [](const S &s) { return s.throttle_events; });
+  counter(out, reactors, "netlab_zero_copy_bytes_total", "counter",
+          "Bytes written by splice() or sendfile(), never copied to user "
+          "space.",
+          [](const S &s) { return s.zero_copy_bytes; });
+  counter(out, reactors, "netlab_buffer_bytes", "gauge",
+          "Bytes held in connection read buffers and write queues.",
+          [](const S &s) { return s.buffer_bytes; });
+  counter(out, reactors, "netlab_memory_pressured", "gauge",
+          "1 while the reactor is over its share of --memory-budget.",
+          [](const S &s) { return s.memory_pressured; });
+  counter(out, reactors, "netlab_memory_pressure_events_total", "counter",
+          "Times the reactor went over its memory budget.",
+          [](const S &s) { return s.memory_pressure_events; });
+  counter(out, reactors, "netlab_connections_shed_total", "counter",
+          "Connections closed to get back under the memory budget.",
+          [](const S &s) { return s.connections_shed; });
+  counter(out, reactors, "netlab_io_deferred_total", "counter",
+          "Times a connection used up its per-tick I/O budget.",
+          [](const S &s) { return s.io_deferred; });
+  counter(out, reactors, "netlab_subscriptions", "gauge",
+          "Topic subscriptions held by connections.",
+          [](const S &s) { return s.subscriptions; });
+  counter(out, reactors, "netlab_messages_published_total", "counter",
+          "PUBLISH commands handled.",
+          [](const S &s) { return s.messages_published; });
+  counter(out, reactors, "netlab_messages_delivered_total", "counter",
+          "Published messages queued to a subscriber.",
+          [](const S &s) { return s.messages_delivered; });
+  counter(out, reactors, "netlab_messages_dropped_total", "counter",
+          "Published messages skipped for a subscriber over the high water "
+          "mark.",
+          [](const S &s) { return s.messages_dropped; });
+  counter(out, reactors, "netlab_subscribers_evicted_total", "counter",
+          "Slow subscribers disconnected.",
+          [](const S &s) { return s.subscribers_evicted; });
+  counter(out, reactors, "netlab_accept_rate", "gauge",
+          "Connections accepted in the last full second.",
+          [](const S &s) { return s.accept_rate; });
+  counter(out, reactors, "netlab_accept_paused", "gauge",
+          "1 while the listener is out of the loop at the connection limit.",
+          [](const S &s) { return s.accept_paused; });
+  counter(out, reactors, "netlab_accept_pauses_total", "counter",
+          "Times the listener was taken out of the loop at the limit.",
+          [](const S &s) { return s.accept_pauses; });
+  counter(out, reactors, "netlab_accept_fd_exhausted_total", "counter",
+          "Clients closed unserved because the process was out of fds.",
+          [](const S &s) { return s.accept_fd_exhausted; });
+  counter(out, reactors, "netlab_frames_traced_total", "counter",
+          "Frames sampled into the trace ring.",
+          [](const S &s) { return s.frames_traced; });
+
+  histogram(out, reactors, "netlab_command_service_seconds",
+            "Time spent handling one frame.", 34, 1e-9,
+            [](const S &s) -> const HistogramSnapshot & { return s.service_ns; });
+  histogram(out, reactors, "netlab_read_bytes", "Bytes returned per read.",
+            24, 1.0,
+            [](const S &s) -> const HistogramSnapshot & { return s.read_bytes; });
+  histogram(out, reactors, "netlab_write_queue_bytes",
+            "Queued output bytes when a flush starts.", 24, 1.0,
+            [](const S &s) -> const HistogramSnapshot & {
+              return s.write_queue_bytes;
+            });
+  histogram(out, reactors, "netlab_events_per_wait",
+            "Events (or completions) per event-loop wakeup.", 12, 1.0,
+            [](const S &s) -> const HistogramSnapshot & {
+              return s.events_per_wait;
+            });
+  histogram(out, reactors, "netlab_accepts_per_wakeup",
+            "Connections accepted per listener wakeup.", 12, 1.0,
+            [](const S &s) -> const HistogramSnapshot & {
+              return s.accepts_per_wakeup;
+            });
+  return out;
+}
+
+// ---------- scrape endpoint ----------
+
+MetricsExporter::~MetricsExporter() { stop(); }
+
+bool MetricsExporter::start(uint16_t port, Render render)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  // SO_REUSEPORT lets a restarted process bind while its predecessor
+  // is still draining.
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, 16) < 0)
+  {
+    int saved = errno;
+    ::close(fd);
+    errno = saved;
+    return false;
+  }
+
+  listen_fd_ = fd;
+  render_ = render;
+  running_ = true;
+  thread_ = std::thread([this] { serve(); });
+  return true;
+}
+
+void MetricsExporter::stop()
+{
+  if (!running_.exchange(false))
+    return;
+
+  // Wakes the blocking accept() in serve().
+  ::shutdown(listen_fd_, SHUT_RDWR);
+  thread_.join();
+  ::close(listen_fd_);
+  listen_fd_ = -1;
+}
+
+void MetricsExporter::serve()
+{
+  while (running_)
+  {
+    int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break; // listener shut down
+    }
+
+    // A scrape is a single small GET; whatever it asks for gets the
+    // metrics. Bound the wait so a silent client cannot stall us.
+    timeval tv{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char req[1024];
+    ssize_t n = ::recv(fd, req, sizeof(req), 0);
+    (void)n;
+
+    const std::string body = render_();
+    std::string resp = "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: " +
+                       std::to_string(body.size()) +
+                       "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t off = 0;
+    while (off < resp.size())
+    {
+      ssize_t w = ::send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+      if (w <= 0)
+        break;
+      off += static_cast<size_t>(w);
+    }
+    ::close(fd);
+  }
+}
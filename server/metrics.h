@@ -0,0 +1,160 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Plain copy of a log2 histogram; merged across reactors by addition.
+struct HistogramSnapshot
+{
+  static constexpr int BUCKETS = 65;
+
+  uint64_t buckets[BUCKETS] = {};
+  uint64_t sum = 0;
+
+  uint64_t count() const;
+  // Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+  uint64_t percentile(double p) const;
+  HistogramSnapshot &operator+=(const HistogramSnapshot &o);
+};
+
+// Log2-bucketed histogram with a single writer: bucket b counts values in
+// [2^(b-1), 2^b), bucket 0 counts zeros. record() is one bit scan and two
+// relaxed load/store pairs (no lock prefix), so it stays on in production.
+class LogHistogram
+{
+public:
+  void record(uint64_t v)
+  {
+    const int b = v ? 64 - __builtin_clzll(v) : 0;
+    bump(buckets_[b], 1);
+    bump(sum_, v);
+  }
+
+  HistogramSnapshot snapshot() const;
+
+private:
+  static void bump(std::atomic<uint64_t> &c, uint64_t n)
+  {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> buckets_[HistogramSnapshot::BUCKETS] = {};
+  std::atomic<uint64_t> sum_{0};
+};
+
+// Plain copy of the counters, used to aggregate across reactors.
+struct MetricsSnapshot
+{
+  uint64_t connections_accepted = 0;
+  uint64_t connections_closed = 0;
+  uint64_t active_connections = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+  uint64_t frames_received = 0;
+  uint64_t connections_rejected = 0; // over a connection limit at accept
+  uint64_t throttle_events = 0;      // reads paused by a rate limit
+  uint64_t zero_copy_bytes = 0;      // written by splice()/sendfile()
+  uint64_t buffer_bytes = 0;         // read buffers + write queues held
+  uint64_t memory_pressured = 0;     // reactors over their memory budget
+  uint64_t memory_pressure_events = 0;
+  uint64_t connections_shed = 0;     // closed to get back under budget
+  uint64_t io_deferred = 0;          // per-tick I/O budget used up
+  uint64_t subscriptions = 0;        // connection-topic pairs
+  uint64_t messages_published = 0;   // PUBLISH commands handled here
+  uint64_t messages_delivered = 0;   // copies queued to subscribers
+  uint64_t messages_dropped = 0;     // skipped for a slow subscriber
+  uint64_t subscribers_evicted = 0;  // slow subscribers disconnected
+  uint64_t accept_rate = 0;          // connections accepted last second
+  uint64_t accept_paused = 0;        // listeners out of the loop, at limit
+  uint64_t accept_pauses = 0;        // times a listener was taken out
+  uint64_t accept_fd_exhausted = 0;  // EMFILE/ENFILE: a client was shed
+  uint64_t frames_traced = 0;        // records written to the trace ring
+
+  HistogramSnapshot service_ns;        // handle_message() per frame
+  HistogramSnapshot read_bytes;        // bytes returned per read()/recv
+  HistogramSnapshot write_queue_bytes; // queue depth at each flush
+  HistogramSnapshot events_per_wait;   // epoll events / CQEs per wakeup
+  HistogramSnapshot accepts_per_wakeup; // connections per listener event
+
+  MetricsSnapshot &operator+=(const MetricsSnapshot &o);
+};
+
+// One per reactor. Written only by the owning reactor thread; read by any
+// thread for STATS, the SIGUSR1 dump and the scrape endpoint. Aligned so
+// two reactors' counters never share a cache line.
+struct alignas(64) Metrics
+{
+  std::atomic<uint64_t> connections_accepted{0};
+  std::atomic<uint64_t> connections_closed{0};
+  std::atomic<uint64_t> active_connections{0};
+  std::atomic<uint64_t> bytes_read{0};
+  std::atomic<uint64_t> bytes_written{0};
+  std::atomic<uint64_t> frames_received{0};
+  std::atomic<uint64_t> connections_rejected{0};
+  std::atomic<uint64_t> throttle_events{0};
+  std::atomic<uint64_t> zero_copy_bytes{0};
+  std::atomic<uint64_t> buffer_bytes{0};
+  std::atomic<uint64_t> memory_pressured{0};
+  std::atomic<uint64_t> memory_pressure_events{0};
+  std::atomic<uint64_t> connections_shed{0};
+  std::atomic<uint64_t> io_deferred{0};
+  std::atomic<uint64_t> subscriptions{0};
+  std::atomic<uint64_t> messages_published{0};
+  std::atomic<uint64_t> messages_delivered{0};
+  std::atomic<uint64_t> messages_dropped{0};
+  std::atomic<uint64_t> subscribers_evicted{0};
+  std::atomic<uint64_t> accept_rate{0};
+  std::atomic<uint64_t> accept_paused{0};
+  std::atomic<uint64_t> accept_pauses{0};
+  std::atomic<uint64_t> accept_fd_exhausted{0};
+  std::atomic<uint64_t> frames_traced{0};
+
+  LogHistogram service_ns;
+  LogHistogram read_bytes;
+  LogHistogram write_queue_bytes;
+  LogHistogram events_per_wait;
+  LogHistogram accepts_per_wakeup;
+
+  // Single writer, so a relaxed load/store pair is enough (no lock prefix).
+  static void add(std::atomic<uint64_t> &c, uint64_t n = 1)
+  {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static void sub(std::atomic<uint64_t> &c, uint64_t n = 1)
+  {
+    c.store(c.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+  }
+
+  MetricsSnapshot snapshot() const;
+};
+
+// Prometheus text exposition (format 0.0.4), one series per reactor.
+std::string format_prometheus(const std::vector<MetricsSnapshot> &reactors);
+
+// Serves `render()` over plain HTTP on 127.0.0.1:port from its own thread,
+// one short-lived connection per scrape, so reactors never see it.
+class MetricsExporter
+{
+public:
+  using Render = std::string (*)();
+
+  MetricsExporter() = default;
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+  // Returns false (errno set) if the port cannot be bound.
+  bool start(uint16_t port, Render render);
+  void stop();
+
+private:
+  void serve();
+
+  int listen_fd_ = -1;
+  Render render_ = nullptr;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+};
@@ -0,0 +1,225 @@
+#include "output_queue.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <new>
+
+FrameBuffer::FrameBuffer(const uint8_t *data, size_t size, bool immortal)
+    : immortal_(immortal), data_(data), size_(size) {}
+
+FrameBuffer::FrameBuffer(const char *literal)
+    : FrameBuffer(reinterpret_cast<const uint8_t *>(literal),
+                  std::strlen(literal), true) {}
+
+FrameBuffer *FrameBuffer::adopt(std::string &&bytes)
+{
+  FrameBuffer *fb = new FrameBuffer(nullptr, 0, false);
+  fb->owned_ = std::move(bytes);
+  fb->data_ = reinterpret_cast<const uint8_t *>(fb->owned_.data());
+  fb->size_ = fb->owned_.size();
+  return fb;
+}
+
+FrameBuffer *FrameBuffer::copy_of(ConstByteSpan bytes)
+{
+  void *mem = ::operator new(sizeof(FrameBuffer) + bytes.size);
+  uint8_t *storage = static_cast<uint8_t *>(mem) + sizeof(FrameBuffer);
+  std::memcpy(storage, bytes.data, bytes.size);
+
+  FrameBuffer *fb = new (mem) FrameBuffer(storage, bytes.size, false);
+  fb->inline_storage_ = true;
+  return fb;
+}
+
+void FrameBuffer::destroy()
+{
+  if (inline_storage_)
+  {
+    this->~FrameBuffer();
+    ::operator delete(static_cast<void *>(this));
+    return;
+  }
+  delete this;
+}
+
+void OutputQueue::set_v1_header(Segment &s)
+{
+  uint32_t netlen = htonl(static_cast<uint32_t>(s.payload.bytes().size));
+  std::memcpy(s.header, &netlen, sizeof(netlen));
+  s.header_len = sizeof(netlen);
+}
+
+void OutputQueue::append(Segment &&s)
+{
+  size_t len = wire_size(s);
+  segments_.push_back(std::move(s));
+  bytes_ += len;
+  if (open_slots_ == 0)
+    ready_ += len;
+}
+
+void OutputQueue::push(FrameRef payload)
+{
+  Segment s;
+  s.payload = std::move(payload);
+  set_v1_header(s);
+  append(std::move(s));
+}
+
+void OutputQueue::push(FrameRef payload, const FrameTag &tag)
+{
+  V2Header h;
+  h.opcode = tag.opcode;
+  h.flags = V2Header::FLAG_RESPONSE;
+  h.length = static_cast<uint32_t>(payload.bytes().size);
+  h.request_id = tag.request_id;
+
+  Segment s;
+  h.encode(s.header);
+  s.header_len = V2Header::SIZE;
+  s.payload = std::move(payload);
+  append(std::move(s));
+}
+
+// Payload of a header-only segment.
+static FrameBuffer NO_PAYLOAD("");
+
+void OutputQueue::push_header(uint32_t length)
+{
+  Segment s;
+  s.payload = FrameRef::share(NO_PAYLOAD);
+  uint32_t netlen = htonl(length);
+  std::memcpy(s.header, &netlen, sizeof(netlen));
+  s.header_len = sizeof(netlen);
+  append(std::move(s));
+}
+
+void OutputQueue::push_header(uint32_t length, const FrameTag &tag)
+{
+  V2Header h;
+  h.opcode = tag.opcode;
+  h.flags = V2Header::FLAG_RESPONSE;
+  h.length = length;
+  h.request_id = tag.request_id;
+
+  Segment s;
+  h.encode(s.header);
+  s.header_len = V2Header::SIZE;
+  s.payload = FrameRef::share(NO_PAYLOAD);
+  append(std::move(s));
+}
+
+void OutputQueue::push_raw(FrameRef bytes)
+{
+  Segment s;
+  s.payload = std::move(bytes);
+  append(std::move(s));
+}
+
+uint64_t OutputQueue::reserve_slot()
+{
+  Segment s;
+  s.slot = ++next_slot_;
+  segments_.push_back(std::move(s));
+  ++open_slots_;
+  return next_slot_;
+}
+
+bool OutputQueue::fill_slot(uint64_t id, FrameRef payload)
+{
+  bool first_open = true;
+  for (size_t i = 0; i < segments_.size(); ++i)
+  {
+    Segment &s = segments_[i];
+    if (s.slot != id)
+    {
+      first_open = first_open && s.slot == 0;
+      continue;
+    }
+
+    s.payload = std::move(payload);
+    s.slot = 0;
+    set_v1_header(s);
+    bytes_ += wire_size(s);
+    --open_slots_;
+
+    // Unblocks everything up to the next open slot.
+    if (first_open)
+    {
+      for (; i < segments_.size() && segments_[i].slot == 0; ++i)
+        ready_ += wire_size(segments_[i]);
+    }
+    return true;
+  }
+  return false;
+}
+
+int OutputQueue::fill_iov(iovec *iov, int max) const
+{
+  int cnt = 0;
+  size_t skip = front_sent_;
+
+  for (size_t i = 0;
+       i < segments_.size() && segments_[i].slot == 0 && cnt < max; ++i)
+  {
+    const Segment *it = &segments_[i];
+    ConstByteSpan body = it->payload.bytes();
+
+    if (skip < it->header_len)
+    {
+      iov[cnt].iov_base = const_cast<uint8_t *>(it->header + skip);
+      iov[cnt].iov_len = it->header_len - skip;
+      ++cnt;
+      skip = 0;
+    }
+    else
+    {
+      skip -= it->header_len;
+    }
+
+    if (body.size > skip && cnt < max)
+    {
+      iov[cnt].iov_base = const_cast<uint8_t *>(body.data + skip);
+      iov[cnt].iov_len = body.size - skip;
+      ++cnt;
+    }
+    skip = 0;
+  }
+
+  return cnt;
+}
+
+void OutputQueue::consume(size_t n)
+{
+  bytes_ -= n;
+  ready_ -= n;
+  n += front_sent_;
+
+  while (!segments_.empty() && segments_.front().slot == 0)
+  {
+    size_t seg_len = wire_size(segments_.front());
+    if (n < seg_len)
+      break;
+    n -= seg_len;
+    segments_.pop_front();
+  }
+
+  front_sent_ = n;
+}
+
+void OutputQueue::SegmentRing::grow()
+{
+  std::vector<Segment> bigger(slots_.empty() ? 8 : slots_.size() * 2);
+  for (size_t i = 0; i < count_; ++i)
+    bigger[i] = std::move((*this)[i]);
+  slots_.swap(bigger);
+  head_ = 0;
+}
+
+void OutputQueue::clear()
+{
+  segments_.clear();
+  front_sent_ = 0;
+  bytes_ = 0;
+  ready_ = 0;
+  open_slots_ = 0;
+}
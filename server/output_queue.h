@@ -0,0 +1,206 @@
+#pragma once
+#include "protocol.h"
+#include "ring_buffer.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+// Immutable response payload. Reference counted (atomically, so one buffer
+// may sit in output queues owned by different reactors) and released when
+// the last queue has written it out.
+class FrameBuffer
+{
+public:
+  // Takes ownership of an already built string; no bytes are copied.
+  static FrameBuffer *adopt(std::string &&bytes);
+  // Single allocation holding header and a copy of the bytes.
+  static FrameBuffer *copy_of(ConstByteSpan bytes);
+
+  // Static storage, never freed; retain/release skip the atomic entirely.
+  explicit FrameBuffer(const char *literal);
+
+  ConstByteSpan bytes() const { return {data_, size_}; }
+
+  void retain()
+  {
+    if (!immortal_)
+      refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release()
+  {
+    if (!immortal_ && refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      destroy();
+  }
+
+private:
+  FrameBuffer(const uint8_t *data, size_t size, bool immortal);
+  void destroy();
+
+  std::atomic<uint32_t> refs_{1};
+  bool immortal_;
+  bool inline_storage_ = false;
+  const uint8_t *data_;
+  size_t size_;
+  std::string owned_;
+};
+
+// Owning handle to a FrameBuffer.
+class FrameRef
+{
+public:
+  FrameRef() = default;
+  explicit FrameRef(FrameBuffer *adopted) : buf_(adopted) {}
+  static FrameRef share(FrameBuffer &buf)
+  {
+    buf.retain();
+    return FrameRef(&buf);
+  }
+
+  FrameRef(const FrameRef &o) : buf_(o.buf_)
+  {
+    if (buf_)
+      buf_->retain();
+  }
+  FrameRef(FrameRef &&o) noexcept : buf_(o.buf_) { o.buf_ = nullptr; }
+  FrameRef &operator=(FrameRef o) noexcept
+  {
+    std::swap(buf_, o.buf_);
+    return *this;
+  }
+  ~FrameRef()
+  {
+    if (buf_)
+      buf_->release();
+  }
+
+  ConstByteSpan bytes() const { return buf_->bytes(); }
+  explicit operator bool() const { return buf_ != nullptr; }
+
+private:
+  FrameBuffer *buf_ = nullptr;
+};
+
+// Per-connection queue of outgoing frames. Each entry is a small wire
+// header (v1 length or v2 reply header) stored inline plus a shared
+// payload; flushing gathers them straight into writev() iovecs, so
+// payload bytes are never copied into a staging buffer.
+//
+// A reply computed elsewhere (another reactor's shard) holds its place
+// with reserve_slot(); frames queued behind an unfilled slot wait, so
+// pipelined responses still go out in request order.
+class OutputQueue
+{
+public:
+  // v1 frame: [u32 length][payload].
+  void push(FrameRef payload);
+  // v2 reply to the request tagged `tag`.
+  void push(FrameRef payload, const FrameTag &tag);
+
+  // A streamed reply: the header announcing `length` payload bytes, then
+  // the payload in pieces (push_raw) or written past the queue (splice,
+  // sendfile) once it has drained.
+  void push_header(uint32_t length);
+  void push_header(uint32_t length, const FrameTag &tag);
+  void push_raw(FrameRef bytes);
+
+  // Appends a placeholder and returns its id (never 0) for fill_slot().
+  uint64_t reserve_slot();
+  // Fills it as a v1 frame. Returns false if the slot is unknown (already
+  // filled or cleared).
+  bool fill_slot(uint64_t id, FrameRef payload);
+
+  size_t size() const { return bytes_; }
+  // Reserved slots not yet filled; their bytes are not in size().
+  size_t open_slots() const { return open_slots_; }
+  // Bytes ahead of the first unfilled slot: what a flush can send now.
+  size_t writable() const { return ready_; }
+  bool empty() const { return segments_.empty(); }
+
+  // Fills at most max iovecs with the writable bytes, in order.
+  int fill_iov(iovec *iov, int max) const;
+
+  // Drops n bytes that the kernel has accepted.
+  void consume(size_t n);
+
+  // Drops everything, keeping the ring's storage for reuse unless an
+  // earlier burst left it large.
+  void clear();
+
+private:
+  struct Segment
+  {
+    uint8_t header[V2Header::SIZE] = {};
+    uint8_t header_len = 0;
+    FrameRef payload;
+    uint64_t slot = 0; // non-zero while waiting for fill_slot()
+  };
+
+  // FIFO of segments in a power-of-two ring. std::deque frees a block
+  // and allocates the next one every few dozen push/pop cycles; this
+  // storage only grows (by doubling) and is kept, so a connection past
+  // its peak queue depth queues frames without allocating.
+  class SegmentRing
+  {
+  public:
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+    Segment &operator[](size_t i) { return slots_[(head_ + i) & mask()]; }
+    const Segment &operator[](size_t i) const
+    {
+      return slots_[(head_ + i) & mask()];
+    }
+    Segment &front() { return slots_[head_]; }
+
+    void push_back(Segment &&s)
+    {
+      if (count_ == slots_.size())
+        grow();
+      slots_[(head_ + count_) & mask()] = std::move(s);
+      ++count_;
+    }
+    void pop_front()
+    {
+      slots_[head_] = Segment{}; // drops the payload reference now
+      head_ = (head_ + 1) & mask();
+      --count_;
+    }
+    void clear()
+    {
+      while (count_ > 0)
+        pop_front();
+      head_ = 0;
+      // Connection objects are recycled; one pipelining burst must not
+      // pin its peak depth for the life of the process.
+      if (slots_.size() > KEEP)
+        std::vector<Segment>().swap(slots_);
+    }
+
+  private:
+    static constexpr size_t KEEP = 16;
+
+    size_t mask() const { return slots_.size() - 1; }
+    void grow();
+
+    std::vector<Segment> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+  };
+
+  static size_t wire_size(const Segment &s)
+  {
+    return s.header_len + s.payload.bytes().size;
+  }
+  static void set_v1_header(Segment &s);
+  void append(Segment &&s);
+
+  SegmentRing segments_;
+  size_t front_sent_ = 0; // bytes of the front segment already written
+  size_t bytes_ = 0;      // unsent bytes, headers included
+  size_t ready_ = 0;      // unsent bytes ahead of the first open slot
+  size_t open_slots_ = 0;
+  uint64_t next_slot_ = 0;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+
+// Wire protocol versions. A connection speaks one of them, fixed by the
+// first byte it sends:
+//
+//   v1: [u32 length][ASCII command]. Replies are [u32 length][payload],
+//       strictly in request order. The first frame on a connection must
+//       be under 16 MB, so that its first byte is 0; later frames may be
+//       larger when they stream (up to 4 GB). A first frame of 16 MB or
+//       more is a protocol error: one starting with 2 (32-48 MB) is told
+//       apart from a v2 header by the opcode and flags checks in
+//       Connection::next_frame().
+//
+//   v2: a 16-byte header, then `length` payload bytes. All fields are
+//       big-endian:
+//
+//         u8 version (2) | u8 opcode | u16 flags | u32 length | u64 request_id
+//
+//       The opcode selects the command, so nothing is parsed; the payload
+//       carries what would follow "NAME " in v1, binary-safe and
+//       untrimmed. A reply repeats opcode and request_id with
+//       FLAG_RESPONSE set. Replies may arrive out of order; the request_id
+//       matches them up, so a client can keep any number of requests
+//       outstanding on one socket.
+
+enum class Opcode : uint8_t
+{
+  PING = 1,
+  ECHO = 2,
+  STATS = 3,
+  CLOSE = 4,
+  SHUTDOWN = 5,
+  GET = 6,
+  SET = 7,
+  DEL = 8,
+  MGET = 9,
+  EXPIRE = 10,
+  BLOB = 11,
+  SUBSCRIBE = 12,
+  UNSUBSCRIBE = 13,
+  PUBLISH = 14,
+  MESSAGE = 15, // server push to a subscriber, request_id 0
+};
+
+// The v2 identity of a request, echoed in its reply.
+struct FrameTag
+{
+  uint8_t opcode = 0;
+  uint64_t request_id = 0;
+};
+
+struct V2Header
+{
+  static constexpr uint8_t VERSION = 2;
+  static constexpr size_t SIZE = 16;
+  static constexpr uint16_t FLAG_RESPONSE = 0x0001;
+
+  uint8_t version = VERSION;
+  uint8_t opcode = 0;
+  uint16_t flags = 0;
+  uint32_t length = 0;
+  uint64_t request_id = 0;
+
+  void encode(uint8_t *out) const
+  {
+    uint16_t f = htobe16(flags);
+    uint32_t l = htobe32(length);
+    uint64_t id = htobe64(request_id);
+    out[0] = version;
+    out[1] = opcode;
+    std::memcpy(out + 2, &f, sizeof(f));
+    std::memcpy(out + 4, &l, sizeof(l));
+    std::memcpy(out + 8, &id, sizeof(id));
+  }
+
+  static V2Header decode(const uint8_t *in)
+  {
+    V2Header h;
+    uint16_t f;
+    uint32_t l;
+    uint64_t id;
+    std::memcpy(&f, in + 2, sizeof(f));
+    std::memcpy(&l, in + 4, sizeof(l));
+    std::memcpy(&id, in + 8, sizeof(id));
+    h.version = in[0];
+    h.opcode = in[1];
+    h.flags = be16toh(f);
+    h.length = be32toh(l);
+    h.request_id = be64toh(id);
+    return h;
+  }
+};
@@ -0,0 +1,75 @@
+#include "rate_limiter.h"
+#include <algorithm>
+
+void TokenBucket::refill(const RateLimit &limit, Clock::time_point now)
+{
+  if (last_ == Clock::time_point{})
+  {
+    tokens_ = limit.rate;
+    last_ = now;
+    return;
+  }
+
+  const double elapsed = std::chrono::duration<double>(now - last_).count();
+  tokens_ = std::min(limit.rate, tokens_ + elapsed * limit.rate);
+  last_ = now;
+}
+
+TokenBucket::Clock::duration TokenBucket::wait(const RateLimit &limit) const
+{
+  if (tokens_ > 0)
+    return Clock::duration::zero();
+
+  // Back in credit by at least a hundredth of a unit, so the wake-up does
+  // not land a hair short of zero.
+  const double seconds = (0.01 - tokens_) / limit.rate;
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(seconds));
+}
+
+IpTable::IpTable(size_t max_connections)
+{
+  // Twice the connection limit (a power of two), so the table never fills
+  // with live addresses.
+  size_t cap = 64;
+  while (cap < max_connections * 2)
+    cap *= 2;
+  entries_.resize(cap);
+  mask_ = cap - 1;
+}
+
+void IpTable::rehome()
+{
+  std::vector<Entry>(entries_).swap(entries_);
+}
+
+IpTable::Entry *IpTable::acquire(uint32_t addr)
+{
+  // Fibonacci hash: consecutive addresses land far apart.
+  const size_t home =
+      static_cast<size_t>((addr * 0x9E3779B97F4A7C15ull) >> 32) & mask_;
+  Entry *spare = nullptr;
+
+  for (size_t i = 0; i < PROBE_WINDOW; ++i)
+  {
+    Entry &e = entries_[(home + i) & mask_];
+    if (e.addr == addr)
+      return &e;
+    if (e.addr == 0)
+    {
+      // Nothing is stored past a never-used slot.
+      if (!spare)
+        spare = &e;
+      break;
+    }
+    if (!spare && e.connections == 0)
+      spare = &e;
+  }
+
+  if (!spare)
+    return nullptr;
+
+  *spare = Entry{};
+  spare->addr = addr;
+  return spare;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A sustained rate with one second of burst on top. rate == 0 disables.
+struct RateLimit
+{
+  double rate = 0; // units per second
+
+  bool enabled() const { return rate > 0; }
+};
+
+// Token bucket refilled lazily from the caller's clock, so an idle bucket
+// costs nothing. A request is admitted while the bucket is not in debt
+// and then charged in full, so one large frame can overdraw it; the
+// overdraft is what the next wait() pays back.
+class TokenBucket
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void refill(const RateLimit &limit, Clock::time_point now);
+  void take(double n) { tokens_ -= n; }
+
+  // How long until the bucket has tokens again; zero if it has them now.
+  Clock::duration wait(const RateLimit &limit) const;
+
+  void reset() { last_ = Clock::time_point{}; }
+
+private:
+  double tokens_ = 0;
+  Clock::time_point last_{}; // epoch = full bucket on first use
+};
+
+// Per-source-IPv4 state for one reactor: live connection count and the
+// shared frame and byte buckets. A fixed array sized from the reactor's
+// connection limit, probed linearly within a short window. An address
+// with no live connections keeps its entry (and its buckets, so
+// reconnecting does not refill them) until another address needs the
+// slot.
+class IpTable
+{
+public:
+  struct Entry
+  {
+    uint32_t addr = 0; // network order; 0 = never used
+    uint32_t connections = 0;
+    TokenBucket frames;
+    TokenBucket bytes;
+  };
+
+  explicit IpTable(size_t max_connections);
+
+  // Finds or claims the entry for addr. nullptr if the probe window is
+  // full of other live addresses; the caller then admits untracked.
+  Entry *acquire(uint32_t addr);
+
+  size_t capacity() const { return entries_.size(); }
+
+  // Reallocates the entries from the calling thread (see
+  // ConnectionTable::rehome).
+  void rehome();
+
+private:
+  static constexpr size_t PROBE_WINDOW = 16;
+
+  std::vector<Entry> entries_;
+  size_t mask_;
+};
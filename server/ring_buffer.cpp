@@ -0,0 +1,144 @@
+#include "ring_buffer.h"
+#include "buffer_pool.h"
+#include <cstring>
+
+static size_t next_pow2(size_t n)
+{
+  size_t p = 4096;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+RingBuffer::~RingBuffer() { reset(); }
+
+RingBuffer::RingBuffer(RingBuffer &&o) noexcept
+    : buf_(o.buf_), capacity_(o.capacity_), head_(o.head_), tail_(o.tail_)
+{
+  o.buf_ = nullptr;
+  o.capacity_ = o.head_ = o.tail_ = 0;
+}
+
+RingBuffer &RingBuffer::operator=(RingBuffer &&o) noexcept
+{
+  if (this != &o)
+  {
+    reset();
+    buf_ = o.buf_;
+    capacity_ = o.capacity_;
+    head_ = o.head_;
+    tail_ = o.tail_;
+    o.buf_ = nullptr;
+    o.capacity_ = o.head_ = o.tail_ = 0;
+  }
+  return *this;
+}
+
+int RingBuffer::readable_iov(iovec out[2]) const
+{
+  if (empty())
+    return 0;
+
+  ConstByteSpan first = readable();
+  out[0].iov_base = const_cast<uint8_t *>(first.data);
+  out[0].iov_len = first.size;
+  if (first.size == size())
+    return 1;
+
+  out[1].iov_base = buf_;
+  out[1].iov_len = size() - first.size;
+  return 2;
+}
+
+int RingBuffer::writable_iov(iovec out[2])
+{
+  size_t room = free_space();
+  if (room == 0)
+    return 0;
+
+  size_t off = tail_ & (capacity_ - 1);
+  size_t run = capacity_ - off;
+  out[0].iov_base = buf_ + off;
+  out[0].iov_len = room < run ? room : run;
+  if (out[0].iov_len == room)
+    return 1;
+
+  out[1].iov_base = buf_;
+  out[1].iov_len = room - out[0].iov_len;
+  return 2;
+}
+
+void RingBuffer::peek(void *dst, size_t n) const
+{
+  ConstByteSpan first = readable();
+  size_t a = n < first.size ? n : first.size;
+  std::memcpy(dst, first.data, a);
+  if (a < n)
+    std::memcpy(static_cast<uint8_t *>(dst) + a, buf_, n - a);
+}
+
+const uint8_t *RingBuffer::contiguous(size_t n)
+{
+  ConstByteSpan first = readable();
+  if (first.size >= n)
+    return first.data;
+
+  // Wrapped: rebuild at offset 0. Happens at most once per capacity()
+  // bytes of traffic, so the cost stays amortised O(1) per byte.
+  relocate(capacity_);
+  return buf_;
+}
+
+void RingBuffer::reserve(size_t n)
+{
+  if (n > capacity_)
+    relocate(next_pow2(n));
+}
+
+void RingBuffer::append(const void *src, size_t n)
+{
+  reserve(size() + n);
+
+  iovec iov[2];
+  int cnt = writable_iov(iov);
+  const uint8_t *p = static_cast<const uint8_t *>(src);
+  size_t left = n;
+  for (int i = 0; i < cnt && left > 0; ++i)
+  {
+    size_t chunk = left < iov[i].iov_len ? left : iov[i].iov_len;
+    std::memcpy(iov[i].iov_base, p, chunk);
+    p += chunk;
+    left -= chunk;
+  }
+  commit(n);
+}
+
+void RingBuffer::release()
+{
+  if (empty())
+    reset();
+}
+
+void RingBuffer::reset()
+{
+  if (buf_)
+    BufferPool::local().release(buf_, capacity_);
+  buf_ = nullptr;
+  capacity_ = 0;
+  head_ = tail_ = 0;
+}
+
+void RingBuffer::relocate(size_t new_capacity)
+{
+  uint8_t *fresh = BufferPool::local().acquire(new_capacity);
+  size_t used = size();
+  if (used > 0)
+    peek(fresh, used);
+
+  if (buf_)
+    BufferPool::local().release(buf_, capacity_);
+  buf_ = fresh;
+  capacity_ = new_capacity;
+  head_ = 0;
+  tail_ = used;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+
+struct ByteSpan
+{
+  uint8_t *data;
+  size_t size;
+};
+
+struct ConstByteSpan
+{
+  const uint8_t *data;
+  size_t size;
+};
+
+// Power-of-two byte ring. head_/tail_ are free-running offsets, so
+// consuming bytes only advances head_ and never moves data. Storage is
+// allocated on first use and grows (doubling) only when a caller asks for
+// more room than the ring has. Storage comes from the thread's
+// BufferPool, so a closed connection's buffer is reused by the next one.
+class RingBuffer
+{
+public:
+  RingBuffer() = default;
+  ~RingBuffer();
+  RingBuffer(RingBuffer &&o) noexcept;
+  RingBuffer &operator=(RingBuffer &&o) noexcept;
+  RingBuffer(const RingBuffer &) = delete;
+  RingBuffer &operator=(const RingBuffer &) = delete;
+
+  size_t size() const { return tail_ - head_; }
+  bool empty() const { return head_ == tail_; }
+  size_t capacity() const { return capacity_; }
+  size_t free_space() const { return capacity_ - size(); }
+
+  // Contiguous readable bytes at head. May be shorter than size() when
+  // the data wraps; readable_iov() returns both halves.
+  ConstByteSpan readable() const
+  {
+    size_t off = head_ & (capacity_ - 1);
+    size_t run = capacity_ - off;
+    return {buf_ + off, size() < run ? size() : run};
+  }
+
+  // Fills up to two iovecs covering the readable (resp. writable) bytes,
+  // ready for writev()/readv(). Returns the number used.
+  int readable_iov(iovec out[2]) const;
+  int writable_iov(iovec out[2]);
+
+  void commit(size_t n) { tail_ += n; }
+
+  void consume(size_t n)
+  {
+    head_ += n;
+    // Rewind when drained so the next message starts contiguous.
+    if (head_ == tail_)
+      head_ = tail_ = 0;
+  }
+
+  // Copies n bytes from head without consuming them; n <= size().
+  void peek(void *dst, size_t n) const;
+
+  // Returns a pointer to the first n bytes as one contiguous run,
+  // relocating the data once if it currently wraps. n <= size().
+  const uint8_t *contiguous(size_t n);
+
+  // Ensures capacity() >= n, preserving contents.
+  void reserve(size_t n);
+
+  void append(const void *src, size_t n);
+
+  // Returns the storage to the pool if empty (idle connections hold no
+  // buffer).
+  void release();
+
+  // Discards the contents and returns the storage to the pool.
+  void reset();
+
+private:
+  void relocate(size_t new_capacity);
+
+  uint8_t *buf_ = nullptr;
+  size_t capacity_ = 0;
+  size_t head_ = 0;
+  size_t tail_ = 0;
+};
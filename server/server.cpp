@@ -1,47 +1,248 @@
 #include "server.h"
 #include "connection.h"
+#include "handoff.h"
 #include "socket_utils.h"
+#include "uring.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 static std::atomic<bool> dump_metrics_requested{false};
+static std::atomic<bool> restart_requested{false};
+static std::atomic<bool> restart_started{false};
+static std::atomic<bool> drain_signaled{false};
+
+// Every reactor in the process. Filled once by install_reactors() before
+// the loops start and read-only afterwards, so no locking is needed.
+static std::vector<Server *> g_servers;
+
+// Duplicates of every reactor's listener, open for the life of the
+// process, so a restart can hand them over even while a reactor exits.
+static std::vector<int> g_listeners;
 
 // ---------- constructor ----------
 
 void Server::stop()
 {
-  std::cout << "\nShutdown signal received. Stopping server...\n";
-
+  // Called from signal handlers and from other reactors: only touch the
+  // atomic flag and the eventfd. The listener is closed by run() on exit.
   running_ = false;
+  wake();
+}
 
-  // Stop accepting new connections
-  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
-  ::close(listen_fd_);
+void Server::drain()
+{
+  drain_requested_ = true;
+  wake();
+}
+
+void Server::wake()
+{
+  uint64_t one = 1;
+  ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+  (void)n;
+}
+
+void Server::stop_all()
+{
+  for (Server *s : g_servers)
+    s->stop();
+}
+
+void Server::drain_all()
+{
+  for (Server *s : g_servers)
+    s->drain();
+}
+
+size_t Server::reactor_count() { return g_servers.size(); }
+
+Server &Server::reactor(size_t i) { return *g_servers[i]; }
+
+void Server::post(Server &to, ReactorTask *task)
+{
+  if (to.mailbox_.push(task))
+    to.wake();
+}
+
+void Server::run_mailbox()
+{
+  mailbox_.begin_drain();
+  while (ReactorTask *task = mailbox_.pop())
+  {
+    task->run(*this);
+    delete task;
+  }
+}
+
+Server &Server::kv_shard(uint64_t hash)
+{
+  // The high half picks the reactor; the low bits index the shard's own
+  // table, so the two choices stay independent.
+  if (g_servers.size() <= 1)
+    return *this;
+  return *g_servers[(hash >> 32) % g_servers.size()];
+}
+
+MetricsSnapshot Server::aggregate_metrics()
+{
+  MetricsSnapshot total;
+  for (const Server *s : g_servers)
+    total += s->metrics_.snapshot();
+  return total;
+}
+
+void Server::place()
+{
+  placement_ = apply_placement(reactor_cpu(cfg_, reactor_id_),
+                               cfg_.numa_policy);
+  // The constructor sized these on the main thread; reallocated here,
+  // they come from this CPU's node like everything allocated from now on.
+  if (placement_.cpu >= 0 ||
+      cfg_.numa_policy != ServerConfig::NumaPolicy::NONE)
+  {
+    connections_.rehome();
+    ip_table_.rehome();
+    kv_.rehome();
+  }
+  placed_.store(true, std::memory_order_release);
+
+  if (placement_.cpu < 0)
+    return;
+  LOG_INFO("[reactor {}] on cpu {} (node {}), numa policy {}", reactor_id_,
+           placement_.cpu, placement_.node, numa_policy_name(cfg_.numa_policy));
+  // Replies leave on this CPU; a NIC queue interrupting another one
+  // drags every packet's cache lines across.
+  if (placement_.nic_irqs.empty())
+    LOG_WARN("[reactor {}] no NIC interrupt is routed to cpu {}; see "
+             "/proc/irq/*/smp_affinity_list",
+             reactor_id_, placement_.cpu);
+  else
+    LOG_INFO("[reactor {}] {} NIC interrupts routed to cpu {}", reactor_id_,
+             placement_.nic_irqs.size(), placement_.cpu);
 }
 
-static Server *g_server = nullptr;
-static void handle_signal(int sig)
+std::string Server::describe_topology(const ServerConfig &cfg)
+{
+  std::string out;
+  out += "cpu_affinity=" + format_cpu_list(cfg.cpu_affinity) + "\n";
+  out += "numa_policy=" + std::string(numa_policy_name(cfg.numa_policy)) + "\n";
+  for (const Server *s : g_servers)
+  {
+    if (s->placed_.load(std::memory_order_acquire))
+      out += describe_placement(s->reactor_id_, s->placement_);
+  }
+  return out;
+}
+
+std::string Server::prometheus_text()
+{
+  std::vector<MetricsSnapshot> reactors;
+  reactors.reserve(g_servers.size());
+  for (const Server *s : g_servers)
+    reactors.push_back(s->metrics_.snapshot());
+
+  // Log rings belong to threads, not reactors: one process-wide series.
+  std::string out = format_prometheus(reactors);
+  out += "# HELP netlab_log_dropped_total Log records dropped on a full "
+         "ring.\n"
+         "# TYPE netlab_log_dropped_total counter\n"
+         "netlab_log_dropped_total " +
+         std::to_string(Logger::dropped()) + "\n";
+  return out;
+}
+
+void Server::handle_signal(int sig)
 {
   if (sig == SIGUSR1)
   {
     dump_metrics_requested.store(true, std::memory_order_relaxed);
+    // Only one thread takes the signal; make sure some loop notices.
+    if (!g_servers.empty())
+      g_servers.front()->wake();
     return;
   }
 
-  if (g_server)
+  if (sig == SIGHUP)
   {
-    g_server->stop();
+    restart_requested.store(true, std::memory_order_relaxed);
+    if (!g_servers.empty())
+      g_servers.front()->wake();
+    return;
   }
+
+  // The first SIGINT/SIGTERM drains; a second one skips the wait.
+  if (drain_signaled.exchange(true))
+    stop_all();
+  else
+    drain_all();
 }
 
-Server::Server(int listen_fd, int max_connections)
-    : listen_fd_(listen_fd), running_(true), max_connections_(max_connections)
+void Server::install_reactors(const std::vector<Server *> &servers)
+{
+  // A second set (the benchmarks build a Server per run) replaces the
+  // first; its listener copies would otherwise keep old ports listening.
+  uninstall_reactors();
+  g_servers = servers;
+  for (const Server *s : servers)
+    g_listeners.push_back(::fcntl(s->listen_fd_, F_DUPFD_CLOEXEC, 0));
+
+  // ---------- signal setup ----------
+  struct sigaction sa{};
+  sa.sa_handler = handle_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGUSR1, &sa, nullptr);
+  sigaction(SIGHUP, &sa, nullptr);
+
+  // A peer reset must surface as EPIPE from write(), not kill the process.
+  signal(SIGPIPE, SIG_IGN);
+}
+
+void Server::uninstall_reactors()
+{
+  g_servers.clear();
+  for (int fd : g_listeners)
+  {
+    if (fd >= 0)
+      ::close(fd);
+  }
+  g_listeners.clear();
+}
+
+Server::Server(int listen_fd, const ServerConfig &cfg, int reactor_id)
+    : cfg_(cfg), listen_fd_(listen_fd), running_(true),
+      // Each reactor owns its listener; the kernel spreads connections
+      // across them, so the connection limit is split evenly as well.
+      max_connections_((cfg.max_connections + cfg.threads - 1) / cfg.threads),
+      reactor_id_(reactor_id), connections_(max_connections_),
+      idle_timers_(IDLE_TICK, IDLE_SLOTS),
+      conn_frames_{static_cast<double>(cfg.max_frame_rate)},
+      conn_bytes_{static_cast<double>(cfg.max_byte_rate)},
+      ip_frames_{static_cast<double>(cfg.ip_frame_rate) / cfg.threads},
+      ip_bytes_{static_cast<double>(cfg.ip_byte_rate) / cfg.threads},
+      rate_limited_(conn_frames_.enabled() || conn_bytes_.enabled() ||
+                    ip_frames_.enabled() || ip_bytes_.enabled()),
+      max_connections_per_ip_(static_cast<uint32_t>(
+          (cfg.max_connections_per_ip + cfg.threads - 1) / cfg.threads)),
+      ip_table_(static_cast<size_t>(max_connections_)),
+      throttle_timers_(THROTTLE_TICK, THROTTLE_SLOTS),
+      memory_budget_(static_cast<size_t>(cfg.memory_budget_mb) * 1024 * 1024 /
+                     static_cast<size_t>(cfg.threads))
 {
   epoll_fd_ = epoll_create1(0);
   if (epoll_fd_ < 0)
@@ -50,233 +251,726 @@ Server::Server(int listen_fd, int max_connections)
     std::exit(EXIT_FAILURE);
   }
 
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0)
+  {
+    std::perror("eventfd");
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Held only so it can be given back when accept() runs out of fds.
+  reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  // The listener and the eventfd are told apart from connections by the
+  // address of the member holding their fd.
   epoll_event ev{};
   ev.events = EPOLLIN;
-  ev.data.fd = listen_fd_;
+  ev.data.ptr = &listen_fd_;
 
   if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0)
   {
     std::perror("epoll_ctl ADD listen_fd");
     std::exit(EXIT_FAILURE);
   }
+
+  ev.data.ptr = &wake_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0)
+  {
+    std::perror("epoll_ctl ADD wake_fd");
+    std::exit(EXIT_FAILURE);
+  }
+
+  if (!cfg_.blob_dir.empty())
+  {
+    blob_dir_fd_ =
+        ::open(cfg_.blob_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (blob_dir_fd_ < 0)
+    {
+      std::perror("open blob dir");
+      std::exit(EXIT_FAILURE);
+    }
+  }
 }
 
-void Server::add_fd_to_epoll(int fd, uint32_t events)
+Server::~Server()
+{
+  // Kept open until now: another reactor may still post to our mailbox
+  // (and write the eventfd) after this loop has exited.
+  ::close(wake_fd_);
+  if (reserve_fd_ >= 0)
+    ::close(reserve_fd_);
+  if (blob_dir_fd_ >= 0)
+    ::close(blob_dir_fd_);
+}
+
+void Server::add_fd_to_epoll(Connection &conn, uint32_t events)
 {
   epoll_event ev{};
   ev.events = events;
-  ev.data.fd = fd;
+  ev.data.ptr = &conn;
 
-  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+  if (io_->epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn.fd, &ev) < 0)
   {
     std::perror("epoll_ctl ADD");
-    ::close(fd);
+    close_connection(conn.fd, "epoll_ctl ADD");
+    return;
   }
+  conn.epoll_events = events;
 }
 
-void Server::mod_fd_epoll(int fd, uint32_t events)
+void Server::mod_fd_epoll(Connection &conn, uint32_t events)
 {
+  if (conn.epoll_events == events)
+    return;
+
   epoll_event ev{};
   ev.events = events;
-  ev.data.fd = fd;
+  ev.data.ptr = &conn;
 
-  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0)
+  if (io_->epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev) < 0)
   {
     std::perror("epoll_ctl MOD");
-    ::close(fd);
+    close_connection(conn.fd, "epoll_ctl MOD");
+    return;
   }
+  conn.epoll_events = events;
 }
 
 void Server::remove_fd_from_epoll(int fd)
 {
-  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  io_->epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
 }
 
 void Server::handle_accept()
 {
-  while (true)
+  // A budget per wakeup, so a connection storm cannot starve clients
+  // that are already connected; the listener stays readable and the
+  // rest are taken on the next iteration.
+  int accepted = 0;
+  while (accepted < cfg_.accept_budget)
   {
+    if (static_cast<int>(connections_.size()) >= max_connections_)
+    {
+      pause_accept();
+      break;
+    }
+
     sockaddr_in addr{};
     socklen_t len = sizeof(addr);
 
+    // Non-blocking and close-on-exec from the start: no fcntl round trips.
     int client_fd =
-        ::accept(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &len);
+        io_->accept4(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if (client_fd < 0)
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
         break;
+      if (errno == EMFILE || errno == ENFILE)
+      {
+        shed_on_fd_exhaustion();
+        break;
+      }
+      // The client reset before we got to it; the next one may be fine.
+      if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR)
+        continue;
 
       std::perror("accept");
       break;
     }
+    ++accepted;
 
-    // 🔒 ENFORCE LIMIT — FIRST THING
-    if ((int)connections_.size() >= max_connections_)
-    {
-      std::cerr << "Rejecting client fd=" << client_fd
-                << " (max_connections reached: " << connections_.size()
-                << ")\n";
-      ::close(client_fd);
-      continue; // IMPORTANT
-    }
+    Connection *conn = open_connection(client_fd, addr.sin_addr.s_addr);
+    if (!conn)
+      continue;
 
-    set_nonblocking(client_fd);
+    tune_accepted_socket(client_fd, cfg_.sock);
+    add_fd_to_epoll(*conn, client_events());
 
-    connections_.emplace(client_fd, Connection(client_fd));
-    metrics_.connections_accepted++;
+    LOG_INFO("[reactor {}] Accepted client fd={} (active={})", reactor_id_,
+             client_fd, connections_.size());
+  }
+  metrics_.accepts_per_wakeup.record(static_cast<uint64_t>(accepted));
+}
 
-    add_fd_to_epoll(client_fd, EPOLLIN);
+void Server::pause_accept()
+{
+  if (accept_paused_)
+    return;
+  accept_paused_ = true;
+  Metrics::add(metrics_.accept_pauses);
+  Metrics::add(metrics_.accept_paused);
+  // At the limit with a queue outside, every close resumes and the next
+  // accept pauses again: warn once a second, the counter has the rest.
+  const auto now = Connection::Clock::now();
+  if (now - accept_warned_at_ >= std::chrono::seconds(1))
+  {
+    accept_warned_at_ = now;
+    LOG_WARN("[reactor {}] At max_connections ({}), pausing accept",
+             reactor_id_, max_connections_);
+  }
 
-    std::cout << "Accepted client fd=" << client_fd
-              << " (active=" << connections_.size() << ")\n";
+  if (uring_)
+    uring_stop_accept();
+  else
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+}
+
+void Server::resume_accept()
+{
+  accept_paused_ = false;
+  Metrics::sub(metrics_.accept_paused);
+  LOG_DEBUG("[reactor {}] Below max_connections, accepting again",
+            reactor_id_);
+
+  if (uring_)
+  {
+    if (uring_accepts_ == 0)
+      uring_arm_accept();
+    return;
   }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listen_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0)
+    std::perror("epoll_ctl ADD listen_fd");
 }
 
-void Server::on_frame_received(Connection &conn,
-                               const std::vector<uint8_t> &frame)
+bool Server::shed_on_fd_exhaustion()
 {
-  auto now = Connection::Clock::now();
-  if (now - conn.window_start > std::chrono::seconds(1))
+  if (reserve_fd_ < 0)
+    reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (reserve_fd_ < 0)
+    return false;
+
+  ::close(reserve_fd_);
+  int fd = io_->accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd >= 0)
+    ::close(fd);
+  reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  Metrics::add(metrics_.accept_fd_exhausted);
+  LOG_WARN("[reactor {}] Out of file descriptors, shed a pending client",
+           reactor_id_);
+  return true;
+}
+
+void Server::adopt(int fd)
+{
+  Connection *conn = open_connection(fd, 0);
+  if (!conn)
+    return;
+
+  // Before run() there is no ring yet; run_uring() moves the connection
+  // over from epoll.
+  if (uring_)
+    uring_arm_recv(*conn);
+  else
+    add_fd_to_epoll(*conn, client_events());
+}
+
+Connection *Server::open_connection(int fd, uint32_t peer_addr)
+{
+  // 🔒 ENFORCE LIMIT — FIRST THING
+  if ((int)connections_.size() >= max_connections_)
   {
-    conn.frames_in_window = 0;
-    conn.window_start = now;
+    LOG_WARN("Rejecting client fd={} (max_connections reached: {})", fd,
+             connections_.size());
+    Metrics::add(metrics_.connections_rejected);
+    ::close(fd);
+    return nullptr;
   }
 
-  if (++conn.frames_in_window > 1000)
+  // An address the table has no room for is admitted untracked: the
+  // table is twice the connection limit, so that takes a crowd of
+  // colliding addresses, not one greedy one.
+  IpTable::Entry *ip = peer_addr ? ip_table_.acquire(peer_addr) : nullptr;
+  if (ip && max_connections_per_ip_ > 0 &&
+      ip->connections >= max_connections_per_ip_)
   {
-    std::cerr << "[ABUSE] frame flood fd=" << conn.fd << "\n";
-    remove_fd_from_epoll(conn.fd);
-    ::close(conn.fd);
-    connections_.erase(conn.fd);
-    metrics_.connections_closed++;
-    return;
+    LOG_WARN("Rejecting client fd={} (per-IP limit reached: {})", fd,
+             ip->connections);
+    Metrics::add(metrics_.connections_rejected);
+    ::close(fd);
+    return nullptr;
   }
 
-  metrics_.bytes_read += frame.size();
-  conn.last_activity = Connection::Clock::now();
+  Connection &conn = connections_.open(fd);
+  conn.generation = ++next_generation_; // checked by cross-reactor replies
+  if (ip)
+  {
+    ip->connections++;
+    conn.ip = ip;
+  }
+  touch(conn, conn.last_activity);
+  if (trace_)
+  {
+    if (!uring_)
+      enable_rx_timestamps(fd); // io_uring's multishot recv has no cmsg
+    if (trace_due_)
+      trace_arm(conn);
+  }
+  Metrics::add(metrics_.connections_accepted);
+  Metrics::add(metrics_.active_connections);
+  return &conn;
+}
+
+bool Server::on_frame_received(Connection &conn, ConstByteSpan frame)
+{
+  Metrics::add(metrics_.bytes_read, frame.size);
+
+  // The frame stays in read_buffer; the router only slices it. v2 frames
+  // skip the text parse entirely.
+  const std::string_view text(reinterpret_cast<const char *>(frame.data),
+                              frame.size);
+  const CommandRouter::Match m =
+      conn.protocol == Connection::Protocol::V2
+          ? command_router().route(conn.tag.opcode, text)
+          : command_router().route(text);
+  return (this->*m.handler)(conn, m.args);
+}
+
+bool Server::handle_message(Connection &conn, ConstByteSpan msg)
+{
+  Metrics::add(metrics_.frames_received);
+  auto start = Connection::Clock::now();
+  bool alive = on_frame_received(conn, msg);
+  metrics_.service_ns.record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Connection::Clock::now() - start)
+          .count()));
+  return alive;
+}
 
-  std::string cmd(reinterpret_cast<const char *>(frame.data()),
-                  frame.size());
+bool Server::queue_frame(Connection &conn, FrameRef payload)
+{
+  return queue_frame(conn, std::move(payload), conn.tag);
+}
 
-  // Trim trailing whitespace
-  while (!cmd.empty() &&
-         (cmd.back() == '\n' || cmd.back() == '\r' || cmd.back() == ' '))
+bool Server::queue_frame(Connection &conn, FrameRef payload,
+                         const FrameTag &tag)
+{
+  const size_t wire = V2Header::SIZE + payload.bytes().size;
+  if (conn.unsent_bytes() + wire > Connection::WRITE_HIGH_WATER)
   {
-    cmd.pop_back();
+    close_connection(conn.fd, "write buffer overflow");
+    return false;
   }
 
-  if (cmd == "PING")
+  // Only an unordered v2 reply can turn up while a streamed reply owns
+  // the socket; it goes out after it.
+  if (conn.stream.reply_open)
   {
-    const std::string resp = "PONG";
-    queue_frame(conn,
-                std::vector<uint8_t>(resp.begin(), resp.end()));
-    return;
+    conn.stream.deferred.emplace_back(std::move(payload), tag);
+    conn.stream.deferred_bytes += wire;
+    return true;
   }
 
-  if (cmd.rfind("ECHO ", 0) == 0)
+  // Header and payload are gathered by writev(); nothing is copied here.
+  if (conn.protocol == Connection::Protocol::V2)
+    conn.write_queue.push(std::move(payload), tag);
+  else
+    conn.write_queue.push(std::move(payload));
+
+  // Written when the loop flushes, together with everything else this
+  // read event produced.
+  arm_write(conn);
+  return true;
+}
+
+void Server::arm_write(Connection &conn)
+{
+  if (uring_)
   {
-    const std::string payload = cmd.substr(5);
-    queue_frame(conn,
-                std::vector<uint8_t>(payload.begin(), payload.end()));
+    uring_queue_send(conn);
     return;
   }
 
-  if (cmd == "STATS")
+  // A blocked socket is already waiting for EPOLLOUT.
+  if (conn.flush_queued || conn.write_blocked)
+    return;
+  conn.flush_queued = true;
+  flush_pending_.push_back(&conn);
+}
+
+void Server::flush_pending()
+{
+  // Entries may be closing, but are not released before this runs. A
+  // write that finishes a streamed reply answers the frames queued behind
+  // it, which may append here.
+  for (size_t i = 0; i < flush_pending_.size(); ++i)
   {
-    std::string out;
-    out += "connections=" + std::to_string(connections_.size()) + "\n";
-    out += "accepted=" + std::to_string(metrics_.connections_accepted) + "\n";
-    out += "closed=" + std::to_string(metrics_.connections_closed) + "\n";
-    out += "frames=" + std::to_string(metrics_.frames_received) + "\n";
-    out += "bytes_read=" + std::to_string(metrics_.bytes_read) + "\n";
-    out += "bytes_written=" + std::to_string(metrics_.bytes_written);
+    Connection *conn = flush_pending_[i];
+    conn->flush_queued = false;
+    if (!conn->closing && !conn->write_blocked)
+      handle_client_write(*conn);
+    if (!conn->closing)
+      account(*conn);
+  }
+  flush_pending_.clear();
+}
+
+uint32_t Server::client_events() const
+{
+  // No EPOLLRDHUP either way: a client that half-closes after its last
+  // request is still read to the end and answered.
+  return cfg_.edge_triggered ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLIN;
+}
 
-    queue_frame(conn,
-                std::vector<uint8_t>(out.begin(), out.end()));
+bool Server::wants_read(const Connection &conn) const
+{
+  // Splice relay: read the body while the pipe is empty.
+  if (conn.stream.pipe_rd >= 0)
+    return conn.stream.body_left > 0 && conn.stream.in_pipe == 0;
+  return !reading_paused(conn);
+}
+
+void Server::update_interest(Connection &conn)
+{
+  if (cfg_.edge_triggered)
+  {
+    if ((conn.read_ready && wants_read(conn)) ||
+        (conn.write_blocked && conn.write_ready))
+      defer(conn);
     return;
   }
 
-  if (cmd == "CLOSE")
-  {
-    const std::string resp = "OK";
-    queue_frame(conn,
-                std::vector<uint8_t>(resp.begin(), resp.end()));
+  // EPOLLOUT only while a write has been cut short; EPOLLIN only while
+  // the peer is keeping up with its responses and is not throttled.
+  uint32_t events = 0;
+  if (wants_read(conn))
+    events |= EPOLLIN;
+  if (conn.write_blocked)
+    events |= EPOLLOUT;
+  mod_fd_epoll(conn, events);
+}
 
-    // EPOLLOUT will flush, then client closes
+void Server::defer(Connection &conn)
+{
+  if (conn.ready_queued || conn.closing)
     return;
+  conn.ready_queued = true;
+  ready_.push_back(&conn);
+}
+
+void Server::run_ready()
+{
+  // Swapped out first: a connection that uses up its budget again is
+  // queued for the next tick, not this one.
+  ready_now_.swap(ready_);
+  for (Connection *conn : ready_now_)
+  {
+    conn->ready_queued = false;
+    if (conn->closing)
+      continue;
+    if (conn->read_ready && wants_read(*conn))
+      handle_client_read(*conn);
+    if (!conn->closing && conn->write_blocked && conn->write_ready)
+      handle_client_write(*conn);
+    if (!conn->closing)
+      account(*conn);
   }
-  // Shutdown button
-  if (cmd == "SHUTDOWN")
+  ready_now_.clear();
+}
+
+bool Server::process_frames(Connection &conn)
+{
+  // Too late to answer: our side of the connection is already shut.
+  if (conn.half_closed)
+  {
+    conn.read_buffer.consume(conn.read_buffer.size());
+    return true;
+  }
+
+  // ---------- framing state machine ----------
+  while (!conn.throttled && !conn.streaming_out())
   {
-    const std::string resp = "OK";
-    queue_frame(conn,
-                std::vector<uint8_t>(resp.begin(), resp.end()));
+    ConstByteSpan frame;
+    Connection::FrameStatus st = conn.next_frame(frame);
 
-    std::cout << "[CONTROL] shutdown requested\n";
-    stop(); // sets running_ = false, removes listen fd
+    if (st == Connection::FrameStatus::NEED_MORE)
+    {
+      if (trace_due_)
+        trace_arm(conn);
+      return true;
+    }
+
+    if (st == Connection::FrameStatus::LARGE)
+    {
+      if (conn.trace.stage == FrameTrace::Stage::READING)
+        conn.trace = FrameTrace{}; // streamed frames are not traced
+      if (!begin_stream(conn, frame))
+        return false;
+      continue;
+    }
+
+    if (st == Connection::FrameStatus::CHUNK)
+    {
+      // The reply is backed up: the rest of the body waits in read_buffer
+      // until the queue drains.
+      if (conn.write_queue.size() >= Connection::WRITE_LOW_WATER)
+        return true;
+      if (!stream_chunk(conn, frame))
+        return false;
+      continue;
+    }
+
+    if (st == Connection::FrameStatus::PROTOCOL_ERROR)
+    {
+      LOG_WARN("Protocol violation fd={} len={}", conn.fd, conn.expected_len);
+      close_connection(conn.fd, "protocol violation");
+      return false;
+    }
+
+    if (conn.trace.stage == FrameTrace::Stage::READING)
+      trace_complete(conn);
+
+    // Over its rate: the frame waits in read_buffer, unparsed.
+    if (rate_limited_ && !admit_frame(conn, frame.size))
+      return true;
+
+    // 🔼 Deliver frame upward, parsed in place
+    const size_t queued = conn.write_queue.size();
+    if (!handle_message(conn, frame))
+      return false; // connection was closed by the handler
+    if (trace_)
+      trace_dispatched(conn, frame.size, queued);
+
+    conn.finish_frame();
+  }
+  return true;
+}
+
+bool Server::admit_frame(Connection &conn, size_t bytes)
+{
+  const auto now = Connection::Clock::now();
+  auto wait = Connection::Clock::duration::zero();
+
+  auto check = [&](TokenBucket &bucket, const RateLimit &limit) {
+    if (!limit.enabled())
+      return;
+    bucket.refill(limit, now);
+    wait = std::max(wait, bucket.wait(limit));
+  };
+  check(conn.frame_tokens, conn_frames_);
+  check(conn.byte_tokens, conn_bytes_);
+  if (conn.ip)
+  {
+    check(conn.ip->frames, ip_frames_);
+    check(conn.ip->bytes, ip_bytes_);
+  }
+
+  if (wait == Connection::Clock::duration::zero())
+  {
+    conn.frame_tokens.take(1);
+    conn.byte_tokens.take(static_cast<double>(bytes));
+    if (conn.ip)
+    {
+      conn.ip->frames.take(1);
+      conn.ip->bytes.take(static_cast<double>(bytes));
+    }
+    return true;
+  }
+
+  // Backpressure rather than a disconnect: stop reading and let the
+  // socket buffers fill, so TCP flow control slows the sender down.
+  conn.throttled = true;
+  throttle_timers_.schedule(conn.throttle_timer, now + wait);
+  Metrics::add(metrics_.throttle_events);
+  if (uring_)
+    uring_pause_recv(conn);
+  else
+    update_interest(conn);
+  return false;
+}
+
+bool Server::reading_paused(const Connection &conn)
+{
+  return conn.throttled || conn.memory_paused || conn.streaming_out() ||
+         conn.write_queue.size() >= Connection::WRITE_LOW_WATER;
+}
+
+void Server::resume_reading(Connection &conn)
+{
+  conn.throttled = false;
+
+  // Frames buffered before the pause go first; they may throttle again.
+  if (!process_frames(conn) || conn.throttled)
     return;
+
+  if (uring_)
+  {
+    if (!conn.recv_armed && !reading_paused(conn))
+      uring_arm_recv(conn);
+  }
+  else
+  {
+    update_interest(conn);
   }
+}
 
-  const std::string err = "ERR unknown command";
-  queue_frame(conn,
-              std::vector<uint8_t>(err.begin(), err.end()));
+// ---------- memory budget ----------
+
+void Server::account(Connection &conn)
+{
+  const size_t now = conn.read_buffer.capacity() + conn.write_queue.size();
+  if (now > conn.accounted)
+    Metrics::add(metrics_.buffer_bytes, now - conn.accounted);
+  else
+    Metrics::sub(metrics_.buffer_bytes, conn.accounted - now);
+  conn.accounted = now;
 }
 
-void Server::handle_message(Connection &conn,
-                            const std::vector<uint8_t> &msg)
+bool Server::over_memory_share(Connection &conn)
 {
-  metrics_.frames_received++;
-  on_frame_received(conn, msg);
+  if (!memory_pressured_)
+    return false;
+  account(conn);
+  if (conn.accounted < heavy_bytes_)
+    return false;
+  conn.memory_paused = true;
+  return true;
 }
 
-void Server::queue_frame(Connection &conn,
-                         const std::vector<uint8_t> &payload)
+void Server::check_memory_budget()
 {
-  uint32_t len = htonl(payload.size());
+  const size_t used = metrics_.buffer_bytes.load(std::memory_order_relaxed);
+  const size_t high = memory_budget_ / 100 * MEMORY_HIGH_PCT;
+  const size_t low = memory_budget_ / 100 * MEMORY_LOW_PCT;
 
-  size_t off = conn.write_buffer.size();
-  conn.write_buffer.resize(off + 4 + payload.size());
+  if (!memory_pressured_ && used >= high)
+  {
+    // Hysteresis: reading resumes only once usage is back under `low`,
+    // so a connection is not paused and resumed on every iteration.
+    memory_pressured_ = true;
+    Metrics::add(metrics_.memory_pressured);
+    Metrics::add(metrics_.memory_pressure_events);
+    LOG_WARN("[reactor {}] Memory pressure: {} of {} bytes buffered",
+             reactor_id_, used, memory_budget_);
+
+    // A connection's fair share of the low mark; anything holding more
+    // is producing faster than its replies drain.
+    heavy_bytes_ = std::max(MIN_HEAVY_BYTES,
+                            low / std::max<size_t>(1, connections_.size()));
+    connections_.for_each([this](Connection &conn) {
+      if (conn.closing)
+        return;
+      // Idle buffers go back to the pool; the next read takes one again.
+      conn.read_buffer.release();
+      account(conn);
+      if (conn.accounted < heavy_bytes_ || conn.memory_paused)
+        return;
+      conn.memory_paused = true;
+      if (uring_)
+        uring_pause_recv(conn);
+      else
+        update_interest(conn);
+    });
+    return;
+  }
 
-  std::memcpy(conn.write_buffer.data() + off, &len, 4);
-  std::memcpy(conn.write_buffer.data() + off + 4,
-              payload.data(),
-              payload.size());
+  if (!memory_pressured_)
+    return;
 
-  if (conn.write_buffer.size() > Connection::WRITE_HIGH_WATER)
+  if (used <= low)
   {
-    std::cerr << "[BACKPRESSURE] fd=" << conn.fd << " write buffer overflow\n";
-    remove_fd_from_epoll(conn.fd);
-    ::close(conn.fd);
-    connections_.erase(conn.fd);
-    metrics_.connections_closed++;
+    memory_pressured_ = false;
+    Metrics::sub(metrics_.memory_pressured);
+    LOG_INFO("[reactor {}] Memory pressure over: {} bytes buffered",
+             reactor_id_, used);
+    connections_.for_each([this](Connection &conn) {
+      if (conn.closing || !conn.memory_paused)
+        return;
+      conn.memory_paused = false;
+      if (!uring_)
+        update_interest(conn);
+      else if (!conn.recv_armed && !reading_paused(conn))
+        uring_arm_recv(conn);
+    });
     return;
   }
 
-  // arm EPOLLOUT only if connection survives
-  mod_fd_epoll(conn.fd, EPOLLIN | EPOLLOUT);
+  if (used <= memory_budget_)
+    return;
+
+  // Paused connections are still over the whole budget (replies nobody
+  // reads, say). Last resort: shed the largest until back under it.
+  std::vector<Connection *> heaviest;
+  connections_.for_each([&heaviest](Connection &conn) {
+    if (!conn.closing)
+      heaviest.push_back(&conn);
+  });
+  std::sort(heaviest.begin(), heaviest.end(),
+            [](const Connection *a, const Connection *b) {
+              return a->accounted > b->accounted;
+            });
+  for (Connection *conn : heaviest)
+  {
+    if (metrics_.buffer_bytes.load(std::memory_order_relaxed) <= memory_budget_)
+      break;
+    LOG_WARN("[reactor {}] Shedding fd={} holding {} bytes", reactor_id_,
+             conn->fd, conn->accounted);
+    Metrics::add(metrics_.connections_shed);
+    close_connection(conn->fd, "memory budget");
+    if (uring_)
+      uring_reap(*conn);
+  }
 }
 
 // ---------- read ----------
 
-void Server::handle_client_read(int fd)
+void Server::handle_client_read(Connection &conn)
 {
-  auto it = connections_.find(fd);
-  if (it == connections_.end())
-    return;
-
-  Connection &conn = it->second;
-  uint8_t buf[4096];
+  const int fd = conn.fd;
+  const size_t budget = static_cast<size_t>(cfg_.io_budget_bytes);
+  size_t read_this_tick = 0;
 
   while (true)
   {
-    ssize_t n = ::read(fd, buf, sizeof(buf));
+    // A relayed body goes socket to pipe; behind a reply still streaming
+    // out, nothing is read.
+    if (conn.stream.pipe_rd >= 0)
+    {
+      splice_relay(conn, STREAM_BUDGET);
+      return;
+    }
+    if (conn.streaming_out())
+    {
+      update_interest(conn);
+      return;
+    }
 
-    if (n > 0)
+    // Past its budget the connection waits for the next tick, like the
+    // write side, so one fast sender cannot hold the loop: level-triggered
+    // epoll reports it again, edge-triggered mode puts it on the ready
+    // list.
+    if (read_this_tick >= budget)
     {
-      conn.last_activity = Connection::Clock::now();
+      Metrics::add(metrics_.io_deferred);
+      update_interest(conn);
+      return;
+    }
+
+    // Read straight into the ring's free space (both halves if wrapped).
+    conn.read_buffer.reserve(conn.read_buffer.size() + READ_CHUNK);
+    iovec iov[2];
+    int cnt = conn.read_buffer.writable_iov(iov);
 
-      conn.read_buffer.insert(conn.read_buffer.end(), buf, buf + n);
+    ssize_t n = conn.trace.stage == FrameTrace::Stage::ARMED
+                    ? trace_read(conn, iov, cnt)
+                    : io_->readv(fd, iov, cnt);
+
+    if (n > 0)
+    {
+      touch(conn, Connection::Clock::now());
+      if (cfg_.sock.quickack)
+        set_quickack(fd);
+      metrics_.read_bytes.record(static_cast<uint64_t>(n));
+      conn.read_buffer.commit(static_cast<size_t>(n));
+      read_this_tick += static_cast<size_t>(n);
     }
     else if (n == 0)
     {
@@ -286,182 +980,237 @@ void Server::handle_client_read(int fd)
     else
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        conn.read_ready = false;
         break;
+      }
 
       std::perror("read");
       close_connection(fd, "read error");
       return;
     }
 
-    // ---------- framing state machine ----------
-    while (true)
+    if (!process_frames(conn) || conn.throttled)
+      return;
+    if (over_memory_share(conn))
     {
-      // Step 1: read length
-      if (conn.state == Connection::ReadState::READ_LEN)
-      {
-        if (conn.read_buffer.size() < sizeof(uint32_t))
-          break;
-
-        uint32_t netlen;
-        std::memcpy(&netlen, conn.read_buffer.data(), sizeof(uint32_t));
-        conn.expected_len = ntohl(netlen);
-
-        // Defensive limit
-        if (conn.expected_len == 0 || conn.expected_len > 1024 * 1024)
-        {
-          std::cerr << "Protocol violation fd=" << fd
-                    << " len=" << conn.expected_len << "\n";
-          close_connection(fd, "write on unknown fd");
-          return;
-        }
-
-        conn.read_buffer.erase(conn.read_buffer.begin(),
-                               conn.read_buffer.begin() + sizeof(uint32_t));
-
-        conn.state = Connection::ReadState::READ_BODY;
-      }
-
-      // Step 2: read payload
-      if (conn.state == Connection::ReadState::READ_BODY)
-      {
-        if (conn.read_buffer.size() < conn.expected_len)
-          break;
-
-        std::vector<uint8_t> frame(conn.read_buffer.begin(),
-                                   conn.read_buffer.begin() +
-                                       conn.expected_len);
-
-        conn.read_buffer.erase(conn.read_buffer.begin(),
-                               conn.read_buffer.begin() + conn.expected_len);
-
-        conn.state = Connection::ReadState::READ_LEN;
-        conn.expected_len = 0;
+      update_interest(conn);
+      return;
+    }
 
-        // 🔼 Deliver frame upward (Phase 3.1 = no-op)
-        on_frame_received(conn, frame);
-      }
+    // A deep pipeline: write now rather than buffer the whole backlog,
+    // and stop reading while the peer is not draining its responses.
+    if (conn.write_queue.size() >= Connection::WRITE_LOW_WATER)
+    {
+      if (!handle_client_write(conn))
+        return;
+      if (conn.write_queue.size() >= Connection::WRITE_LOW_WATER)
+        return;
     }
   }
 }
 
 // ---------- write ----------
 
-void Server::handle_client_write(int fd)
+bool Server::handle_client_write(Connection &conn)
 {
-  auto it = connections_.find(fd);
-  if (it == connections_.end())
-  {
-    close_connection(fd, "write on unknown fd");
-    ::close(fd);
-    return;
-  }
+  const int fd = conn.fd;
 
-  auto &conn = it->second;
-
-  constexpr size_t MAX_WRITE_PER_TICK = 64 * 1024;
+  const size_t budget = static_cast<size_t>(cfg_.io_budget_bytes);
   size_t written_this_tick = 0;
 
-  while (!conn.write_buffer.empty() &&
-         written_this_tick < MAX_WRITE_PER_TICK)
+  iovec iov[IOV_MAX];
+  metrics_.write_queue_bytes.record(conn.write_queue.size());
+
+  while (conn.write_queue.writable() > 0 && written_this_tick < budget)
   {
+    int cnt = conn.write_queue.fill_iov(iov, IOV_MAX);
 
-    ssize_t n = ::write(fd,
-                        conn.write_buffer.data(),
-                        conn.write_buffer.size());
+    ssize_t n = io_->writev(fd, iov, cnt);
 
     if (n > 0)
     {
-      conn.last_activity = Connection::Clock::now();
+      touch(conn, Connection::Clock::now());
 
       written_this_tick += static_cast<size_t>(n);
+      Metrics::add(metrics_.bytes_written, static_cast<uint64_t>(n));
 
-      conn.write_buffer.erase(
-          conn.write_buffer.begin(),
-          conn.write_buffer.begin() + n);
+      // Drop fully written frames; a partial one keeps its offset.
+      conn.write_queue.consume(static_cast<size_t>(n));
+      if (conn.trace.stage == FrameTrace::Stage::WRITING)
+        trace_written(conn, static_cast<size_t>(n));
     }
     else
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
       {
-        // Kernel buffer full — wait for next EPOLLOUT
-        return;
+        conn.write_ready = false;
+        break; // kernel buffer full — wait for EPOLLOUT
       }
 
       std::perror("write");
       close_connection(fd, "write error");
-      return;
+      return false;
     }
   }
 
-  // Stop EPOLLOUT if nothing left to write
-  if (conn.write_buffer.empty())
-  {
-    mod_fd_epoll(fd, EPOLLIN);
-  }
+  // Arm EPOLLOUT only if bytes are left over (EAGAIN or the per-tick
+  // budget); drop it again once the queue drains.
+  conn.write_blocked = conn.write_queue.writable() > 0;
+  if (conn.write_blocked && conn.write_ready)
+    Metrics::add(metrics_.io_deferred);
+
+  // A spliced or file-backed reply continues once everything queued
+  // ahead of it is out.
+  if (conn.write_queue.empty() && conn.streaming_out() && !conn.closing)
+    return stream_out(conn, budget - written_this_tick);
+  if (conn.body_buffered() &&
+      conn.write_queue.size() < Connection::WRITE_LOW_WATER &&
+      !conn.closing && !process_frames(conn))
+    return false;
+
+  update_interest(conn);
+  return !conn.closing;
 }
 
 // ---------- event loop ----------
 
-void Server::run()
+void Server::touch(Connection &conn, Connection::Clock::time_point now)
 {
-  g_server = this;
+  conn.last_activity = now;
+  // O(1), and free unless the deadline moved into another wheel slot.
+  idle_timers_.schedule(conn.idle_timer, now + IDLE_TIMEOUT);
+}
 
-  // ---------- signal setup ----------
-  struct sigaction sa{};
-  sa.sa_handler = handle_signal;
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = 0;
+void Server::housekeeping()
+{
+  auto now = Connection::Clock::now();
 
-  sigaction(SIGINT, &sa, nullptr);
-  sigaction(SIGTERM, &sa, nullptr);
-  sigaction(SIGUSR1, &sa, nullptr);
+  // ---------- idle timeout expiry ----------
+  // Only the wheel slots that came due are visited, so the cost tracks
+  // the number of expiring connections, not the total.
+  idle_timers_.advance(now, [this, now](TimerNode &node) {
+    Connection &conn = *static_cast<Connection *>(node.owner);
+    if (now - conn.last_activity < IDLE_TIMEOUT)
+    {
+      idle_timers_.schedule(node, conn.last_activity + IDLE_TIMEOUT);
+      return;
+    }
+    LOG_INFO("Closing idle fd={}", conn.fd);
+    close_connection(conn.fd, "idle timeout");
+  });
+
+  // ---------- throttle expiry ----------
+  throttle_timers_.advance(now, [this](TimerNode &node) {
+    resume_reading(*static_cast<Connection *>(node.owner));
+  });
+
+  // ---------- accept ----------
+  if (accept_paused_ && !draining_ &&
+      static_cast<int>(connections_.size()) < max_connections_)
+    resume_accept();
+  if (accept_starved_ && now >= accept_retry_at_)
+  {
+    accept_starved_ = false;
+    if (uring_accepts_ == 0 && !draining_ && !accept_paused_)
+      uring_arm_accept();
+  }
+  if (now - accept_rate_at_ >= std::chrono::seconds(1))
+  {
+    const uint64_t accepted =
+        metrics_.connections_accepted.load(std::memory_order_relaxed);
+    metrics_.accept_rate.store(accepted - accepted_at_,
+                               std::memory_order_relaxed);
+    accepted_at_ = accepted;
+    accept_rate_at_ = now;
+  }
 
-  std::cout << "epoll event loop started\n";
+  // ---------- drain and restart ----------
+  if (drain_requested_.load(std::memory_order_relaxed) && !draining_)
+    begin_drain(now);
+  if (draining_)
+    drain_step(now);
+  if (!g_servers.empty() && this == g_servers.front() &&
+      restart_requested.exchange(false))
+    begin_restart(now);
+  if (handoff_channel_ >= 0)
+    poll_restart(now);
+
+  // ---------- memory budget ----------
+  if (memory_budget_ > 0)
+    check_memory_budget();
+
+  // ---------- key expiry ----------
+  kv_.expire_step(KvStore::now_ms(), KV_EXPIRE_BUDGET);
+
+  // ---------- metrics logging ----------
+  if (dump_metrics_requested.exchange(false))
+  {
+    const MetricsSnapshot m = aggregate_metrics();
+    LOG_INFO("[metrics dump] reactors={} active={} accepted={} closed={} "
+             "frames={} read_bytes={} written_bytes={}",
+             g_servers.size(), m.active_connections, m.connections_accepted,
+             m.connections_closed, m.frames_received, m.bytes_read,
+             m.bytes_written);
+  }
+}
 
-  constexpr int MAX_EVENTS = 16;
-  epoll_event events[MAX_EVENTS];
+int Server::wait_timeout_ms()
+{
+  // Bounded by the next idle deadline, so idle clients are evicted even
+  // when no other traffic arrives, by the next throttled connection's
+  // resume, by the expiry tick while keys with a TTL are waiting to be
+  // reclaimed, by the accept retry while out of descriptors, and by
+  // DRAIN_TICK_MS while a drain or restart is under way.
+  const auto now = Connection::Clock::now();
+  int timeout = idle_timers_.timeout_ms(now);
+  int throttle = throttle_timers_.timeout_ms(now);
+  if (throttle >= 0 && (timeout < 0 || throttle < timeout))
+    timeout = throttle;
+  if (kv_.volatile_count() > 0 && (timeout < 0 || timeout > KV_EXPIRE_TICK_MS))
+    timeout = KV_EXPIRE_TICK_MS;
+  if (accept_starved_ && (timeout < 0 || timeout > ACCEPT_RETRY_MS))
+    timeout = ACCEPT_RETRY_MS;
+  if ((draining_ || handoff_channel_ >= 0) &&
+      (timeout < 0 || timeout > DRAIN_TICK_MS))
+    timeout = DRAIN_TICK_MS;
+  return timeout;
+}
 
-  auto last_log = Connection::Clock::now();
+void Server::run()
+{
+  place();
 
-  // ---------- main loop ----------
-  while (running_)
+  if (cfg_.io_backend == ServerConfig::IoBackend::URING)
   {
-
-    auto now = Connection::Clock::now();
-
-    // ---------- idle timeout sweep ----------
-    for (auto it = connections_.begin(); it != connections_.end();)
+    if (uring_init())
     {
-      if (now - it->second.last_activity > IDLE_TIMEOUT)
-      {
-        std::cout << "Closing idle fd=" << it->first << "\n";
-        remove_fd_from_epoll(it->first);
-        ::close(it->first);
-        it = connections_.erase(it);
-        metrics_.connections_closed++;
-      }
-      else
-      {
-        ++it;
-      }
+      on_uring_.store(true, std::memory_order_release);
+      run_uring();
+      return;
     }
+    LOG_WARN("[reactor {}] io_uring unavailable ({}), falling back to epoll",
+             reactor_id_, LogErrno{errno});
+  }
 
-    // ---------- metrics logging ----------
-    if (dump_metrics_requested.exchange(false))
-    {
-      std::cout << "[metrics dump] "
-                << "active=" << connections_.size()
-                << " accepted=" << metrics_.connections_accepted
-                << " closed=" << metrics_.connections_closed
-                << " frames=" << metrics_.frames_received
-                << " read_bytes=" << metrics_.bytes_read
-                << " written_bytes=" << metrics_.bytes_written
-                << "\n";
-      last_log = now;
-    }
+  LOG_INFO("[reactor {}] epoll event loop started", reactor_id_);
+
+  std::vector<epoll_event> events(static_cast<size_t>(cfg_.events_per_wait));
+
+  // ---------- main loop ----------
+  while (running_)
+  {
+    housekeeping();
+    // One more budget for each connection left over from the last tick.
+    if (!ready_.empty())
+      run_ready();
+    // Connections resumed from throttling may have replies queued.
+    flush_pending();
 
     // ---------- wait for I/O ----------
-    int ready = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+    // Connections on the ready list still have work: just poll.
+    int ready = epoll_wait(epoll_fd_, events.data(), cfg_.events_per_wait,
+                           ready_.empty() ? wait_timeout_ms() : 0);
 
     if (ready < 0)
     {
@@ -471,56 +1220,274 @@ void Server::run()
       std::perror("epoll_wait");
       std::exit(EXIT_FAILURE);
     }
+    metrics_.events_per_wait.record(static_cast<uint64_t>(ready));
 
     // ---------- handle events ----------
     for (int i = 0; i < ready; ++i)
     {
-      int fd = events[i].data.fd;
+      void *tag = events[i].data.ptr;
       uint32_t ev = events[i].events;
 
-      if (fd == listen_fd_)
+      if (tag == &listen_fd_)
       {
         handle_accept();
         continue;
       }
 
+      if (tag == &wake_fd_)
+      {
+        uint64_t count;
+        while (::read(wake_fd_, &count, sizeof(count)) > 0)
+        {
+        }
+        run_mailbox();
+        continue;
+      }
+
+      // Closed earlier in this batch: the object is retired, not reused,
+      // until the batch is over.
+      Connection &conn = *static_cast<Connection *>(tag);
+      if (conn.closing)
+        continue;
+
       if (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
       {
-        close_connection(fd, "epoll error/hup");
+        close_connection(conn.fd, "epoll error/hup");
         continue;
       }
 
+      // Level-triggered, these only arrive while wanted; edge-triggered,
+      // they record what the socket allows until the next EAGAIN.
       if (ev & EPOLLIN)
-        handle_client_read(fd);
+      {
+        conn.read_ready = true;
+        if (wants_read(conn))
+          handle_client_read(conn);
+      }
 
-      if (ev & EPOLLOUT)
-        handle_client_write(fd);
+      if ((ev & EPOLLOUT) && !conn.closing)
+      {
+        conn.write_ready = true;
+        if (conn.write_blocked)
+          handle_client_write(conn);
+      }
+
+      if (!conn.closing)
+        account(conn);
     }
+
+    // One write per connection for everything this batch produced.
+    flush_pending();
+    // Entries for connections closed since they were queued would
+    // outlive the objects.
+    if (!ready_.empty())
+      ready_.erase(std::remove_if(ready_.begin(), ready_.end(),
+                                  [](const Connection *c) { return c->closing; }),
+                   ready_.end());
+    connections_.release_retired();
   }
 
-  // ---------- shutdown ----------
-  std::cout << "Draining connections...\n";
+  shutdown_connections();
+}
+
+// ---------- drain and restart ----------
 
-  for (auto &[fd, conn] : connections_)
+void Server::begin_drain(Connection::Clock::time_point now)
+{
+  draining_ = true;
+  drain_deadline_ = now + std::chrono::milliseconds(cfg_.drain_timeout_ms);
+  LOG_INFO("[reactor {}] Draining {} connections (deadline {} ms)",
+           reactor_id_, connections_.size(), cfg_.drain_timeout_ms);
+
+  if (accept_paused_)
   {
-    ::close(fd);
+    accept_paused_ = false; // for good: the listener is going away
+    Metrics::sub(metrics_.accept_paused);
+  }
+
+  // Stop accepting. Unless a new process has taken the listener over,
+  // shut it down too, so new clients are refused at once instead of
+  // queueing until exit.
+  if (uring_)
+    uring_stop_accept();
+  else
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+  if (!restart_started)
+    ::shutdown(listen_fd_, SHUT_RD);
+}
+
+void Server::drain_step(Connection::Clock::time_point now)
+{
+  if (now >= drain_deadline_)
+  {
+    LOG_WARN("[reactor {}] Drain deadline passed, {} connections left",
+             reactor_id_, connections_.size());
+    running_ = false;
+    return;
+  }
+
+  connections_.for_each([now](Connection &conn) {
+    if (conn.closing || conn.half_closed)
+      return;
+
+    // Requests the client has already sent are still answered: wait
+    // while any are buffered or unread, or their replies are queued
+    // (including ones still out on another reactor). A client accepted
+    // a moment ago gets DRAIN_QUIET to send its first request.
+    int unread = 0;
+    if (now - conn.last_activity < DRAIN_QUIET || conn.stream.reply_open ||
+        !conn.write_queue.empty() || conn.send_in_flight ||
+        !conn.read_buffer.empty() ||
+        (::ioctl(conn.fd, FIONREAD, &unread) == 0 && unread > 0))
+      return;
+
+    // The client reads EOF after its last reply and closes its side.
+    ::shutdown(conn.fd, SHUT_WR);
+    conn.half_closed = true;
+  });
+
+  // An empty reactor stays up until every reactor is empty: it still
+  // owns a key shard the others' clients may be waiting on.
+  if (connections_.size() == 0)
+    drained_ = true;
+  for (const Server *s : g_servers)
+  {
+    if (!s->drained_)
+      return;
+  }
+  running_ = false;
+}
+
+void Server::begin_restart(Connection::Clock::time_point now)
+{
+  if (handoff_channel_ >= 0)
+  {
+    LOG_INFO("[CONTROL] restart already in progress");
+    return;
+  }
+  // Flagged before the check: a reactor that starts draining after it
+  // either stops this restart or sees the flag and leaves its listener
+  // up for the new process.
+  restart_started = true;
+  for (const Server *s : g_servers)
+  {
+    if (s->drain_requested_ || !s->running_)
+    {
+      restart_started = false;
+      LOG_INFO("[CONTROL] shutting down, restart ignored");
+      return;
+    }
   }
 
+  handoff_channel_ = handoff_spawn(g_listeners, handoff_pid_);
+  if (handoff_channel_ < 0)
+  {
+    restart_started = false;
+    std::perror("restart");
+    return;
+  }
+  handoff_deadline_ = now + HANDOFF_TIMEOUT;
+  LOG_INFO("[CONTROL] restart: pid {} received {} listeners", handoff_pid_,
+           g_listeners.size());
+}
+
+void Server::poll_restart(Connection::Clock::time_point now)
+{
+  const int status = handoff_poll(handoff_channel_);
+  if (status == 0 && now < handoff_deadline_)
+    return;
+
+  ::close(handoff_channel_);
+  handoff_channel_ = -1;
+
+  if (status == 1)
+  {
+    LOG_INFO("[CONTROL] restart: pid {} is serving, draining", handoff_pid_);
+    drain_all();
+    return;
+  }
+
+  LOG_ERROR("[CONTROL] restart failed: pid {} {} before taking over; still "
+            "serving",
+            handoff_pid_, status < 0 ? "exited" : "timed out");
+  ::kill(handoff_pid_, SIGKILL); // no-op if it is already gone
+  ::waitpid(handoff_pid_, nullptr, 0);
+  handoff_pid_ = -1;
+  restart_started = false;
+}
+
+void Server::shutdown_connections()
+{
+  // ---------- shutdown ----------
+  LOG_INFO("[reactor {}] Draining connections...", reactor_id_);
+
+  // Stop accepting new connections
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+  ::close(listen_fd_);
+
+  connections_.for_each([this](Connection &conn) {
+    release_stream(conn);
+    ::close(conn.fd);
+    idle_timers_.cancel(conn.idle_timer);
+    if (!conn.closing)
+    {
+      Metrics::add(metrics_.connections_closed);
+      Metrics::sub(metrics_.active_connections);
+      Metrics::sub(metrics_.buffer_bytes, conn.accounted);
+      Metrics::sub(metrics_.subscriptions, conn.subscriptions.size());
+    }
+  });
+  topics_.clear();
+
+  // Tearing the ring down cancels whatever is still in flight.
+  uring_.reset();
+  flush_pending_.clear();
+  ready_.clear();
   connections_.clear();
+  for (const auto &p : spare_pipes_)
+  {
+    ::close(p.first);
+    ::close(p.second);
+  }
+  spare_pipes_.clear();
   ::close(epoll_fd_);
 
-  std::cout << "Server shutdown complete.\n";
+  LOG_INFO("[reactor {}] shutdown complete.", reactor_id_);
 }
+
 void Server::close_connection(int fd, const char *reason)
 {
-  auto it = connections_.find(fd);
-  if (it == connections_.end())
+  Connection *conn = connections_.find(fd);
+  if (!conn || conn->closing)
     return;
 
-  std::cerr << "[CLOSE] fd=" << fd;
-  if (reason)
-    std::cerr << " reason=" << reason;
-  std::cerr << "\n";
+  LOG_INFO("[CLOSE] fd={} reason={}", fd, reason ? reason : "none");
+
+  idle_timers_.cancel(conn->idle_timer);
+  throttle_timers_.cancel(conn->throttle_timer);
+  if (conn->ip)
+  {
+    conn->ip->connections--;
+    conn->ip = nullptr;
+  }
+  Metrics::add(metrics_.connections_closed);
+  Metrics::sub(metrics_.active_connections);
+  Metrics::sub(metrics_.buffer_bytes, conn->accounted);
+  conn->accounted = 0;
+  Metrics::sub(metrics_.subscriptions, conn->subscriptions.size());
+  topics_.remove(*conn);
+  conn->closing = true;
+  release_stream(*conn);
+
+  if (uring_)
+  {
+    // The fd stays open (and the entry alive) until the kernel has
+    // returned every operation that still references it.
+    uring_begin_close(*conn);
+    return;
+  }
 
-  close_connection(fd, "idle timeout");
+  remove_fd_from_epoll(fd);
+  ::close(fd);
+  connections_.retire(*conn);
 }
@@ -1,45 +1,389 @@
 #pragma once
+#include "command_router.h"
+#include "config.h"
 #include "connection.h"
+#include "connection_table.h"
+#include "io_ops.h"
+#include "kv_store.h"
+#include "logger.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "topology.h"
+#include "trace.h"
 #include <atomic>
 #include <cstdint>
-#include <unordered_map>
+#include <memory>
 #include <chrono>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
 
-struct Metrics
-{
-  uint64_t connections_accepted = 0;
-  uint64_t connections_closed = 0;
-  uint64_t bytes_read = 0;
-  uint64_t bytes_written = 0;
-  uint64_t frames_received = 0;
-};
+struct io_uring_cqe;
+class IoUring;
 
 class Server
 {
 public:
-  Server(int listen_fd, int max_connections);
+  Server(int listen_fd, const ServerConfig &cfg, int reactor_id = 0);
+  ~Server();
   void run();
+
+  // Async-signal-safe: flags the loop and wakes it through wake_fd_.
   void stop();
 
+  // Async-signal-safe. Stops accepting, answers what clients have already
+  // sent, half-closes each connection once its replies are flushed, and
+  // leaves the loop when all have closed or cfg.drain_timeout_ms passes.
+  void drain();
+
+  // Serves an already-connected stream socket (one end of a socketpair,
+  // say) as if it had been accepted. Before run() or on this reactor.
+  void adopt(int fd);
+
+  // Routes the epoll backend's socket syscalls through `ops` (io_ops.h),
+  // which must outlive the loop. Before run().
+  void set_io_ops(IoOps &ops) { io_ = &ops; }
+
+  // Samples frames into `ring` at cfg.trace_sample (trace.h); the ring
+  // must outlive the loop. Before run().
+  void set_trace(TraceRing *ring);
+
+  // "uring" or "epoll": the backend the loop runs on, which is epoll when
+  // io_uring was asked for but could not be set up. Safe to call from any
+  // thread once run() has started.
+  const char *backend_name() const
+  {
+    return on_uring_.load(std::memory_order_acquire) ? "uring" : "epoll";
+  }
+
+  // This reactor's counters; safe to call from any thread.
+  MetricsSnapshot metrics() const { return metrics_.snapshot(); }
+
+  // Registers every reactor of the process. Signals, SHUTDOWN and STATS
+  // fan out across this set. Must be called before any run().
+  static void install_reactors(const std::vector<Server *> &servers);
+  // Forgets them and closes the listener copies kept for a restart. After
+  // every loop has returned and before the Servers are destroyed.
+  static void uninstall_reactors();
+
+  // Every reactor's metrics in Prometheus text format; safe to call from
+  // any thread (MetricsExporter's render function).
+  static std::string prometheus_text();
+
+  // The command table (server_commands.cpp). Public so the benchmarks can
+  // time lookups against the real set of commands.
+  static const CommandRouter &command_router();
+
 private:
   void handle_accept();
-  void handle_client_read(int fd);
-  void handle_client_write(int fd);
-  void handle_message(Connection &conn, const std::vector<uint8_t> &msg);
-  void queue_frame(Connection &conn, const std::vector<uint8_t> &payload);
-  void on_frame_received(Connection &, const std::vector<uint8_t> &);
+  // At the connection limit the listener leaves the loop (epoll) or its
+  // multishot accept is cancelled (io_uring); housekeeping brings it back
+  // once a slot is free. Meanwhile new clients wait in the kernel backlog
+  // instead of each costing an accept and a close.
+  void pause_accept();
+  void resume_accept();
+  // EMFILE/ENFILE: frees reserve_fd_ just long enough to accept one
+  // pending client and close it, so the listener stops reporting it.
+  // false when no client was waiting.
+  bool shed_on_fd_exhaustion();
+  // Admission shared by both backends: the connection and per-IP limits,
+  // then a table entry. nullptr once the fd has been rejected and closed.
+  Connection *open_connection(int fd, uint32_t peer_addr);
+  void handle_client_read(Connection &conn);
+  // The frame handlers and handle_client_write() return false once they
+  // have closed the connection.
+  bool handle_client_write(Connection &conn);
+  bool handle_message(Connection &conn, ConstByteSpan msg);
+  // Replies to the frame being handled (conn.tag for v2).
+  bool queue_frame(Connection &conn, FrameRef payload);
+  bool queue_frame(Connection &conn, FrameRef payload, const FrameTag &tag);
+  bool on_frame_received(Connection &, ConstByteSpan frame);
+  bool process_frames(Connection &conn);
+  void arm_write(Connection &conn);
+  void flush_pending();
+  // Level-triggered: re-registers the interest the connection needs now.
+  // Edge-triggered: interest never changes; a connection the socket still
+  // allows to make progress goes on the ready list.
+  void update_interest(Connection &conn);
+  bool wants_read(const Connection &conn) const;
+  uint32_t client_events() const;
+  void defer(Connection &conn);
+  void run_ready();
   void close_connection(int fd, const char *reason);
 
-  void add_fd_to_epoll(int fd, uint32_t events);
-  void mod_fd_epoll(int fd, uint32_t events);
+  // Charges one frame of `bytes` to the connection's and its address's
+  // buckets. false if any is in debt: the connection is throttled and the
+  // frame stays buffered until resume_reading().
+  bool admit_frame(Connection &conn, size_t bytes);
+  void resume_reading(Connection &conn);
+  // Not reading: throttled, paused by the memory budget, replies backed
+  // up past WRITE_LOW_WATER, or a reply still streaming out.
+  static bool reading_paused(const Connection &conn);
+
+  // Memory budget. account() brings metrics_.buffer_bytes up to date with
+  // the connection's buffers. Under pressure, over_memory_share() pauses
+  // a connection holding more than its share; true if it did.
+  void account(Connection &conn);
+  bool over_memory_share(Connection &conn);
+  void check_memory_budget();
+  void touch(Connection &conn, Connection::Clock::time_point now);
+  void housekeeping();
+  void begin_drain(Connection::Clock::time_point now);
+  void drain_step(Connection::Clock::time_point now);
+  // SIGHUP, on the first reactor: hands the listeners to a new process
+  // (handoff.h) and drains once it is up.
+  void begin_restart(Connection::Clock::time_point now);
+  void poll_restart(Connection::Clock::time_point now);
+  void shutdown_connections();
+  void wake();
+
+  // Command handlers (server_commands.cpp), registered in
+  // command_router(). Each returns false once it has closed the connection.
+  bool cmd_ping(Connection &conn, std::string_view args);
+  bool cmd_echo(Connection &conn, std::string_view args);
+  bool cmd_stats(Connection &conn, std::string_view args);
+  bool cmd_close(Connection &conn, std::string_view args);
+  bool cmd_shutdown(Connection &conn, std::string_view args);
+  bool cmd_unknown(Connection &conn, std::string_view frame);
+  bool cmd_echo_stream(Connection &conn, std::string_view chunk);
+  bool cmd_blob(Connection &conn, std::string_view name);
+
+  // Large payloads (server_stream.cpp). Each returns false once it has
+  // closed the connection.
+  bool begin_stream(Connection &conn, ConstByteSpan head);
+  bool stream_chunk(Connection &conn, ConstByteSpan chunk);
+  // Queues the header of a `length`-byte reply whose payload follows.
+  void open_stream_reply(Connection &conn, uint32_t length);
+  bool close_stream_reply(Connection &conn);
+  bool stream_file(Connection &conn, int file_fd, uint64_t size);
+  // Continues a spliced or file-backed reply once the queue has drained;
+  // budget caps the bytes written this call.
+  bool stream_out(Connection &conn, size_t budget);
+  bool splice_relay(Connection &conn, size_t budget);
+  bool fill_from_file(Connection &conn);
+  bool finish_stream_out(Connection &conn);
+  void release_stream(Connection &conn);
+
+  // Key-value commands (server_kv.cpp). Every key belongs to one
+  // reactor's shard; keys owned elsewhere travel through the owner's
+  // mailbox and the reply fills a slot reserved in the caller's queue.
+  bool cmd_get(Connection &conn, std::string_view args);
+  bool cmd_set(Connection &conn, std::string_view args);
+  bool cmd_del(Connection &conn, std::string_view args);
+  bool cmd_mget(Connection &conn, std::string_view args);
+  bool cmd_expire(Connection &conn, std::string_view args);
+  enum class KvOp
+  {
+    GET,
+    SET,
+    DEL,
+    EXPIRE
+  };
+  Server &kv_shard(uint64_t hash);
+  FrameRef kv_execute(KvOp op, std::string_view key, std::string_view value,
+                      int64_t arg);
+  bool kv_command(Connection &conn, KvOp op, std::string_view key,
+                  std::string_view value, int64_t arg);
+
+  // Where a reply computed on another reactor goes. v1 replies fill a
+  // slot reserved in request order; v2 replies carry their request id
+  // and are queued whenever they arrive (slot 0).
+  struct ReplyAddress
+  {
+    int fd;
+    uint32_t generation;
+    uint64_t slot;
+    FrameTag tag;
+  };
+  // Reserves the reply's place. false (the connection closed) if its
+  // unsent replies, counting those still on their way, are already
+  // over WRITE_HIGH_WATER.
+  bool reply_address(Connection &conn, ReplyAddress &to);
+  void kv_deliver(const ReplyAddress &to, FrameRef reply);
+  struct KvRequest;
+  struct KvReply;
+  struct KvGather;
+  struct KvMgetPart;
+  struct KvMgetReply;
+
+  // Pub/sub (server_pubsub.cpp). A connection's subscriptions live in its
+  // own reactor's registry. A PUBLISH builds the message once; every
+  // subscriber queue, here and on the reactors it is posted to, shares
+  // that one buffer.
+  bool cmd_subscribe(Connection &conn, std::string_view topic);
+  bool cmd_unsubscribe(Connection &conn, std::string_view topic);
+  bool cmd_publish(Connection &conn, std::string_view args);
+  void fan_out(std::string_view topic, const FrameRef &message);
+  struct PubSubDelivery;
+
+  // Sampled tracing (server_trace.cpp). Every hook is behind trace_ or a
+  // connection's trace stage, which stays IDLE while tracing is off.
+  // trace_arm() picks the next connection to follow once a sample is due
+  // and its read buffer is empty, so the next read starts a frame.
+  void trace_arm(Connection &conn);
+  ssize_t trace_read(Connection &conn, iovec *iov, int cnt);
+  void trace_first_byte(Connection &conn, uint64_t kernel_ns, uint8_t flags);
+  void trace_complete(Connection &conn);
+  void trace_dispatched(Connection &conn, size_t bytes_in, size_t queued);
+  void trace_written(Connection &conn, size_t n);
+  void trace_emit(Connection &conn, uint64_t now);
+
+  // Cross-reactor tasks: post() is safe from any thread; run_mailbox()
+  // runs on this reactor when wake_fd_ fires.
+  void post(Server &to, ReactorTask *task);
+  void run_mailbox();
+
+  static MetricsSnapshot aggregate_metrics();
+  static size_t reactor_count();
+  static Server &reactor(size_t i);
+  // Pins this thread and sets its memory policy per cfg_, then
+  // reallocates the tables the constructor sized; first thing run()
+  // does, before the loop allocates anything.
+  void place();
+  // cpu_affinity/numa_policy and every placed reactor, for STATS.
+  static std::string describe_topology(const ServerConfig &cfg);
+  static void stop_all();
+  static void drain_all();
+  static void handle_signal(int sig);
+
+  // Connections are registered with data.ptr = &conn, so an event leads
+  // straight to its Connection without a table lookup.
+  void add_fd_to_epoll(Connection &conn, uint32_t events);
+  // Skips the syscall when the interest set is unchanged.
+  void mod_fd_epoll(Connection &conn, uint32_t events);
   void remove_fd_from_epoll(int fd);
 
+  // io_uring backend (server_uring.cpp). Same framing and commands; only
+  // the syscall layer differs.
+  bool uring_init();
+  void run_uring();
+  void uring_complete(const io_uring_cqe &cqe);
+  void uring_on_accept(const io_uring_cqe &cqe);
+  void uring_on_recv(Connection &conn, const io_uring_cqe &cqe);
+  void uring_on_send(Connection &conn, const io_uring_cqe &cqe);
+  void uring_arm_accept();
+  void uring_stop_accept();
+  void uring_arm_wake();
+  void uring_arm_recv(Connection &conn);
+  void uring_pause_recv(Connection &conn);
+  void uring_queue_send(Connection &conn);
+  void uring_submit_sends();
+  void uring_begin_close(Connection &conn);
+  void uring_reap(Connection &conn);
+
+  ServerConfig cfg_;
+  IoOps *io_ = &IoOps::system();
   int listen_fd_;
   int epoll_fd_;
-  std::unordered_map<int, Connection> connections_;
+  int wake_fd_;
+  int reserve_fd_; // /dev/null, given up to shed_on_fd_exhaustion()
+  bool accept_paused_ = false;
+  int uring_accepts_ = 0; // multishot accepts armed and not yet ended
+  // io_uring takes the descriptor before it looks at the queue, so with
+  // none left a rearmed accept fails at once; it is retried every
+  // ACCEPT_RETRY_MS instead.
+  bool accept_starved_ = false;
+  Connection::Clock::time_point accept_retry_at_{};
+  static constexpr int ACCEPT_RETRY_MS = 100;
+  Connection::Clock::time_point accept_warned_at_{};
+  Connection::Clock::time_point accept_rate_at_{};
+  uint64_t accepted_at_ = 0; // connections_accepted at accept_rate_at_
   std::atomic<bool> running_;
   int max_connections_;
+  int reactor_id_;
+  ConnectionTable connections_;
+
+  // Written once by place() on this reactor's thread, then published by
+  // placed_ to STATS on any other.
+  ReactorPlacement placement_;
+  std::atomic<bool> placed_{false};
+
+  static constexpr std::chrono::milliseconds IDLE_TICK{250};
+  static constexpr size_t IDLE_SLOTS = 256; // 64 s span > IDLE_TIMEOUT
+  TimerWheel idle_timers_;
+
+  // Rate limits for this reactor. The per-IP ones are the configured
+  // values divided by the reactor count, like max_connections_, so no
+  // state is shared between threads.
+  RateLimit conn_frames_;
+  RateLimit conn_bytes_;
+  RateLimit ip_frames_;
+  RateLimit ip_bytes_;
+  bool rate_limited_; // any of the four enabled
+  uint32_t max_connections_per_ip_; // 0 = unlimited
+  IpTable ip_table_;
+  static constexpr std::chrono::milliseconds THROTTLE_TICK{5};
+  static constexpr size_t THROTTLE_SLOTS = 256; // longer waits re-check
+  TimerWheel throttle_timers_;
+
+  // Connections with responses queued since the last flush. Written
+  // once per loop iteration, however many frames each one produced.
+  std::vector<Connection *> flush_pending_;
+
+  // Edge-triggered mode: connections that stopped at their I/O budget
+  // (or were unpaused) with the socket still readable or writable. Each
+  // gets one more budget per tick, after that tick's events, and the
+  // loop does not block while any are waiting.
+  std::vector<Connection *> ready_;
+  std::vector<Connection *> ready_now_;
+
+  std::unique_ptr<IoUring> uring_;
+  std::atomic<bool> on_uring_{false}; // for backend_name(); never cleared
+  uint32_t next_generation_ = 0;
+  static constexpr unsigned URING_ENTRIES = 1024;
+  static constexpr unsigned URING_BUFFERS = 256; // provided recv buffers
+  static constexpr int URING_SEND_IOV = 64;      // iovecs per sendmsg
+
+  // Key-value shard. Expired keys are also reclaimed in the background,
+  // KV_EXPIRE_BUDGET slots per loop iteration, at least every
+  // KV_EXPIRE_TICK while any key has a TTL.
+  KvStore kv_;
+
+  TraceRing *trace_ = nullptr;
+  uint32_t trace_countdown_ = 0; // frames until the next sample is due
+  bool trace_due_ = false;
+
+  TopicRegistry topics_;
+  std::string publish_scratch_; // message being built, capacity kept
+  std::vector<int> slow_subscribers_; // evicted after a fan-out
+  Mailbox mailbox_;
+  static constexpr size_t KV_EXPIRE_BUDGET = 128;
+  static constexpr int KV_EXPIRE_TICK_MS = 100;
+  int wait_timeout_ms();
+
+  // Graceful drain and restart hand-off. While either is in progress the
+  // loop wakes at least every DRAIN_TICK_MS to check on it.
+  std::atomic<bool> drain_requested_{false};
+  bool draining_ = false;
+  std::atomic<bool> drained_{false}; // no connections left
+  Connection::Clock::time_point drain_deadline_;
+  int handoff_channel_ = -1;
+  pid_t handoff_pid_ = -1;
+  Connection::Clock::time_point handoff_deadline_;
+  static constexpr int DRAIN_TICK_MS = 50;
+  static constexpr std::chrono::milliseconds DRAIN_QUIET{100};
+  static constexpr std::chrono::seconds HANDOFF_TIMEOUT{10};
+
+  // Streaming. Pipes of finished splice relays are kept for the next one.
+  int blob_dir_fd_ = -1;
+  std::vector<std::pair<int, int>> spare_pipes_;
+  static constexpr size_t SPARE_PIPES = 16;
+  static constexpr size_t FILE_CHUNK = 64 * 1024; // copied file reads
+  static constexpr size_t STREAM_BUDGET = 256 * 1024; // spliced per read event
+
+  // Memory budget for this reactor (cfg.memory_budget_mb split evenly;
+  // 0 = off). Pressure starts at MEMORY_HIGH_PCT of it and ends at
+  // MEMORY_LOW_PCT; in between, connections holding more than
+  // heavy_bytes_ are not read. Over the full budget, the largest are shed.
+  size_t memory_budget_;
+  bool memory_pressured_ = false;
+  size_t heavy_bytes_ = 0;
+  static constexpr size_t MEMORY_HIGH_PCT = 90;
+  static constexpr size_t MEMORY_LOW_PCT = 70;
+  static constexpr size_t MIN_HEAVY_BYTES = 64 * 1024;
 
   static constexpr std::chrono::seconds IDLE_TIMEOUT{30};
+  static constexpr size_t READ_CHUNK = 16 * 1024; // min free space per read
   Metrics metrics_;
 };
@@ -0,0 +1,171 @@
+// Text command handlers. A new command is a handler plus one add() line
+// in command_router(); the framing and event loops never change.
+
+#include "server.h"
+#include "socket_utils.h"
+#include <climits>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Fixed replies are shared by every connection and never freed.
+static FrameBuffer RESP_PONG("PONG");
+static FrameBuffer RESP_OK("OK");
+static FrameBuffer RESP_UNKNOWN("ERR unknown command");
+static FrameBuffer RESP_NO_BLOBS("ERR blobs disabled");
+static FrameBuffer RESP_NO_BLOB("ERR no such blob");
+
+const CommandRouter &Server::command_router()
+{
+  // Built on first use and read-only afterwards, so every reactor shares
+  // it without locking.
+  static const CommandRouter router = [] {
+    using Args = CommandRouter::Args;
+    CommandRouter r;
+    r.add("PING", Opcode::PING, &Server::cmd_ping);
+    r.add("ECHO", Opcode::ECHO, &Server::cmd_echo, Args::REQUIRED,
+          &Server::cmd_echo_stream);
+    r.add("STATS", Opcode::STATS, &Server::cmd_stats);
+    r.add("CLOSE", Opcode::CLOSE, &Server::cmd_close);
+    r.add("SHUTDOWN", Opcode::SHUTDOWN, &Server::cmd_shutdown);
+    r.add("GET", Opcode::GET, &Server::cmd_get, Args::REQUIRED);
+    r.add("SET", Opcode::SET, &Server::cmd_set, Args::REQUIRED);
+    r.add("DEL", Opcode::DEL, &Server::cmd_del, Args::REQUIRED);
+    r.add("MGET", Opcode::MGET, &Server::cmd_mget, Args::REQUIRED);
+    r.add("EXPIRE", Opcode::EXPIRE, &Server::cmd_expire, Args::REQUIRED);
+    r.add("BLOB", Opcode::BLOB, &Server::cmd_blob, Args::REQUIRED);
+    r.add("SUBSCRIBE", Opcode::SUBSCRIBE, &Server::cmd_subscribe,
+          Args::REQUIRED);
+    r.add("UNSUBSCRIBE", Opcode::UNSUBSCRIBE, &Server::cmd_unsubscribe,
+          Args::REQUIRED);
+    r.add("PUBLISH", Opcode::PUBLISH, &Server::cmd_publish, Args::REQUIRED);
+    r.set_fallback(&Server::cmd_unknown);
+    return r;
+  }();
+  return router;
+}
+
+bool Server::cmd_ping(Connection &conn, std::string_view)
+{
+  return queue_frame(conn, FrameRef::share(RESP_PONG));
+}
+
+bool Server::cmd_echo(Connection &conn, std::string_view args)
+{
+  // args points into read_buffer, which is recycled: this is the one copy.
+  return queue_frame(conn, FrameRef(FrameBuffer::copy_of(
+                               {reinterpret_cast<const uint8_t *>(args.data()),
+                                args.size()})));
+}
+
+bool Server::cmd_echo_stream(Connection &conn, std::string_view chunk)
+{
+  // The reply is the body verbatim, so its length is known from the first
+  // piece on; the rest may bypass this handler (splice_relay). Unlike a
+  // buffered ECHO, trailing whitespace is kept: the length is already
+  // sent when the last piece shows it (README, Large Payloads).
+  Connection::Stream &s = conn.stream;
+  if (s.body_left == s.body_total)
+  {
+    open_stream_reply(conn, static_cast<uint32_t>(s.body_total));
+    s.relay = true;
+  }
+
+  conn.write_queue.push_raw(FrameRef(FrameBuffer::copy_of(
+      {reinterpret_cast<const uint8_t *>(chunk.data()), chunk.size()})));
+  arm_write(conn);
+
+  if (chunk.size() == s.body_left)
+    return close_stream_reply(conn);
+  return true;
+}
+
+bool Server::cmd_blob(Connection &conn, std::string_view name)
+{
+  if (blob_dir_fd_ < 0)
+    return queue_frame(conn, FrameRef::share(RESP_NO_BLOBS));
+
+  // A plain file directly inside blob_dir: no paths, no dot files.
+  if (name.empty() || name.size() > NAME_MAX || name.front() == '.' ||
+      name.find('/') != std::string_view::npos ||
+      name.find('\0') != std::string_view::npos)
+    return queue_frame(conn, FrameRef::share(RESP_NO_BLOB));
+
+  const std::string file(name);
+  int fd = ::openat(blob_dir_fd_, file.c_str(),
+                    O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      static_cast<uint64_t>(st.st_size) > UINT32_MAX)
+  {
+    if (fd >= 0)
+      ::close(fd);
+    return queue_frame(conn, FrameRef::share(RESP_NO_BLOB));
+  }
+
+  // Streamed: the reply may be far larger than WRITE_HIGH_WATER.
+  return stream_file(conn, fd, static_cast<uint64_t>(st.st_size));
+}
+
+bool Server::cmd_stats(Connection &conn, std::string_view)
+{
+  const MetricsSnapshot m = aggregate_metrics();
+  std::string out;
+  out += "connections=" + std::to_string(m.active_connections) + "\n";
+  out += "accepted=" + std::to_string(m.connections_accepted) + "\n";
+  out += "closed=" + std::to_string(m.connections_closed) + "\n";
+  out += "rejected=" + std::to_string(m.connections_rejected) + "\n";
+  out += "accept_rate=" + std::to_string(m.accept_rate) + "\n";
+  out += "accept_paused=" + std::to_string(m.accept_paused) + "\n";
+  out += "accept_pauses=" + std::to_string(m.accept_pauses) + "\n";
+  out += "accept_fd_exhausted=" + std::to_string(m.accept_fd_exhausted) +
+         "\n";
+  out += "throttled=" + std::to_string(m.throttle_events) + "\n";
+  out += "frames=" + std::to_string(m.frames_received) + "\n";
+  out += "bytes_read=" + std::to_string(m.bytes_read) + "\n";
+  out += "bytes_written=" + std::to_string(m.bytes_written) + "\n";
+  out += "zero_copy_bytes=" + std::to_string(m.zero_copy_bytes) + "\n";
+  out += "buffer_bytes=" + std::to_string(m.buffer_bytes) + "\n";
+  out += "memory_budget=" +
+         std::to_string(static_cast<uint64_t>(cfg_.memory_budget_mb) * 1024 *
+                        1024) +
+         "\n";
+  out += "memory_pressured=" + std::to_string(m.memory_pressured) + "\n";
+  out += "shed=" + std::to_string(m.connections_shed) + "\n";
+  out += "io_deferred=" + std::to_string(m.io_deferred) + "\n";
+  out += "subscriptions=" + std::to_string(m.subscriptions) + "\n";
+  out += "published=" + std::to_string(m.messages_published) + "\n";
+  out += "delivered=" + std::to_string(m.messages_delivered) + "\n";
+  out += "msg_dropped=" + std::to_string(m.messages_dropped) + "\n";
+  out += "slow_evicted=" + std::to_string(m.subscribers_evicted) + "\n";
+  out += "traced=" + std::to_string(m.frames_traced) + "\n";
+  out += "log_dropped=" + std::to_string(Logger::dropped()) + "\n";
+  out += "service_p50_ns=" + std::to_string(m.service_ns.percentile(50)) + "\n";
+  out += "service_p99_ns=" + std::to_string(m.service_ns.percentile(99)) + "\n";
+  out += describe_socket_tuning(listen_fd_, conn.fd, cfg_.sock);
+  out += describe_topology(cfg_);
+  out += "reactors=" + std::to_string(reactor_count());
+
+  return queue_frame(conn, FrameRef(FrameBuffer::adopt(std::move(out))));
+}
+
+bool Server::cmd_close(Connection &conn, std::string_view)
+{
+  // The reply is flushed, then the client closes.
+  return queue_frame(conn, FrameRef::share(RESP_OK));
+}
+
+bool Server::cmd_shutdown(Connection &conn, std::string_view)
+{
+  bool alive = queue_frame(conn, FrameRef::share(RESP_OK));
+
+  LOG_INFO("[CONTROL] shutdown requested");
+  drain_all(); // every reactor stops accepting and drains its clients
+  return alive;
+}
+
+bool Server::cmd_unknown(Connection &conn, std::string_view)
+{
+  return queue_frame(conn, FrameRef::share(RESP_UNKNOWN));
+}
@@ -0,0 +1,343 @@
+// Key-value commands. Each reactor owns the shard for the keys whose hash
+// maps to it (kv_shard()), and only that reactor touches it, so the store
+// needs no locks. A command for a key owned elsewhere is posted to the
+// owner's mailbox and the owner posts the reply back. For a v1 client a
+// slot reserved in the connection's queue keeps pipelined responses in
+// request order; a v2 reply carries its request id and is sent as soon as
+// it returns.
+
+#include "server.h"
+#include <charconv>
+#include <climits>
+#include <memory>
+#include <string>
+#include <vector>
+
+static FrameBuffer RESP_KV_OK("OK");
+static FrameBuffer RESP_NIL("NIL");
+static FrameBuffer RESP_ONE(":1");
+static FrameBuffer RESP_ZERO(":0");
+static FrameBuffer RESP_SYNTAX("ERR syntax");
+static FrameBuffer RESP_KEY_TOO_LONG("ERR key too long");
+
+// Splits off the first space-separated word of args.
+static std::string_view next_word(std::string_view &args)
+{
+  size_t space = args.find(' ');
+  std::string_view word = args.substr(0, space);
+  args = space == std::string_view::npos ? std::string_view()
+                                         : args.substr(space + 1);
+  return word;
+}
+
+static FrameRef bad_key(std::string_view key)
+{
+  return FrameRef::share(key.size() > KvStore::MAX_KEY ? RESP_KEY_TOO_LONG
+                                                      : RESP_SYNTAX);
+}
+
+static bool valid_key(std::string_view key)
+{
+  return !key.empty() && key.size() <= KvStore::MAX_KEY &&
+         key.find(' ') == std::string_view::npos;
+}
+
+// MGET reply entry: "$<len>\n<bytes>\n", or "$-1\n" for a missing key.
+static void append_entry(std::string &out, const KvItem *item)
+{
+  if (!item)
+  {
+    out += "$-1\n";
+    return;
+  }
+  std::string_view v = item->value();
+  out += '$';
+  out += std::to_string(v.size());
+  out += '\n';
+  out.append(v.data(), v.size());
+  out += '\n';
+}
+
+// ---------- cross-reactor tasks ----------
+
+// Runs on the owning reactor, then sends the reply home.
+struct Server::KvRequest : ReactorTask
+{
+  KvOp op;
+  std::string key;
+  std::string value;
+  int64_t arg = 0;
+  Server *home;
+  ReplyAddress to;
+
+  void run(Server &owner) override;
+};
+
+// Runs on the home reactor.
+struct Server::KvReply : ReactorTask
+{
+  ReplyAddress to;
+  FrameRef reply;
+
+  void run(Server &home) override { home.kv_deliver(to, std::move(reply)); }
+};
+
+void Server::KvRequest::run(Server &owner)
+{
+  KvReply *r = new KvReply;
+  r->to = to;
+  r->reply = owner.kv_execute(op, key, value, arg);
+  owner.post(*home, r);
+}
+
+// One MGET spread over several shards. Owned by the home reactor and
+// only touched there; the shared_ptr just keeps it alive until the last
+// part has come back (or been dropped at shutdown).
+struct Server::KvGather
+{
+  std::vector<std::string> entries; // encoded, in request order
+  size_t remaining = 0;             // parts still out
+  ReplyAddress to;
+};
+
+struct Server::KvMgetReply : ReactorTask
+{
+  std::shared_ptr<KvGather> gather;
+  std::vector<size_t> index;
+  std::vector<std::string> entries;
+
+  void run(Server &home) override
+  {
+    KvGather &g = *gather;
+    for (size_t i = 0; i < index.size(); ++i)
+      g.entries[index[i]] = std::move(entries[i]);
+    if (--g.remaining > 0)
+      return;
+
+    std::string out = "*" + std::to_string(g.entries.size()) + "\n";
+    for (const std::string &e : g.entries)
+      out += e;
+    home.kv_deliver(g.to, FrameRef(FrameBuffer::adopt(std::move(out))));
+  }
+};
+
+// The keys of one MGET that a single other reactor owns.
+struct Server::KvMgetPart : ReactorTask
+{
+  std::shared_ptr<KvGather> gather;
+  std::vector<size_t> index;
+  std::vector<std::string> keys;
+  Server *home;
+
+  void run(Server &owner) override
+  {
+    const int64_t now = KvStore::now_ms();
+    KvMgetReply *r = new KvMgetReply;
+    r->gather = std::move(gather);
+    r->index = std::move(index);
+    r->entries.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+      append_entry(r->entries[i],
+                   owner.kv_.get(keys[i], KvStore::hash(keys[i]), now));
+    owner.post(*home, r);
+  }
+};
+
+// ---------- shard access ----------
+
+FrameRef Server::kv_execute(KvOp op, std::string_view key,
+                            std::string_view value, int64_t arg)
+{
+  const uint64_t h = KvStore::hash(key);
+  const int64_t now = KvStore::now_ms();
+
+  switch (op)
+  {
+  case KvOp::GET:
+  {
+    const KvItem *item = kv_.get(key, h, now);
+    if (!item)
+      return FrameRef::share(RESP_NIL);
+    std::string out;
+    out.reserve(4 + item->value_len);
+    out += "VAL ";
+    out += item->value();
+    return FrameRef(FrameBuffer::adopt(std::move(out)));
+  }
+  case KvOp::SET:
+    kv_.set(key, h, value);
+    return FrameRef::share(RESP_KV_OK);
+  case KvOp::DEL:
+    return FrameRef::share(kv_.del(key, h, now) ? RESP_ONE : RESP_ZERO);
+  case KvOp::EXPIRE:
+    return FrameRef::share(kv_.expire(key, h, now + arg * 1000, now) ? RESP_ONE
+                                                                     : RESP_ZERO);
+  }
+  return FrameRef::share(RESP_SYNTAX);
+}
+
+bool Server::reply_address(Connection &conn, ReplyAddress &to)
+{
+  // An open slot counts as the smallest frame it can become, so a client
+  // pipelining remote requests without reading hits the mark just as it
+  // would with local ones.
+  const size_t pending = (conn.write_queue.open_slots() + 1) * sizeof(uint32_t);
+  if (conn.unsent_bytes() + pending > Connection::WRITE_HIGH_WATER)
+  {
+    close_connection(conn.fd, "write buffer overflow");
+    return false;
+  }
+
+  const bool ordered = conn.protocol != Connection::Protocol::V2;
+  to = {conn.fd, conn.generation,
+        ordered ? conn.write_queue.reserve_slot() : 0, conn.tag};
+  return true;
+}
+
+void Server::kv_deliver(const ReplyAddress &to, FrameRef reply)
+{
+  // The client may have gone, and its fd been reused, while the request
+  // was away.
+  Connection *conn = connections_.find(to.fd);
+  if (!conn || conn->closing || conn->generation != to.generation)
+    return;
+
+  if (to.slot == 0)
+  {
+    queue_frame(*conn, std::move(reply), to.tag);
+    return;
+  }
+  if (!conn->write_queue.fill_slot(to.slot, std::move(reply)))
+    return;
+  // The slot was reserved before the reply's size was known.
+  if (conn->unsent_bytes() > Connection::WRITE_HIGH_WATER)
+  {
+    close_connection(to.fd, "write buffer overflow");
+    return;
+  }
+  arm_write(*conn);
+}
+
+bool Server::kv_command(Connection &conn, KvOp op, std::string_view key,
+                        std::string_view value, int64_t arg)
+{
+  if (!valid_key(key))
+    return queue_frame(conn, bad_key(key));
+
+  Server &owner = kv_shard(KvStore::hash(key));
+  if (&owner == this)
+    return queue_frame(conn, kv_execute(op, key, value, arg));
+
+  ReplyAddress to;
+  if (!reply_address(conn, to))
+    return false;
+  KvRequest *req = new KvRequest;
+  req->op = op;
+  req->key.assign(key.data(), key.size());
+  req->value.assign(value.data(), value.size());
+  req->arg = arg;
+  req->home = this;
+  req->to = to;
+  post(owner, req);
+  return true;
+}
+
+// ---------- commands ----------
+
+bool Server::cmd_get(Connection &conn, std::string_view args)
+{
+  return kv_command(conn, KvOp::GET, args, {}, 0);
+}
+
+bool Server::cmd_set(Connection &conn, std::string_view args)
+{
+  // SET <key> <value>; the value runs to the end of the frame and may
+  // contain spaces.
+  size_t space = args.find(' ');
+  if (space == std::string_view::npos)
+    return queue_frame(conn, FrameRef::share(RESP_SYNTAX));
+  return kv_command(conn, KvOp::SET, args.substr(0, space),
+                    args.substr(space + 1), 0);
+}
+
+bool Server::cmd_del(Connection &conn, std::string_view args)
+{
+  return kv_command(conn, KvOp::DEL, args, {}, 0);
+}
+
+bool Server::cmd_expire(Connection &conn, std::string_view args)
+{
+  // EXPIRE <key> <seconds>; zero or negative deletes the key.
+  std::string_view key = next_word(args);
+  int64_t seconds = 0;
+  auto [end, ec] = std::from_chars(args.data(), args.data() + args.size(),
+                                   seconds);
+  if (args.empty() || ec != std::errc() || end != args.data() + args.size() ||
+      seconds > INT32_MAX || seconds < INT32_MIN)
+    return queue_frame(conn, FrameRef::share(RESP_SYNTAX));
+  return kv_command(conn, KvOp::EXPIRE, key, {}, seconds);
+}
+
+bool Server::cmd_mget(Connection &conn, std::string_view args)
+{
+  std::vector<std::string_view> keys;
+  while (!args.empty())
+  {
+    std::string_view key = next_word(args);
+    if (key.empty())
+      continue;
+    if (!valid_key(key))
+      return queue_frame(conn, bad_key(key));
+    keys.push_back(key);
+  }
+
+  const int64_t now = KvStore::now_ms();
+  auto gather = std::make_shared<KvGather>();
+  gather->entries.resize(keys.size());
+
+  // Local keys are answered now; the rest are grouped by owner so each
+  // remote reactor receives one task for this command.
+  std::vector<std::pair<Server *, KvMgetPart *>> parts;
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    const uint64_t h = KvStore::hash(keys[i]);
+    Server &owner = kv_shard(h);
+    if (&owner == this)
+    {
+      append_entry(gather->entries[i], kv_.get(keys[i], h, now));
+      continue;
+    }
+
+    KvMgetPart *part = nullptr;
+    for (auto &p : parts)
+      part = p.first == &owner ? p.second : part;
+    if (!part)
+    {
+      part = new KvMgetPart;
+      part->gather = gather;
+      part->home = this;
+      parts.emplace_back(&owner, part);
+    }
+    part->index.push_back(i);
+    part->keys.emplace_back(keys[i]);
+  }
+
+  if (parts.empty())
+  {
+    std::string out = "*" + std::to_string(keys.size()) + "\n";
+    for (const std::string &e : gather->entries)
+      out += e;
+    return queue_frame(conn, FrameRef(FrameBuffer::adopt(std::move(out))));
+  }
+
+  gather->remaining = parts.size();
+  if (!reply_address(conn, gather->to))
+  {
+    for (auto &p : parts)
+      delete p.second;
+    return false;
+  }
+  for (auto &p : parts)
+    post(*p.first, p.second);
+  return true;
+}
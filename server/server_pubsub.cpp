@@ -0,0 +1,154 @@
+// Publish/subscribe. SUBSCRIBE and UNSUBSCRIBE change the registry of the
+// reactor that owns the connection. PUBLISH builds "MESSAGE <topic>
+// <msg>" once, in a single allocation, and pushes a reference to that
+// buffer onto every subscriber's output queue: local subscribers
+// directly, those of other reactors through one mailbox task per
+// reactor that has any subscriptions at all. The payload is never
+// copied per subscriber; writev() gathers the shared bytes behind each
+// connection's own header.
+//
+// A subscriber whose unsent bytes would pass WRITE_HIGH_WATER is slow:
+// it misses the message (DROP) or is closed (DISCONNECT), per
+// cfg.slow_subscriber. Either way one slow reader cannot make the
+// others' messages wait or grow without bound.
+
+#include "server.h"
+#include <string>
+
+static FrameBuffer RESP_PUB_OK("OK");
+static FrameBuffer RESP_ADDED(":1");
+static FrameBuffer RESP_UNCHANGED(":0");
+static FrameBuffer RESP_BAD_TOPIC("ERR syntax");
+static FrameBuffer RESP_TOPIC_TOO_LONG("ERR topic too long");
+static FrameBuffer RESP_TOO_MANY("ERR too many subscriptions");
+
+static FrameRef check_topic(std::string_view topic)
+{
+  if (topic.size() > TopicRegistry::MAX_TOPIC)
+    return FrameRef::share(RESP_TOPIC_TOO_LONG);
+  if (topic.empty() || topic.find(' ') != std::string_view::npos)
+    return FrameRef::share(RESP_BAD_TOPIC);
+  return FrameRef();
+}
+
+// Runs on a reactor with subscribers; the message is already built.
+struct Server::PubSubDelivery : ReactorTask
+{
+  std::string topic;
+  FrameRef message;
+
+  void run(Server &server) override { server.fan_out(topic, message); }
+};
+
+void Server::fan_out(std::string_view topic, const FrameRef &message)
+{
+  Topic *t = topics_.find(topic);
+  if (!t)
+    return;
+
+  const FrameTag tag{static_cast<uint8_t>(Opcode::MESSAGE), 0};
+  const size_t wire = V2Header::SIZE + message.bytes().size;
+  const bool evict =
+      cfg_.slow_subscriber == ServerConfig::SlowSubscriber::DISCONNECT;
+  uint64_t delivered = 0;
+  uint64_t dropped = 0;
+
+  for (Connection *conn : t->subscribers)
+  {
+    if (conn->unsent_bytes() + wire > Connection::WRITE_HIGH_WATER)
+    {
+      // Closing would reorder t->subscribers under us; done below.
+      if (evict)
+        slow_subscribers_.push_back(conn->fd);
+      ++dropped;
+      continue;
+    }
+    queue_frame(*conn, message, tag);
+    ++delivered;
+  }
+
+  Metrics::add(metrics_.messages_delivered, delivered);
+  if (evict)
+  {
+    for (int fd : slow_subscribers_)
+    {
+      Metrics::add(metrics_.subscribers_evicted);
+      close_connection(fd, "slow subscriber");
+    }
+    slow_subscribers_.clear();
+  }
+  else
+  {
+    Metrics::add(metrics_.messages_dropped, dropped);
+  }
+}
+
+// ---------- commands ----------
+
+bool Server::cmd_subscribe(Connection &conn, std::string_view topic)
+{
+  if (FrameRef err = check_topic(topic))
+    return queue_frame(conn, std::move(err));
+
+  switch (topics_.subscribe(conn, topic))
+  {
+  case TopicRegistry::Result::OK:
+    Metrics::add(metrics_.subscriptions);
+    return queue_frame(conn, FrameRef::share(RESP_ADDED));
+  case TopicRegistry::Result::ALREADY:
+    return queue_frame(conn, FrameRef::share(RESP_UNCHANGED));
+  case TopicRegistry::Result::LIMIT:
+    break;
+  }
+  return queue_frame(conn, FrameRef::share(RESP_TOO_MANY));
+}
+
+bool Server::cmd_unsubscribe(Connection &conn, std::string_view topic)
+{
+  if (FrameRef err = check_topic(topic))
+    return queue_frame(conn, std::move(err));
+
+  if (topics_.unsubscribe(conn, topic) != TopicRegistry::Result::OK)
+    return queue_frame(conn, FrameRef::share(RESP_UNCHANGED));
+  Metrics::sub(metrics_.subscriptions);
+  return queue_frame(conn, FrameRef::share(RESP_ADDED));
+}
+
+bool Server::cmd_publish(Connection &conn, std::string_view args)
+{
+  // PUBLISH <topic> <message>; the message runs to the end of the frame
+  // and may contain spaces (or, over v2, any bytes).
+  const size_t space = args.find(' ');
+  const std::string_view topic = args.substr(0, space);
+  if (FrameRef err = check_topic(topic))
+    return queue_frame(conn, std::move(err));
+  if (space == std::string_view::npos)
+    return queue_frame(conn, FrameRef::share(RESP_BAD_TOPIC));
+
+  publish_scratch_.assign("MESSAGE ");
+  publish_scratch_.append(args.data(), args.size());
+  const FrameRef message(FrameBuffer::copy_of(
+      {reinterpret_cast<const uint8_t *>(publish_scratch_.data()),
+       publish_scratch_.size()}));
+  Metrics::add(metrics_.messages_published);
+
+  // Acknowledged first, so a publisher subscribed to its own topic reads
+  // OK before the MESSAGE.
+  if (!queue_frame(conn, FrameRef::share(RESP_PUB_OK)))
+    return false;
+
+  for (size_t i = 0; i < reactor_count(); ++i)
+  {
+    Server &other = reactor(i);
+    if (&other == this || other.topics_.subscriptions() == 0)
+      continue;
+    PubSubDelivery *task = new PubSubDelivery;
+    task->topic.assign(topic.data(), topic.size());
+    task->message = message;
+    post(other, task);
+  }
+  fan_out(topic, message);
+
+  // The publisher may itself have been a slow subscriber.
+  return !conn.closing;
+}
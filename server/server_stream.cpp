@@ -0,0 +1,340 @@
+// Large payloads. A frame over Connection::STREAM_THRESHOLD whose command
+// can stream is handed to it in pieces as it arrives, so memory per
+// connection stays at a read's worth whatever the frame size. Replies
+// too large to queue whole go out the same way: a relayed body is spliced
+// from the socket through a pipe and back, a file with sendfile(), and
+// neither passes through user space. With the io_uring backend, or with
+// --zero-copy 0, both fall back to pieces copied through the queue.
+
+#include "server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+bool Server::begin_stream(Connection &conn, ConstByteSpan head)
+{
+  const bool v2 = conn.protocol == Connection::Protocol::V2;
+  const std::string_view text(reinterpret_cast<const char *>(head.data),
+                              head.size);
+  const CommandRouter::Match m =
+      v2 ? command_router().route(conn.tag.opcode, text)
+         : command_router().route(text);
+
+  if (!m.stream)
+  {
+    if (conn.expected_len > Connection::MAX_FRAME)
+    {
+      LOG_WARN("Protocol violation fd={} len={}", conn.fd, conn.expected_len);
+      close_connection(conn.fd, "protocol violation");
+      return false;
+    }
+    // Buffered, then routed again in full like any other frame.
+    conn.buffer_whole = true;
+    return true;
+  }
+
+  if (rate_limited_ && !admit_frame(conn, conn.expected_len))
+    return true;
+
+  Metrics::add(metrics_.frames_received);
+  // A v1 body starts after "NAME "; a v2 payload is all body.
+  const size_t skip =
+      v2 ? 0 : static_cast<size_t>(m.args.data() - text.data());
+  conn.begin_stream(m.stream, skip);
+  return true;
+}
+
+bool Server::stream_chunk(Connection &conn, ConstByteSpan chunk)
+{
+  Metrics::add(metrics_.bytes_read, chunk.size);
+
+  Connection::Stream &s = conn.stream;
+  const std::string_view text(reinterpret_cast<const char *>(chunk.data),
+                              chunk.size);
+  if (!(this->*s.handler)(conn, text))
+    return false;
+  conn.finish_chunk(chunk.size);
+
+  // The reply repeats the body and nothing of it is buffered: the rest
+  // can go socket to socket. splice_relay() takes over from the next read.
+  if (!s.relay || s.body_left == 0 || !conn.read_buffer.empty() ||
+      !cfg_.zero_copy || uring_)
+    return true;
+
+  if (spare_pipes_.empty())
+  {
+    int p[2];
+    if (::pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+      std::perror("pipe2"); // keeps copying
+      return true;
+    }
+    spare_pipes_.emplace_back(p[0], p[1]);
+  }
+  s.pipe_rd = spare_pipes_.back().first;
+  s.pipe_wr = spare_pipes_.back().second;
+  s.in_pipe = 0;
+  spare_pipes_.pop_back();
+  return true;
+}
+
+void Server::open_stream_reply(Connection &conn, uint32_t length)
+{
+  if (conn.protocol == Connection::Protocol::V2)
+    conn.write_queue.push_header(length, conn.tag);
+  else
+    conn.write_queue.push_header(length);
+  conn.stream.reply_open = true;
+  arm_write(conn);
+}
+
+bool Server::close_stream_reply(Connection &conn)
+{
+  Connection::Stream &s = conn.stream;
+  if (!s.reply_open)
+    return true;
+  s.reply_open = false;
+  s.relay = false;
+  s.deferred_bytes = 0; // counted again as they are queued
+
+  for (auto &held : s.deferred)
+  {
+    if (!queue_frame(conn, std::move(held.first), held.second))
+      return false;
+  }
+  s.deferred.clear();
+  return true;
+}
+
+bool Server::stream_file(Connection &conn, int file_fd, uint64_t size)
+{
+  open_stream_reply(conn, static_cast<uint32_t>(size));
+  if (size == 0)
+  {
+    ::close(file_fd);
+    return close_stream_reply(conn);
+  }
+
+  Connection::Stream &s = conn.stream;
+  s.file_fd = file_fd;
+  s.file_offset = 0;
+  s.file_left = size;
+
+  // sendfile() waits for the queue to drain (stream_out); copies are
+  // queued behind the header now.
+  if (uring_ || !cfg_.zero_copy)
+    return fill_from_file(conn);
+  return true;
+}
+
+bool Server::fill_from_file(Connection &conn)
+{
+  Connection::Stream &s = conn.stream;
+  while (s.file_left > 0 &&
+         conn.write_queue.size() < Connection::WRITE_LOW_WATER)
+  {
+    std::string piece;
+    piece.resize(static_cast<size_t>(std::min<uint64_t>(s.file_left, FILE_CHUNK)));
+    ssize_t n = ::pread(s.file_fd, &piece[0], piece.size(), s.file_offset);
+    if (n <= 0)
+    {
+      if (n < 0)
+        std::perror("pread");
+      close_connection(conn.fd, "blob read error");
+      return false;
+    }
+    piece.resize(static_cast<size_t>(n));
+    s.file_offset += n;
+    s.file_left -= static_cast<uint64_t>(n);
+    conn.write_queue.push_raw(FrameRef(FrameBuffer::adopt(std::move(piece))));
+  }
+  arm_write(conn);
+
+  if (s.file_left > 0)
+    return true;
+  release_stream(conn);
+  return close_stream_reply(conn);
+}
+
+bool Server::stream_out(Connection &conn, size_t budget)
+{
+  Connection::Stream &s = conn.stream;
+  if (s.pipe_rd >= 0)
+    return splice_relay(conn, budget);
+
+  if (!cfg_.zero_copy)
+  {
+    if (!fill_from_file(conn))
+      return false;
+    if (!conn.streaming_out())
+      return finish_stream_out(conn);
+    update_interest(conn);
+    return true;
+  }
+
+  while (s.file_left > 0 && budget > 0)
+  {
+    ssize_t n = ::sendfile(conn.fd, s.file_fd, &s.file_offset,
+                           static_cast<size_t>(std::min<uint64_t>(s.file_left, budget)));
+    if (n > 0)
+    {
+      touch(conn, Connection::Clock::now());
+      s.file_left -= static_cast<uint64_t>(n);
+      budget -= static_cast<size_t>(n);
+      Metrics::add(metrics_.bytes_written, static_cast<uint64_t>(n));
+      Metrics::add(metrics_.zero_copy_bytes, static_cast<uint64_t>(n));
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      conn.write_ready = false;
+      break;
+    }
+
+    if (n < 0)
+      std::perror("sendfile");
+    // n == 0: the file shrank under us; the header promised more.
+    close_connection(conn.fd, "sendfile error");
+    return false;
+  }
+
+  if (s.file_left == 0)
+    return finish_stream_out(conn);
+
+  // Socket full or budget spent: carry on at the next EPOLLOUT.
+  conn.write_blocked = true;
+  update_interest(conn);
+  return true;
+}
+
+bool Server::splice_relay(Connection &conn, size_t budget)
+{
+  Connection::Stream &s = conn.stream;
+  const int fd = conn.fd;
+  bool progress = true;
+
+  while (progress && budget > 0)
+  {
+    progress = false;
+
+    if (s.body_left > 0)
+    {
+      ssize_t n = ::splice(fd, nullptr, s.pipe_wr, nullptr,
+                           static_cast<size_t>(s.body_left),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0)
+      {
+        touch(conn, Connection::Clock::now());
+        conn.body_consumed(static_cast<size_t>(n));
+        s.in_pipe += static_cast<size_t>(n);
+        Metrics::add(metrics_.bytes_read, static_cast<uint64_t>(n));
+        progress = true;
+      }
+      else if (n == 0)
+      {
+        close_connection(fd, "client FIN");
+        return false;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        // With bytes in the pipe it may be the pipe that is full.
+        if (s.in_pipe == 0)
+          conn.read_ready = false;
+      }
+      else
+      {
+        std::perror("splice");
+        close_connection(fd, "read error");
+        return false;
+      }
+    }
+
+    // Behind whatever is still queued ahead of the body.
+    if (s.in_pipe > 0 && conn.write_queue.empty())
+    {
+      ssize_t n = ::splice(s.pipe_rd, nullptr, fd, nullptr,
+                           std::min(s.in_pipe, budget),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0)
+      {
+        s.in_pipe -= static_cast<size_t>(n);
+        budget -= static_cast<size_t>(n);
+        Metrics::add(metrics_.bytes_written, static_cast<uint64_t>(n));
+        Metrics::add(metrics_.zero_copy_bytes, static_cast<uint64_t>(n));
+        conn.write_blocked = false;
+        progress = true;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        conn.write_blocked = true;
+        conn.write_ready = false;
+      }
+      else
+      {
+        std::perror("splice");
+        close_connection(fd, "write error");
+        return false;
+      }
+    }
+  }
+
+  if (s.body_left == 0 && s.in_pipe == 0)
+    return finish_stream_out(conn);
+
+  // Budget spent with bytes still in the pipe: come back on EPOLLOUT.
+  if (s.in_pipe > 0 && budget == 0)
+    conn.write_blocked = true;
+  update_interest(conn);
+  return true;
+}
+
+bool Server::finish_stream_out(Connection &conn)
+{
+  release_stream(conn);
+  conn.write_blocked = conn.write_queue.writable() > 0;
+  if (!close_stream_reply(conn))
+    return false;
+
+  // Frames the client sent behind the streamed one.
+  if (!process_frames(conn))
+    return false;
+  if (uring_)
+  {
+    if (!conn.recv_armed && !reading_paused(conn))
+      uring_arm_recv(conn);
+  }
+  else
+  {
+    update_interest(conn);
+  }
+  return true;
+}
+
+void Server::release_stream(Connection &conn)
+{
+  Connection::Stream &s = conn.stream;
+  if (s.pipe_rd >= 0)
+  {
+    // A pipe with bytes left in it (the client went away) is not reused.
+    if (s.in_pipe == 0 && spare_pipes_.size() < SPARE_PIPES)
+    {
+      spare_pipes_.emplace_back(s.pipe_rd, s.pipe_wr);
+    }
+    else
+    {
+      ::close(s.pipe_rd);
+      ::close(s.pipe_wr);
+    }
+    s.pipe_rd = s.pipe_wr = -1;
+    s.in_pipe = 0;
+  }
+  if (s.file_fd >= 0)
+  {
+    ::close(s.file_fd);
+    s.file_fd = -1;
+    s.file_left = 0;
+  }
+}
@@ -0,0 +1,171 @@
+// Sampled request tracing (trace.h). About one frame in cfg.trace_sample
+// is followed through its reactor: a sample falls due as frames are
+// dispatched, and the next connection whose read buffer runs empty at a
+// frame boundary is armed, so its next read starts a frame and the
+// first-byte stamp is exact. The reply is tracked by byte count through
+// the output queue: the bytes queued ahead of it, then its own.
+//
+// With tracing off no connection is ever armed, and what remains on the
+// hot path is a test of trace_ per frame and of the connection's stage
+// per read and write.
+
+#include "server.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+void Server::set_trace(TraceRing *ring)
+{
+  trace_ = cfg_.trace_sample > 0 ? ring : nullptr;
+  trace_countdown_ = static_cast<uint32_t>(cfg_.trace_sample);
+}
+
+void Server::trace_arm(Connection &conn)
+{
+  if (conn.trace.stage != FrameTrace::Stage::IDLE || conn.closing ||
+      !conn.read_buffer.empty() ||
+      (conn.state != Connection::ReadState::READ_LEN &&
+       conn.state != Connection::ReadState::READ_HEADER))
+    return;
+  conn.trace.stage = FrameTrace::Stage::ARMED;
+  trace_due_ = false;
+}
+
+ssize_t Server::trace_read(Connection &conn, iovec *iov, int cnt)
+{
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = static_cast<size_t>(cnt);
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  const ssize_t n = io_->recvmsg(conn.fd, &msg, 0);
+  if (n <= 0)
+    return n;
+
+  // The software receive stamp is CLOCK_REALTIME, taken when the newest
+  // segment this read returned reached the socket; older segments came
+  // earlier, so this is the least time the first byte spent queued.
+  uint64_t kernel_ns = 0;
+  uint8_t flags = 0;
+  for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+  {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING)
+      continue;
+    scm_timestamping ts;
+    std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+    if (ts.ts[0].tv_sec == 0 && ts.ts[0].tv_nsec == 0)
+      continue;
+    timespec now;
+    ::clock_gettime(CLOCK_REALTIME, &now);
+    const int64_t queued = (now.tv_sec - ts.ts[0].tv_sec) * 1000000000ll +
+                           (now.tv_nsec - ts.ts[0].tv_nsec);
+    kernel_ns = queued > 0 ? static_cast<uint64_t>(queued) : 0;
+    flags = TraceRecord::KERNEL_TS;
+  }
+  trace_first_byte(conn, kernel_ns, flags);
+  return n;
+}
+
+void Server::trace_first_byte(Connection &conn, uint64_t kernel_ns,
+                              uint8_t flags)
+{
+  FrameTrace &t = conn.trace;
+  t.stage = FrameTrace::Stage::READING;
+  t.first_byte_ns = trace_now_ns();
+  t.kernel_ns = kernel_ns;
+  t.flags = flags;
+}
+
+void Server::trace_complete(Connection &conn)
+{
+  conn.trace.complete_ns = trace_now_ns();
+  conn.trace.stage = FrameTrace::Stage::READY;
+}
+
+void Server::trace_dispatched(Connection &conn, size_t bytes_in,
+                              size_t queued)
+{
+  FrameTrace &t = conn.trace;
+  if (t.stage != FrameTrace::Stage::READY)
+  {
+    if (!trace_due_ && --trace_countdown_ == 0)
+    {
+      trace_due_ = true;
+      trace_countdown_ = static_cast<uint32_t>(cfg_.trace_sample);
+    }
+    return;
+  }
+
+  t.dispatched_ns = trace_now_ns();
+  t.bytes_in = static_cast<uint32_t>(bytes_in);
+  t.opcode = conn.protocol == Connection::Protocol::V2 ? conn.tag.opcode : 0;
+  t.request_id = conn.tag.request_id;
+
+  // A reply that is streamed, or filled in later by another reactor, has
+  // no fixed place in the queue to follow; the sample is given up.
+  const size_t now_queued = conn.write_queue.size();
+  if (conn.closing || conn.streaming_out() || conn.stream.reply_open ||
+      conn.write_queue.writable() != now_queued)
+  {
+    t = FrameTrace{};
+    return;
+  }
+  if (now_queued == queued)
+  {
+    // Nothing queued: no reply, or a v2 one still to come from another
+    // reactor's shard.
+    t.flags |= TraceRecord::NO_REPLY;
+    trace_emit(conn, t.dispatched_ns);
+    return;
+  }
+
+  t.ahead = queued;
+  t.through = now_queued;
+  t.bytes_out = static_cast<uint32_t>(now_queued - queued);
+  t.stage = FrameTrace::Stage::WRITING;
+}
+
+void Server::trace_written(Connection &conn, size_t n)
+{
+  FrameTrace &t = conn.trace;
+  const uint64_t now = trace_now_ns();
+  if (t.first_out_ns == 0 && n > t.ahead)
+    t.first_out_ns = now;
+  t.ahead -= std::min(n, t.ahead);
+  if (n < t.through)
+  {
+    t.through -= n;
+    return;
+  }
+  trace_emit(conn, now);
+}
+
+void Server::trace_emit(Connection &conn, uint64_t now)
+{
+  const FrameTrace &t = conn.trace;
+  TraceRecord r{};
+  r.first_byte_ns = t.first_byte_ns;
+  r.kernel_ns = t.kernel_ns;
+  r.reassembly_ns = t.complete_ns - t.first_byte_ns;
+  r.dispatch_ns = t.dispatched_ns - t.complete_ns;
+  if (!(t.flags & TraceRecord::NO_REPLY))
+  {
+    r.queued_ns = t.first_out_ns - t.dispatched_ns;
+    r.flush_ns = now - t.first_out_ns;
+  }
+  r.fd = static_cast<uint32_t>(conn.fd);
+  r.bytes_in = t.bytes_in;
+  r.bytes_out = t.bytes_out;
+  r.reactor = static_cast<uint16_t>(reactor_id_);
+  r.opcode = t.opcode;
+  r.flags = t.flags;
+  r.request_id = t.request_id;
+  trace_->push(r);
+  Metrics::add(metrics_.frames_traced);
+
+  conn.trace = FrameTrace{};
+}
@@ -0,0 +1,463 @@
+// io_uring backend for Server.
+//
+// Replaces epoll_wait + read + write + epoll_ctl(MOD) with:
+//   * one multishot ACCEPT on the listener,
+//   * one multishot RECV per connection, fed from a provided buffer ring,
+//   * at most one SENDMSG per connection in flight, gathering the whole
+//     OutputQueue (up to URING_SEND_IOV frames) in a single submission.
+// Responses queued while processing a batch of completions are submitted
+// together with the next io_uring_enter(), so there is no per-response
+// syscall at all.
+//
+// Framing, command handling and queue_frame() are shared with epoll.
+
+#include "server.h"
+#include "socket_utils.h"
+#include "uring.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+enum UringOp : uint64_t
+{
+  OP_ACCEPT = 1,
+  OP_WAKE,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL
+};
+
+// user_data layout: op (8 bits) | generation (24 bits) | fd (32 bits).
+// Only the low 24 bits of a connection's generation fit; completions are
+// matched on those (same_generation), which is enough to tell an fd's
+// current connection from the one before it.
+constexpr uint32_t GENERATION_MASK = 0xFFFFFF;
+
+uint64_t pack(UringOp op, uint32_t generation, int fd)
+{
+  return (static_cast<uint64_t>(op) << 56) |
+         (static_cast<uint64_t>(generation & GENERATION_MASK) << 32) |
+         static_cast<uint32_t>(fd);
+}
+
+UringOp op_of(uint64_t ud) { return static_cast<UringOp>(ud >> 56); }
+uint32_t generation_of(uint64_t ud) { return (ud >> 32) & GENERATION_MASK; }
+bool same_generation(const Connection &conn, uint64_t ud)
+{
+  return (conn.generation & GENERATION_MASK) == generation_of(ud);
+}
+int fd_of(uint64_t ud) { return static_cast<int>(static_cast<uint32_t>(ud)); }
+} // namespace
+
+bool Server::uring_init()
+{
+  auto ring = std::make_unique<IoUring>();
+  if (!ring->init(URING_ENTRIES, URING_BUFFERS, READ_CHUNK))
+    return false;
+
+  uring_ = std::move(ring);
+  return true;
+}
+
+void Server::run_uring()
+{
+  LOG_INFO("[reactor {}] io_uring event loop started", reactor_id_);
+
+  uring_arm_accept();
+  uring_arm_wake();
+
+  // Connections adopted before the loop started went to epoll.
+  connections_.for_each([this](Connection &conn) {
+    remove_fd_from_epoll(conn.fd);
+    uring_arm_recv(conn);
+  });
+
+  // ---------- main loop ----------
+  while (running_)
+  {
+    housekeeping();
+
+    // Everything queued by the last batch goes out with this enter().
+    uring_submit_sends();
+    connections_.release_retired();
+
+    int ret = uring_->submit_and_wait(1, wait_timeout_ms());
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY &&
+        ret != -ETIME)
+    {
+      errno = -ret;
+      std::perror("io_uring_enter");
+      std::exit(EXIT_FAILURE);
+    }
+
+    unsigned seen = uring_->drain_cqes(
+        [this](const io_uring_cqe &cqe) { uring_complete(cqe); });
+    metrics_.events_per_wait.record(seen);
+  }
+
+  shutdown_connections();
+}
+
+void Server::uring_complete(const io_uring_cqe &cqe)
+{
+  const UringOp op = op_of(cqe.user_data);
+
+  if (op == OP_ACCEPT)
+  {
+    uring_on_accept(cqe);
+    return;
+  }
+
+  if (op == OP_WAKE)
+  {
+    uint64_t count;
+    while (::read(wake_fd_, &count, sizeof(count)) > 0)
+    {
+    }
+    run_mailbox();
+    if (!(cqe.flags & IORING_CQE_F_MORE) && running_)
+      uring_arm_wake();
+    return;
+  }
+
+  const int fd = fd_of(cqe.user_data);
+  Connection *conn = connections_.find(fd);
+  if (!conn || !same_generation(*conn, cqe.user_data))
+  {
+    // Cannot happen while fds are held until their ops drain (the fd is
+    // not reused, so 24 bits of generation wrapping is harmless), but
+    // never leak a provided buffer.
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+      uring_->recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    return;
+  }
+
+  if (op == OP_RECV)
+    uring_on_recv(*conn, cqe);
+  else if (op == OP_SEND)
+    uring_on_send(*conn, cqe);
+  else
+    conn->ops_in_flight--; // OP_CANCEL: counted so it cannot outlive the fd
+
+  if (!conn->closing)
+    account(*conn);
+  uring_reap(*conn);
+}
+
+void Server::uring_on_accept(const io_uring_cqe &cqe)
+{
+  // A cancel for pause_accept() may still be on its way when the accept
+  // resumes; count what is armed so there is only ever one.
+  const bool ended =
+      !(cqe.flags & IORING_CQE_F_MORE) && --uring_accepts_ == 0;
+
+  if ((draining_ || accept_paused_) && cqe.res < 0)
+    return; // cancelled, or the listener was shut down
+
+  if (cqe.res == -EMFILE || cqe.res == -ENFILE)
+  {
+    // Nobody shed means the error came before the queue was looked at;
+    // rearming now would fail the same way.
+    if (!shed_on_fd_exhaustion() && ended)
+    {
+      accept_starved_ = true;
+      accept_retry_at_ = Connection::Clock::now() +
+                         std::chrono::milliseconds(ACCEPT_RETRY_MS);
+      return;
+    }
+  }
+  if (ended && running_ && !draining_ && !accept_paused_)
+    uring_arm_accept();
+
+  if (cqe.res == -EMFILE || cqe.res == -ENFILE)
+    return;
+  if (cqe.res < 0)
+  {
+    errno = -cqe.res;
+    std::perror("accept");
+    return;
+  }
+
+  const int client_fd = cqe.res;
+
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  if (::getpeername(client_fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0)
+    addr.sin_addr.s_addr = 0; // untracked
+
+  Connection *conn = open_connection(client_fd, addr.sin_addr.s_addr);
+  if (!conn)
+    return;
+
+  tune_accepted_socket(client_fd, cfg_.sock);
+  uring_arm_recv(*conn);
+  uring_reap(*conn);
+
+  LOG_INFO("[reactor {}] Accepted client fd={} (active={})", reactor_id_,
+           client_fd, connections_.size());
+
+  if (static_cast<int>(connections_.size()) >= max_connections_)
+    pause_accept();
+}
+
+void Server::uring_on_recv(Connection &conn, const io_uring_cqe &cqe)
+{
+  const bool more = cqe.flags & IORING_CQE_F_MORE;
+  if (!more)
+  {
+    conn.ops_in_flight--;
+    conn.recv_armed = false;
+    conn.recv_cancelling = false;
+  }
+
+  if (cqe.flags & IORING_CQE_F_BUFFER)
+  {
+    const uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe.res > 0 && !conn.closing)
+    {
+      metrics_.read_bytes.record(static_cast<uint64_t>(cqe.res));
+      conn.read_buffer.append(uring_->buffer(bid), cqe.res);
+    }
+    uring_->recycle_buffer(bid);
+  }
+
+  if (conn.closing)
+    return;
+
+  if (cqe.res > 0)
+  {
+    touch(conn, Connection::Clock::now());
+    if (conn.trace.stage == FrameTrace::Stage::ARMED)
+      trace_first_byte(conn, 0, 0);
+    if (cfg_.sock.quickack)
+      set_quickack(conn.fd);
+    if (!process_frames(conn))
+      return;
+    // Stop receiving while replies back up, one is streaming out or the
+    // reactor is over its memory budget; uring_on_send() or
+    // check_memory_budget() resumes.
+    if (over_memory_share(conn) || reading_paused(conn))
+      uring_pause_recv(conn);
+    else if (!more)
+      uring_arm_recv(conn);
+    return;
+  }
+
+  if (cqe.res == 0)
+  {
+    close_connection(conn.fd, "client FIN");
+    return;
+  }
+
+  if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED)
+  {
+    // Provided buffers ran dry (they are recycled as soon as each
+    // completion is copied out), or the recv was cancelled to pause the
+    // connection. Re-arm unless it is still paused; if it has resumed
+    // meanwhile, resume_reading() or uring_on_send() left the re-arm to us.
+    if (!more && !reading_paused(conn))
+      uring_arm_recv(conn);
+    return;
+  }
+
+  errno = -cqe.res;
+  std::perror("read");
+  close_connection(conn.fd, "read error");
+}
+
+void Server::uring_on_send(Connection &conn, const io_uring_cqe &cqe)
+{
+  conn.ops_in_flight--;
+  conn.send_in_flight = false;
+
+  if (conn.closing)
+    return;
+
+  if (cqe.res < 0)
+  {
+    errno = -cqe.res;
+    std::perror("write");
+    close_connection(conn.fd, "write error");
+    return;
+  }
+
+  touch(conn, Connection::Clock::now());
+  Metrics::add(metrics_.bytes_written, static_cast<uint64_t>(cqe.res));
+  conn.write_queue.consume(static_cast<size_t>(cqe.res));
+  if (conn.trace.stage == FrameTrace::Stage::WRITING)
+    trace_written(conn, static_cast<size_t>(cqe.res));
+
+  // A file-backed reply is topped up as the queue drains.
+  if (conn.stream.file_fd >= 0)
+  {
+    if (!fill_from_file(conn))
+      return;
+    if (!conn.streaming_out() && !finish_stream_out(conn))
+      return;
+  }
+
+  if (conn.body_buffered() &&
+      conn.write_queue.size() < Connection::WRITE_LOW_WATER &&
+      !process_frames(conn))
+    return;
+
+  // Short send or frames queued meanwhile: go again with the next batch.
+  if (conn.write_queue.writable() > 0)
+    uring_queue_send(conn);
+  if (!conn.recv_armed && !reading_paused(conn))
+    uring_arm_recv(conn);
+}
+
+void Server::uring_arm_accept()
+{
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = pack(OP_ACCEPT, 0, listen_fd_);
+  ++uring_accepts_;
+}
+
+void Server::uring_stop_accept()
+{
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = pack(OP_ACCEPT, 0, listen_fd_);
+  sqe->user_data = pack(OP_CANCEL, 0, listen_fd_);
+}
+
+void Server::uring_arm_wake()
+{
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = wake_fd_;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = pack(OP_WAKE, 0, wake_fd_);
+}
+
+void Server::uring_arm_recv(Connection &conn)
+{
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (!sqe)
+  {
+    close_connection(conn.fd, "submission queue full");
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn.fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = IoUring::BUF_GROUP;
+  sqe->user_data = pack(OP_RECV, conn.generation, conn.fd);
+  conn.ops_in_flight++;
+  conn.recv_armed = true;
+}
+
+void Server::uring_pause_recv(Connection &conn)
+{
+  // Frames already received stay buffered either way; without a free
+  // entry the recv just keeps running and the connection is paused a
+  // little later.
+  if (!conn.recv_armed || conn.recv_cancelling)
+    return;
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = pack(OP_RECV, conn.generation, conn.fd);
+  sqe->user_data = pack(OP_CANCEL, conn.generation, conn.fd);
+  conn.ops_in_flight++;
+  conn.recv_cancelling = true;
+}
+
+void Server::uring_queue_send(Connection &conn)
+{
+  if (conn.flush_queued || conn.send_in_flight)
+    return;
+  conn.flush_queued = true;
+  flush_pending_.push_back(&conn);
+}
+
+void Server::uring_submit_sends()
+{
+  // Entries may be closing, but are not released before this runs.
+  for (Connection *pending : flush_pending_)
+  {
+    Connection &conn = *pending;
+    const int fd = conn.fd;
+    conn.flush_queued = false;
+    if (conn.closing)
+      continue;
+    account(conn);
+    if (conn.write_queue.writable() == 0)
+      continue;
+
+    io_uring_sqe *sqe = uring_->get_sqe();
+    if (!sqe)
+    {
+      close_connection(fd, "submission queue full");
+      uring_reap(conn);
+      continue;
+    }
+
+    metrics_.write_queue_bytes.record(conn.write_queue.size());
+
+    // iovecs and msghdr must stay put until the completion arrives.
+    conn.send_iov.resize(URING_SEND_IOV);
+    int cnt = conn.write_queue.fill_iov(conn.send_iov.data(), URING_SEND_IOV);
+    conn.send_msg = msghdr{};
+    conn.send_msg.msg_iov = conn.send_iov.data();
+    conn.send_msg.msg_iovlen = static_cast<size_t>(cnt);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.send_msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = pack(OP_SEND, conn.generation, fd);
+    conn.ops_in_flight++;
+    conn.send_in_flight = true;
+  }
+  flush_pending_.clear();
+}
+
+void Server::uring_begin_close(Connection &conn)
+{
+  conn.closing = true;
+
+  // Wakes the multishot recv (and any send) so they complete promptly.
+  ::shutdown(conn.fd, SHUT_RDWR);
+
+  io_uring_sqe *sqe = uring_->get_sqe();
+  if (sqe)
+  {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = conn.fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = pack(OP_CANCEL, conn.generation, conn.fd);
+    conn.ops_in_flight++;
+  }
+}
+
+void Server::uring_reap(Connection &conn)
+{
+  if (!conn.closing || conn.ops_in_flight > 0)
+    return;
+
+  ::close(conn.fd);
+  connections_.retire(conn);
+}
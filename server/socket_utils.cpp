@@ -1,10 +1,15 @@
 #include "socket_utils.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <map>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -26,8 +31,145 @@ void set_nonblocking(int fd) {
   }
 }
 
+void set_nodelay(int fd) {
+  int one = 1;
+  if (::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+    std::perror("setsockopt(TCP_NODELAY)");
+}
+
+void set_quickack(int fd) {
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+static void set_int_option(int fd, int level, int name, int value,
+                           const char *what) {
+  if (::setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    std::perror(what);
+}
+
+void enable_rx_timestamps(int fd) {
+  set_int_option(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                 SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE,
+                 "setsockopt SO_TIMESTAMPING");
+}
+
+void tune_listening_socket(int fd, const ServerConfig::SocketTuning &t,
+                           int cpu) {
+  if (t.defer_accept_s > 0)
+    set_int_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, t.defer_accept_s,
+                   "setsockopt(TCP_DEFER_ACCEPT)");
+  if (t.fastopen_queue > 0)
+    set_int_option(fd, IPPROTO_TCP, TCP_FASTOPEN, t.fastopen_queue,
+                   "setsockopt(TCP_FASTOPEN)");
+  // Raising SO_BUSY_POLL needs CAP_NET_ADMIN.
+  if (t.busy_poll_us > 0)
+    set_int_option(fd, SOL_SOCKET, SO_BUSY_POLL, t.busy_poll_us,
+                   "setsockopt(SO_BUSY_POLL)");
+  if (t.prefer_busy_poll)
+    set_int_option(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1,
+                   "setsockopt(SO_PREFER_BUSY_POLL)");
+  if (t.incoming_cpu)
+    set_int_option(fd, SOL_SOCKET, SO_INCOMING_CPU, cpu,
+                   "setsockopt(SO_INCOMING_CPU)");
+}
+
+void attach_cpu_steering(int fd, const std::vector<int> &cpus) {
+  const uint32_t groups = static_cast<uint32_t>(cpus.size());
+  bool identity = true;
+  std::map<int, std::vector<uint32_t>> on_cpu;
+  for (uint32_t r = 0; r < groups; ++r) {
+    identity = identity && cpus[r] == static_cast<int>(r);
+    on_cpu[cpus[r]].push_back(r);
+  }
+
+  // A = receiving CPU.
+  std::vector<sock_filter> code = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0,
+       static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+  };
+
+  // Reactors pinned elsewhere than CPU r: one test per pinned CPU, which
+  // returns its reactor, or picks one of several by the flow's receive
+  // hash. A jump skips at most 255 instructions, so at most 127
+  // reactors share one CPU's flows.
+  if (identity)
+    on_cpu.clear(); // reactor r on CPU r: A % groups below is exact
+  for (auto &entry : on_cpu) {
+    std::vector<uint32_t> &rs = entry.second;
+    rs.resize(std::min<size_t>(rs.size(), 127));
+    std::vector<sock_filter> block;
+    if (rs.size() > 1) {
+      block.push_back({BPF_LD | BPF_W | BPF_ABS, 0, 0,
+                       static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_RXHASH)});
+      block.push_back({BPF_ALU | BPF_MOD | BPF_K, 0, 0,
+                       static_cast<uint32_t>(rs.size())});
+      for (uint32_t i = 0; i + 1 < rs.size(); ++i) {
+        block.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0, 1, i});
+        block.push_back({BPF_RET | BPF_K, 0, 0, rs[i]});
+      }
+    }
+    block.push_back({BPF_RET | BPF_K, 0, 0, rs.back()});
+
+    code.push_back({BPF_JMP | BPF_JEQ | BPF_K, 0,
+                    static_cast<uint8_t>(block.size()),
+                    static_cast<uint32_t>(entry.first)});
+    code.insert(code.end(), block.begin(), block.end());
+  }
+
+  // Any other CPU: return A % groups as the index into the group.
+  code.push_back({BPF_ALU | BPF_MOD | BPF_K, 0, 0, groups});
+  code.push_back({BPF_RET | BPF_A, 0, 0, 0});
+
+  sock_fprog prog{static_cast<unsigned short>(code.size()), code.data()};
+  if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) < 0)
+    std::perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+}
+
+void tune_accepted_socket(int fd, const ServerConfig::SocketTuning &t) {
+  if (t.nodelay)
+    set_nodelay(fd);
+  if (t.quickack)
+    set_quickack(fd);
+}
+
+static int get_int_option(int fd, int level, int name) {
+  int value = -1;
+  socklen_t len = sizeof(value);
+  if (::getsockopt(fd, level, name, &value, &len) < 0)
+    return -1;
+  return value;
+}
+
+std::string describe_socket_tuning(int listen_fd, int conn_fd,
+                                   const ServerConfig::SocketTuning &t) {
+  // Connection-level values come from the connection asking, so they
+  // show what an accepted socket actually inherited.
+  std::string out;
+  auto line = [&out](const char *name, int value) {
+    out += name;
+    out += '=';
+    out += std::to_string(value);
+    out += '\n';
+  };
+  line("sock_nodelay", get_int_option(conn_fd, IPPROTO_TCP, TCP_NODELAY));
+  line("sock_quickack", t.quickack ? 1 : 0);
+  line("sock_defer_accept_s",
+       get_int_option(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT));
+  line("sock_busy_poll_us", get_int_option(conn_fd, SOL_SOCKET, SO_BUSY_POLL));
+  line("sock_prefer_busy_poll",
+       get_int_option(conn_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL));
+  line("sock_fastopen_queue",
+       get_int_option(listen_fd, IPPROTO_TCP, TCP_FASTOPEN));
+  line("sock_incoming_cpu",
+       get_int_option(listen_fd, SOL_SOCKET, SO_INCOMING_CPU));
+  line("conn_rx_cpu", get_int_option(conn_fd, SOL_SOCKET, SO_INCOMING_CPU));
+  return out;
+}
+
 int create_listening_socket(uint16_t port, int backlog, int recv_buf_bytes,
-                            int send_buf_bytes) {
+                            int send_buf_bytes, bool reuse_port) {
   // 1. socket()
   int fd = ::socket(AF_INET, SOCK_STREAM, 0);
   if (fd < 0) {
@@ -43,6 +185,13 @@ int create_listening_socket(uint16_t port, int backlog, int recv_buf_bytes,
     std::exit(EXIT_FAILURE);
   }
 
+  if (reuse_port &&
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+    std::perror("setsockopt(SO_REUSEPORT)");
+    ::close(fd);
+    std::exit(EXIT_FAILURE);
+  }
+
   // 3. Set socket buffers
   if (::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recv_buf_bytes,
                    sizeof(recv_buf_bytes)) < 0) {
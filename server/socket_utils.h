@@ -1,10 +1,51 @@
 #pragma once
 
+#include "config.h"
 #include <cstdint>
+#include <string>
+#include <vector>
 
 // Creates, binds, and listens on a TCP socket.
+// With reuse_port, several sockets may bind the same port and the kernel
+// load-balances incoming connections between them (one per reactor).
 // Returns listening fd on success.
 // Exits the program on failure.
 int create_listening_socket(uint16_t port, int backlog, int recv_buf_bytes,
-                            int send_buf_bytes);
+                            int send_buf_bytes, bool reuse_port = false);
 void set_nonblocking(int fd);
+
+// Disables Nagle on an accepted socket. Replies completed by another
+// reactor go out as a separate write; Nagle would hold that write back
+// until the peer's delayed ACK.
+void set_nodelay(int fd);
+
+// Listener options from t: TCP_DEFER_ACCEPT, TCP_FASTOPEN, the busy-poll
+// pair (accepted sockets inherit them) and SO_INCOMING_CPU = cpu, the
+// CPU the listener's reactor runs on.
+// An option the kernel refuses is reported and left off.
+void tune_listening_socket(int fd, const ServerConfig::SocketTuning &t,
+                           int cpu);
+
+// Attaches a classic BPF program to the SO_REUSEPORT group of fd so that
+// every flow is handled by the reactor on the CPU its packets arrive on.
+// cpus[r] is the CPU of the group's r-th listener. Reactors sharing a CPU
+// split its flows by receive hash; a CPU no reactor is on falls back to
+// listener (receiving CPU % group size).
+void attach_cpu_steering(int fd, const std::vector<int> &cpus);
+
+// Per-connection options from t, right after accept.
+void tune_accepted_socket(int fd, const ServerConfig::SocketTuning &t);
+
+// TCP_QUICKACK is not sticky: the kernel drops back to delayed ACKs, so
+// it is re-armed after each read.
+void set_quickack(int fd);
+
+// SO_TIMESTAMPING with software receive stamps, so a recvmsg() can say
+// when the kernel took in the bytes it returns. Reported and left off
+// if refused.
+void enable_rx_timestamps(int fd);
+
+// The options in effect, read back from the kernel, as "name=value\n"
+// lines for STATS.
+std::string describe_socket_tuning(int listen_fd, int conn_fd,
+                                   const ServerConfig::SocketTuning &t);
@@ -0,0 +1,105 @@
+#include "timer_wheel.h"
+
+TimerNode::~TimerNode()
+{
+  if (wheel)
+    wheel->cancel(*this);
+}
+
+static size_t round_pow2(size_t n)
+{
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+TimerWheel::TimerWheel(Clock::duration tick, size_t slots,
+                       Clock::time_point start)
+    : start_(start), tick_(tick), slots_(round_pow2(slots)),
+      mask_(slots_.size() - 1)
+{
+  for (TimerNode &s : slots_)
+    s.prev = s.next = &s;
+}
+
+TimerWheel::~TimerWheel()
+{
+  // Disarm whatever is left so the owners' destructors do not touch us.
+  for (TimerNode &head : slots_)
+  {
+    while (head.next != &head)
+      unlink(*head.next);
+  }
+}
+
+uint64_t TimerWheel::tick_of(Clock::time_point t) const
+{
+  if (t <= start_)
+    return 0;
+  return static_cast<uint64_t>((t - start_) / tick_);
+}
+
+void TimerWheel::schedule(TimerNode &node, Clock::time_point deadline)
+{
+  // Round up so a timer never fires before its deadline.
+  uint64_t tick = tick_of(deadline) + 1;
+  if (tick <= current_)
+    tick = current_ + 1;
+  if (tick > current_ + mask_)
+    tick = current_ + mask_;
+
+  if (node.wheel == this && node.tick == tick)
+    return;
+
+  if (node.wheel)
+    node.wheel->cancel(node);
+  link(node, tick);
+}
+
+void TimerWheel::cancel(TimerNode &node)
+{
+  if (node.wheel == this)
+    unlink(node);
+}
+
+int TimerWheel::timeout_ms(Clock::time_point now) const
+{
+  if (size_ == 0)
+    return -1;
+
+  for (uint64_t t = current_ + 1; t <= current_ + mask_ + 1; ++t)
+  {
+    const TimerNode &head = slots_[t & mask_];
+    if (head.next == &head)
+      continue;
+
+    auto due = start_ + tick_ * t;
+    if (due <= now)
+      return 0;
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(due - now).count();
+    return static_cast<int>(ms);
+  }
+  return -1;
+}
+
+void TimerWheel::link(TimerNode &node, uint64_t tick)
+{
+  TimerNode &head = slots_[tick & mask_];
+  node.prev = head.prev;
+  node.next = &head;
+  head.prev->next = &node;
+  head.prev = &node;
+  node.wheel = this;
+  node.tick = tick;
+  ++size_;
+}
+
+void TimerWheel::unlink(TimerNode &node)
+{
+  node.prev->next = node.next;
+  node.next->prev = node.prev;
+  node.prev = node.next = nullptr;
+  node.wheel = nullptr;
+  --size_;
+}
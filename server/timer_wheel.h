@@ -0,0 +1,84 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TimerWheel;
+
+// Intrusive timer entry, embedded in the object it times. Unlinks itself
+// on destruction, so owners can be freed without cancelling first.
+struct TimerNode
+{
+  explicit TimerNode(void *owner_ = nullptr) : owner(owner_) {}
+  ~TimerNode();
+  TimerNode(const TimerNode &) = delete;
+  TimerNode &operator=(const TimerNode &) = delete;
+
+  bool armed() const { return wheel != nullptr; }
+
+  void *owner;
+  TimerNode *prev = nullptr;
+  TimerNode *next = nullptr;
+  TimerWheel *wheel = nullptr;
+  uint64_t tick = 0;
+};
+
+// Single-level hashed timing wheel. schedule(), re-arm and cancel are
+// O(1) list splices; advance() only visits the slots that have come due
+// and the timers in them. Deadlines further out than the wheel span are
+// clamped to its last slot, and the owner re-checks when it fires.
+class TimerWheel
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TimerWheel(Clock::duration tick, size_t slots,
+             Clock::time_point start = Clock::now());
+  ~TimerWheel();
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // Arms or re-arms the node. A re-arm landing in the same tick is free.
+  void schedule(TimerNode &node, Clock::time_point deadline);
+  void cancel(TimerNode &node);
+
+  // Fires every timer whose tick has passed. Nodes are unlinked before
+  // fn(TimerNode &) runs, so the callback may re-arm or destroy them.
+  template <typename Fn>
+  void advance(Clock::time_point now, Fn &&fn)
+  {
+    const uint64_t target = tick_of(now);
+    while (current_ < target && size_ > 0)
+    {
+      ++current_;
+      TimerNode &head = slots_[current_ & mask_];
+      while (head.next != &head)
+      {
+        TimerNode *n = head.next;
+        unlink(*n);
+        fn(*n);
+      }
+    }
+    if (current_ < target)
+      current_ = target;
+  }
+
+  // Milliseconds until the next armed slot is due: what epoll_wait should
+  // block for. -1 when nothing is armed.
+  int timeout_ms(Clock::time_point now) const;
+
+  size_t size() const { return size_; }
+
+private:
+  uint64_t tick_of(Clock::time_point t) const;
+  void link(TimerNode &node, uint64_t tick);
+  void unlink(TimerNode &node);
+
+  Clock::time_point start_;
+  Clock::duration tick_;
+  std::vector<TimerNode> slots_; // list sentinels
+  uint64_t mask_;
+  uint64_t current_ = 0; // last tick processed
+  size_t size_ = 0;
+};
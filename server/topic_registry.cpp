@@ -0,0 +1,93 @@
+#include "topic_registry.h"
+#include "connection.h"
+
+Topic *TopicRegistry::find(std::string_view topic)
+{
+  key_.assign(topic.data(), topic.size());
+  auto it = topics_.find(key_);
+  return it == topics_.end() ? nullptr : &it->second;
+}
+
+TopicRegistry::Result TopicRegistry::subscribe(Connection &conn,
+                                               std::string_view topic)
+{
+  for (const Subscription &s : conn.subscriptions)
+  {
+    if (s.topic->name == topic)
+      return Result::ALREADY;
+  }
+  if (conn.subscriptions.size() >= MAX_PER_CONNECTION)
+    return Result::LIMIT;
+
+  Topic *t = find(topic);
+  if (!t)
+  {
+    t = &topics_[key_];
+    t->name = key_;
+  }
+  conn.subscriptions.push_back({t, t->subscribers.size()});
+  t->subscribers.push_back(&conn);
+  subscriptions_.store(subscriptions_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+  return Result::OK;
+}
+
+TopicRegistry::Result TopicRegistry::unsubscribe(Connection &conn,
+                                                 std::string_view topic)
+{
+  for (size_t i = 0; i < conn.subscriptions.size(); ++i)
+  {
+    if (conn.subscriptions[i].topic->name == topic)
+    {
+      leave(conn, i);
+      return Result::OK;
+    }
+  }
+  return Result::ALREADY;
+}
+
+void TopicRegistry::remove(Connection &conn)
+{
+  while (!conn.subscriptions.empty())
+    leave(conn, conn.subscriptions.size() - 1);
+}
+
+void TopicRegistry::leave(Connection &conn, size_t which)
+{
+  const Subscription sub = conn.subscriptions[which];
+  conn.subscriptions[which] = conn.subscriptions.back();
+  conn.subscriptions.pop_back();
+
+  // Move the last subscriber into the gap and fix its back-reference.
+  std::vector<Connection *> &subs = sub.topic->subscribers;
+  Connection *moved = subs.back();
+  subs[sub.index] = moved;
+  subs.pop_back();
+  if (moved != &conn)
+  {
+    for (Subscription &s : moved->subscriptions)
+    {
+      if (s.topic == sub.topic)
+      {
+        s.index = sub.index;
+        break;
+      }
+    }
+  }
+
+  if (subs.empty())
+    topics_.erase(topics_.find(sub.topic->name));
+  subscriptions_.store(subscriptions_.load(std::memory_order_relaxed) - 1,
+                       std::memory_order_relaxed);
+}
+
+void TopicRegistry::clear()
+{
+  for (auto &entry : topics_)
+  {
+    for (Connection *conn : entry.second.subscribers)
+      conn->subscriptions.clear();
+  }
+  topics_.clear();
+  subscriptions_.store(0, std::memory_order_relaxed);
+}
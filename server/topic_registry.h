@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct Connection;
+
+// Subscribers of one topic on one reactor.
+struct Topic
+{
+  std::string name;
+  std::vector<Connection *> subscribers;
+};
+
+// One entry of Connection::subscriptions: the topic and the connection's
+// position in its subscriber list, so leaving is a swap with the last
+// subscriber rather than a search.
+struct Subscription
+{
+  Topic *topic;
+  size_t index;
+};
+
+// Topics with subscribers on this reactor. Each reactor keeps only the
+// connections it owns and only that reactor touches the registry, so
+// nothing is locked; a PUBLISH reaches other reactors through their
+// mailboxes. subscriptions() is the one value read across threads, so
+// publishers can skip reactors with no subscribers at all.
+class TopicRegistry
+{
+public:
+  static constexpr size_t MAX_TOPIC = 128;      // bytes
+  static constexpr size_t MAX_PER_CONNECTION = 64;
+
+  TopicRegistry() = default;
+  TopicRegistry(const TopicRegistry &) = delete;
+  TopicRegistry &operator=(const TopicRegistry &) = delete;
+
+  enum class Result
+  {
+    OK,
+    ALREADY, // subscribe: already in; unsubscribe: was not
+    LIMIT    // MAX_PER_CONNECTION reached
+  };
+
+  Result subscribe(Connection &conn, std::string_view topic);
+  Result unsubscribe(Connection &conn, std::string_view topic);
+  // Drops every subscription of a closing connection.
+  void remove(Connection &conn);
+  void clear();
+
+  // nullptr when no connection here subscribes to topic. No allocation.
+  Topic *find(std::string_view topic);
+
+  size_t subscriptions() const
+  {
+    return subscriptions_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void leave(Connection &conn, size_t which);
+
+  std::unordered_map<std::string, Topic> topics_; // nodes never move
+  std::string key_; // lookup scratch, so find() never allocates once warm
+  std::atomic<size_t> subscriptions_{0};
+};
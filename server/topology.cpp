@@ -0,0 +1,226 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+bool parse_cpu_list(const std::string &list, std::vector<int> &out) {
+  out.clear();
+  size_t i = 0;
+  auto number = [&](int &v) {
+    if (i >= list.size() || list[i] < '0' || list[i] > '9')
+      return false;
+    long n = 0;
+    while (i < list.size() && list[i] >= '0' && list[i] <= '9') {
+      n = n * 10 + (list[i++] - '0');
+      if (n >= CPU_SETSIZE)
+        return false;
+    }
+    v = static_cast<int>(n);
+    return true;
+  };
+
+  while (i < list.size()) {
+    int lo, hi;
+    if (!number(lo))
+      return false;
+    hi = lo;
+    if (i < list.size() && list[i] == '-') {
+      ++i;
+      if (!number(hi) || hi < lo)
+        return false;
+    }
+    for (int c = lo; c <= hi; ++c)
+      out.push_back(c);
+    if (i < list.size() && list[i] != ',')
+      return false;
+    if (i < list.size() && ++i == list.size())
+      return false; // trailing comma
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return !out.empty();
+}
+
+std::string format_cpu_list(const std::vector<int> &cpus) {
+  std::string out;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+      ++j;
+    if (!out.empty())
+      out += ',';
+    out += std::to_string(cpus[i]);
+    if (j > i)
+      out += '-' + std::to_string(cpus[j]);
+    i = j + 1;
+  }
+  return out;
+}
+
+std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) < 0)
+    return cpus;
+  for (int c = 0; c < CPU_SETSIZE; ++c) {
+    if (CPU_ISSET(c, &set))
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+int reactor_cpu(const ServerConfig &cfg, int reactor) {
+  if (cfg.cpu_affinity.empty())
+    return -1;
+  return cfg.cpu_affinity[static_cast<size_t>(reactor) %
+                          cfg.cpu_affinity.size()];
+}
+
+static std::string read_line(const std::string &path) {
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return line;
+}
+
+// Interrupts of every network device: its own MSI vectors, or those of
+// the PCI function it sits on (virtio-net and similar).
+static std::vector<int> nic_irqs() {
+  std::vector<int> irqs;
+  DIR *net = ::opendir("/sys/class/net");
+  if (!net)
+    return irqs;
+  while (dirent *e = ::readdir(net)) {
+    const std::string dev = std::string("/sys/class/net/") + e->d_name +
+                            "/device";
+    for (const char *sub : {"/msi_irqs", "/../msi_irqs"}) {
+      DIR *d = ::opendir((dev + sub).c_str());
+      if (!d)
+        continue;
+      while (dirent *irq = ::readdir(d)) {
+        if (irq->d_name[0] != '.')
+          irqs.push_back(std::atoi(irq->d_name));
+      }
+      ::closedir(d);
+      break;
+    }
+  }
+  ::closedir(net);
+  std::sort(irqs.begin(), irqs.end());
+  irqs.erase(std::unique(irqs.begin(), irqs.end()), irqs.end());
+  return irqs;
+}
+
+static std::vector<int> irqs_serving(int cpu) {
+  std::vector<int> out;
+  for (int irq : nic_irqs()) {
+    // effective_affinity_list is where the vector is routed now;
+    // smp_affinity_list is the requested mask, for older kernels.
+    const std::string base = "/proc/irq/" + std::to_string(irq);
+    std::string list = read_line(base + "/effective_affinity_list");
+    if (list.empty())
+      list = read_line(base + "/smp_affinity_list");
+    std::vector<int> cpus;
+    if (parse_cpu_list(list, cpus) &&
+        std::binary_search(cpus.begin(), cpus.end(), cpu))
+      out.push_back(irq);
+  }
+  return out;
+}
+
+static long set_mempolicy(int mode, const unsigned long *mask,
+                          unsigned long maxnode) {
+  return ::syscall(SYS_set_mempolicy, mode, mask, maxnode);
+}
+
+ReactorPlacement apply_placement(int cpu, ServerConfig::NumaPolicy policy) {
+  ReactorPlacement p;
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (::sched_setaffinity(0, sizeof(set), &set) < 0)
+      std::perror("sched_setaffinity");
+    else
+      p.cpu = cpu;
+  }
+
+  unsigned cur_cpu = 0, node = 0;
+  if (::syscall(SYS_getcpu, &cur_cpu, &node, nullptr) == 0)
+    p.node = static_cast<int>(node);
+
+  constexpr unsigned long MASK_BITS = 1024;
+  unsigned long mask[MASK_BITS / (8 * sizeof(unsigned long))] = {};
+  auto set_node = [&mask](int n) {
+    if (n >= 0 && static_cast<unsigned long>(n) < MASK_BITS)
+      mask[n / (8 * sizeof(unsigned long))] |=
+          1UL << (n % (8 * sizeof(unsigned long)));
+  };
+
+  long rc = 0;
+  switch (policy) {
+  case ServerConfig::NumaPolicy::NONE:
+    break;
+  case ServerConfig::NumaPolicy::LOCAL:
+    // Pinned: prefer the node of its CPU, spill elsewhere when it is
+    // full. Unpinned: whichever node the thread is on at the time.
+    if (p.cpu >= 0 && p.node >= 0) {
+      set_node(p.node);
+      rc = set_mempolicy(MPOL_PREFERRED, mask, MASK_BITS);
+    } else {
+      rc = set_mempolicy(MPOL_LOCAL, nullptr, 0);
+    }
+    break;
+  case ServerConfig::NumaPolicy::BIND:
+    set_node(p.node);
+    rc = set_mempolicy(MPOL_BIND, mask, MASK_BITS);
+    break;
+  case ServerConfig::NumaPolicy::INTERLEAVE: {
+    std::vector<int> nodes;
+    if (!parse_cpu_list(read_line("/sys/devices/system/node/online"), nodes))
+      nodes = {0};
+    for (int n : nodes)
+      set_node(n);
+    rc = set_mempolicy(MPOL_INTERLEAVE, mask, MASK_BITS);
+    break;
+  }
+  }
+  if (rc < 0)
+    std::perror("set_mempolicy");
+
+  if (p.cpu >= 0)
+    p.nic_irqs = irqs_serving(p.cpu);
+  return p;
+}
+
+std::string describe_placement(int reactor, const ReactorPlacement &p) {
+  const std::string prefix = "reactor" + std::to_string(reactor);
+  std::string out;
+  out += prefix + "_cpu=" + std::to_string(p.cpu) + "\n";
+  out += prefix + "_node=" + std::to_string(p.node) + "\n";
+  out += prefix + "_nic_irqs=" + format_cpu_list(p.nic_irqs) + "\n";
+  return out;
+}
+
+const char *numa_policy_name(ServerConfig::NumaPolicy policy) {
+  switch (policy) {
+  case ServerConfig::NumaPolicy::NONE:
+    return "none";
+  case ServerConfig::NumaPolicy::LOCAL:
+    return "local";
+  case ServerConfig::NumaPolicy::BIND:
+    return "bind";
+  case ServerConfig::NumaPolicy::INTERLEAVE:
+    return "interleave";
+  }
+  return "none";
+}
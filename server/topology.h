@@ -0,0 +1,39 @@
+#pragma once
+
+#include "config.h"
+#include <string>
+#include <vector>
+
+// Parses a kernel-style CPU or node list ("0-3,8,10-11") into ascending,
+// de-duplicated numbers. Returns false on malformed input.
+bool parse_cpu_list(const std::string &list, std::vector<int> &out);
+
+// Formats numbers back into the same style ("0-3,8").
+std::string format_cpu_list(const std::vector<int> &cpus);
+
+// CPUs this process may run on (sched_getaffinity), ascending.
+std::vector<int> allowed_cpus();
+
+// The CPU reactor r is pinned to: cpu_affinity[r % size], or -1 when no
+// affinity list is set.
+int reactor_cpu(const ServerConfig &cfg, int reactor);
+
+// Where a reactor thread ended up.
+struct ReactorPlacement {
+  int cpu = -1;              // pinned CPU; -1 = not pinned
+  int node = -1;             // NUMA node it runs on
+  std::vector<int> nic_irqs; // NIC interrupts whose affinity includes cpu
+};
+
+// Pins the calling thread to cpu (if >= 0), then sets its memory policy,
+// so everything it allocates and first touches from here on (connection
+// slabs, pooled buffers, the io_uring rings) comes from that CPU's node.
+// Tables sized earlier, on another thread, are not moved; Server::place()
+// reallocates its own after calling this.
+// A step the kernel refuses is reported with perror and left unapplied.
+ReactorPlacement apply_placement(int cpu, ServerConfig::NumaPolicy policy);
+
+// "reactor<r>_cpu=", "_node=" and "_nic_irqs=" lines for STATS.
+std::string describe_placement(int reactor, const ReactorPlacement &p);
+
+const char *numa_policy_name(ServerConfig::NumaPolicy policy);
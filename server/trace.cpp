@@ -0,0 +1,101 @@
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+uint64_t trace_now_ns()
+{
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static int64_t realtime_offset_ns()
+{
+  timespec rt;
+  ::clock_gettime(CLOCK_REALTIME, &rt);
+  const int64_t real =
+      static_cast<int64_t>(rt.tv_sec) * 1000000000ll + rt.tv_nsec;
+  return real - static_cast<int64_t>(trace_now_ns());
+}
+
+void TraceRing::push(const TraceRecord &r)
+{
+  // Single writer: the reactor that owns the ring. The slot's seq is
+  // cleared before the body changes and set after, so a reader that sees
+  // the same seq before and after copying has a whole record.
+  const uint64_t pos = head_->load(std::memory_order_relaxed);
+  TraceRecord &slot = slots_[pos & mask_];
+
+  __atomic_store_n(&slot.seq, 0, __ATOMIC_RELAXED);
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(reinterpret_cast<char *>(&slot) + sizeof(slot.seq),
+              reinterpret_cast<const char *>(&r) + sizeof(r.seq),
+              sizeof(TraceRecord) - sizeof(r.seq));
+  __atomic_store_n(&slot.seq, pos + 1, __ATOMIC_RELEASE);
+  head_->store(pos + 1, std::memory_order_release);
+}
+
+TraceFile::~TraceFile()
+{
+  if (map_)
+    ::munmap(map_, size_);
+}
+
+bool TraceFile::open(const std::string &path, uint32_t reactors,
+                     uint32_t sample)
+{
+  const size_t ring_bytes = RING_HEADER + size_t{SLOTS} * sizeof(TraceRecord);
+  const size_t size = sizeof(TraceFileHeader) + reactors * ring_bytes;
+
+  // Built under a private name and renamed over `path`: a predecessor
+  // still writing the old file keeps its own (now unlinked) inode.
+  const std::string tmp = path + "." + std::to_string(::getpid());
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  void *map = MAP_FAILED;
+  if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+    map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED || ::rename(tmp.c_str(), path.c_str()) < 0)
+  {
+    const int err = errno;
+    if (map != MAP_FAILED)
+      ::munmap(map, size);
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    errno = err;
+    return false;
+  }
+  ::close(fd); // the mapping keeps the file
+
+  // A fresh file reads as zeros: every head 0, every seq "never written".
+  auto *hdr = static_cast<TraceFileHeader *>(map);
+  std::memcpy(hdr->magic, "NLTRACE1", sizeof(hdr->magic));
+  hdr->version = VERSION;
+  hdr->reactors = reactors;
+  hdr->slots = SLOTS;
+  hdr->record_size = sizeof(TraceRecord);
+  hdr->sample = sample;
+  hdr->realtime_offset_ns = realtime_offset_ns();
+
+  map_ = map;
+  size_ = size;
+  rings_.resize(reactors);
+  char *base = static_cast<char *>(map) + sizeof(TraceFileHeader);
+  for (uint32_t r = 0; r < reactors; ++r)
+  {
+    char *ring = base + r * ring_bytes;
+    rings_[r].head_ = new (ring) std::atomic<uint64_t>(0);
+    rings_[r].slots_ = reinterpret_cast<TraceRecord *>(ring + RING_HEADER);
+    rings_[r].mask_ = SLOTS - 1;
+  }
+  return true;
+}
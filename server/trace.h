@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sampled request tracing. A traced frame is stamped at five points:
+//
+//   first byte read   the read that brought its first byte in
+//   frame complete    the framing state machine has all of it
+//   dispatch done     its command handler returned
+//   first byte out    a write took the first byte of its reply
+//   flushed           the last byte of its reply has been written
+//
+// plus, where SO_TIMESTAMPING gives one, when the kernel received the
+// bytes that the first read returned. Each finished frame becomes one
+// TraceRecord of stage durations in a memory-mapped ring file, one ring
+// per reactor, which tools/trace_to_perfetto.py turns into a timeline.
+//
+// The file survives the process and a reader needs no cooperation from
+// it: each ring's head counts records ever written, a record's seq is
+// its position + 1 and is stored last, so a reader of a live file can
+// tell a slot being overwritten from a finished one.
+
+struct TraceRecord
+{
+  uint64_t seq;           // position in the ring + 1; 0 = never written
+                          // (set by TraceRing::push)
+  uint64_t first_byte_ns; // CLOCK_MONOTONIC
+  uint64_t kernel_ns;     // socket receive to first byte read
+  uint64_t reassembly_ns; // first byte read to frame complete
+  uint64_t dispatch_ns;   // frame complete to dispatch done
+  uint64_t queued_ns;     // dispatch done to first byte of the reply out
+  uint64_t flush_ns;      // first byte out to last byte out
+  uint32_t fd;
+  uint32_t bytes_in;      // frame payload
+  uint32_t bytes_out;     // reply bytes queued by the handler
+  uint16_t reactor;
+  uint8_t opcode;         // v2 opcode; 0 for v1
+  uint8_t flags;          // KERNEL_TS, NO_REPLY
+  uint64_t request_id;    // v2 request id; 0 for v1
+
+  static constexpr uint8_t KERNEL_TS = 1; // kernel_ns is measured
+  static constexpr uint8_t NO_REPLY = 2;  // nothing queued by dispatch
+};
+static_assert(sizeof(TraceRecord) == 80, "ring file layout");
+
+// Start of the file. Offsets are fixed by the constants below.
+struct TraceFileHeader
+{
+  char magic[8];      // "NLTRACE1"
+  uint32_t version;
+  uint32_t reactors;
+  uint32_t slots;     // records per ring, a power of two
+  uint32_t record_size;
+  uint32_t sample;    // one frame in `sample` is traced
+  uint32_t reserved;
+  int64_t realtime_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC at open
+  uint8_t pad[24];
+};
+static_assert(sizeof(TraceFileHeader) == 64, "ring file layout");
+
+// One reactor's ring: written by that reactor only, read by anyone.
+class TraceRing
+{
+public:
+  void push(const TraceRecord &r);
+  uint64_t recorded() const { return head_->load(std::memory_order_relaxed); }
+
+private:
+  friend class TraceFile;
+  std::atomic<uint64_t> *head_ = nullptr;
+  TraceRecord *slots_ = nullptr;
+  uint64_t mask_ = 0;
+};
+
+// The mapping behind every ring. open() builds the file next to `path`
+// and renames it into place, so a restarted process never truncates the
+// file its predecessor is still writing.
+class TraceFile
+{
+public:
+  static constexpr uint32_t VERSION = 1;
+  static constexpr uint32_t SLOTS = 64 * 1024; // 5 MB per reactor
+  static constexpr size_t RING_HEADER = 64;    // head, then padding
+
+  TraceFile() = default;
+  ~TraceFile();
+  TraceFile(const TraceFile &) = delete;
+  TraceFile &operator=(const TraceFile &) = delete;
+
+  // false with errno set (and nothing left behind) on failure.
+  bool open(const std::string &path, uint32_t reactors, uint32_t sample);
+  TraceRing *ring(uint32_t reactor) { return &rings_[reactor]; }
+
+private:
+  void *map_ = nullptr;
+  size_t size_ = 0;
+  std::vector<TraceRing> rings_;
+};
+
+// Where a connection's traced frame has got to. Lives in Connection, so
+// tracing allocates nothing; stage stays IDLE unless tracing is on.
+struct FrameTrace
+{
+  enum class Stage : uint8_t
+  {
+    IDLE,
+    ARMED,   // read buffer empty: the next read starts a frame
+    READING, // first byte stamped
+    READY,   // frame complete, not yet dispatched
+    WRITING  // reply queued, waiting for the flush
+  };
+  Stage stage = Stage::IDLE;
+  uint8_t flags = 0;
+  uint64_t first_byte_ns = 0;
+  uint64_t kernel_ns = 0;
+  uint64_t complete_ns = 0;
+  uint64_t dispatched_ns = 0;
+  uint64_t first_out_ns = 0;
+  size_t ahead = 0;   // queued bytes still to go before the reply
+  size_t through = 0; // queued bytes still to go up to its last byte
+  uint32_t bytes_in = 0;
+  uint32_t bytes_out = 0;
+  uint8_t opcode = 0;
+  uint64_t request_id = 0;
+};
+
+// CLOCK_MONOTONIC in ns, the clock every stamp uses.
+uint64_t trace_now_ns();
@@ -0,0 +1,205 @@
+#include "uring.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg, size_t argsz)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, arg, argsz));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                 unsigned nr_args)
+{
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// Multishot recv landed in 6.0; older kernels accept the SQE but fail it
+// at runtime, which is too late to fall back cleanly.
+static bool kernel_supports_multishot_recv()
+{
+  utsname u{};
+  if (::uname(&u) != 0)
+    return false;
+
+  int major = 0;
+  if (std::sscanf(u.release, "%d", &major) != 1)
+    return false;
+  return major >= 6;
+}
+
+IoUring::~IoUring()
+{
+  if (ring_fd_ >= 0)
+    ::close(ring_fd_);
+  if (sq_ptr_)
+    ::munmap(sq_ptr_, sq_map_len_);
+  if (sqes_)
+    ::munmap(sqes_, sqes_map_len_);
+  if (buf_ring_)
+    ::munmap(buf_ring_, buf_ring_len_);
+  if (bufs_)
+    ::munmap(bufs_, bufs_len_);
+}
+
+bool IoUring::init(unsigned entries, unsigned buf_count, unsigned buf_size)
+{
+  if (!kernel_supports_multishot_recv())
+  {
+    errno = ENOSYS;
+    return false;
+  }
+
+  io_uring_params p{};
+  ring_fd_ = sys_io_uring_setup(entries, &p);
+  if (ring_fd_ < 0)
+    return false;
+
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP) ||
+      !(p.features & IORING_FEAT_EXT_ARG))
+  {
+    errno = ENOTSUP;
+    return false;
+  }
+
+  // SQ and CQ rings share one mapping (IORING_FEAT_SINGLE_MMAP).
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  sq_map_len_ = sq_len > cq_len ? sq_len : cq_len;
+
+  void *ring = ::mmap(nullptr, sq_map_len_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED)
+    return false;
+  sq_ptr_ = ring;
+
+  sqes_map_len_ = p.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = ::mmap(nullptr, sqes_map_len_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  uint8_t *base = static_cast<uint8_t *>(ring);
+  sq_head_ = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+  sq_entries_ = p.sq_entries;
+  sq_local_tail_ = *sq_tail_;
+
+  cq_head_ = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(base + p.cq_off.cqes);
+  cq_mask_ = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+
+  return setup_buf_ring(buf_count, buf_size);
+}
+
+bool IoUring::setup_buf_ring(unsigned count, unsigned size)
+{
+  buf_ring_len_ = count * sizeof(io_uring_buf);
+  void *ring = ::mmap(nullptr, buf_ring_len_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED)
+  {
+    buf_ring_ = nullptr;
+    return false;
+  }
+  buf_ring_ = static_cast<io_uring_buf *>(ring);
+
+  bufs_len_ = static_cast<size_t>(count) * size;
+  void *bufs = ::mmap(nullptr, bufs_len_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs == MAP_FAILED)
+  {
+    bufs_ = nullptr;
+    return false;
+  }
+  bufs_ = static_cast<uint8_t *>(bufs);
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = count;
+  reg.bgid = BUF_GROUP;
+  if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return false;
+
+  buf_count_ = count;
+  buf_size_ = size;
+  buf_mask_ = count - 1;
+  for (unsigned bid = 0; bid < count; ++bid)
+    recycle_buffer(static_cast<uint16_t>(bid));
+  return true;
+}
+
+void IoUring::recycle_buffer(uint16_t bid)
+{
+  uint16_t *ring_tail = &buf_ring_[0].resv;
+  uint16_t tail = *ring_tail;
+  io_uring_buf &b = buf_ring_[tail & buf_mask_];
+  b.addr = reinterpret_cast<uint64_t>(bufs_ + static_cast<size_t>(bid) * buf_size_);
+  b.len = buf_size_;
+  b.bid = bid;
+  __atomic_store_n(ring_tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+io_uring_sqe *IoUring::get_sqe()
+{
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_local_tail_ - head >= sq_entries_)
+  {
+    // SQ full: hand what we have to the kernel without waiting.
+    if (submit_and_wait(0) < 0)
+      return nullptr;
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_)
+      return nullptr;
+  }
+
+  unsigned idx = sq_local_tail_ & sq_mask_;
+  sq_array_[idx] = idx;
+  ++sq_local_tail_;
+
+  io_uring_sqe *sqe = &sqes_[idx];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int IoUring::submit_and_wait(unsigned wait_nr, int timeout_ms)
+{
+  unsigned to_submit = sq_local_tail_ - *sq_tail_;
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+  if (wait_nr > 0 && timeout_ms >= 0)
+  {
+    // IORING_ENTER_EXT_ARG (5.11+) bounds the wait like epoll_wait.
+    __kernel_timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg{};
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr,
+                             flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  }
+  else
+  {
+    ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags, nullptr, 0);
+  }
+  return ret < 0 ? -errno : ret;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper over the raw syscalls (no liburing dependency):
+// one SQ/CQ pair plus one provided-buffer ring for multishot recv.
+// Owned and driven by a single reactor thread.
+class IoUring
+{
+public:
+  IoUring() = default;
+  ~IoUring();
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  // Returns false (with errno set) when the kernel lacks io_uring or any
+  // feature the server backend relies on: single-mmap rings, provided
+  // buffer rings and multishot accept/recv (Linux 6.0+).
+  bool init(unsigned entries, unsigned buf_count, unsigned buf_size);
+
+  // Next free SQE, zeroed. Flushes the SQ to the kernel if it is full.
+  io_uring_sqe *get_sqe();
+
+  // Submits queued SQEs and waits for at least wait_nr completions, or
+  // timeout_ms (-1 = no limit). Returns <0 (-errno) on failure; -EINTR
+  // and -ETIME are not errors for the caller.
+  int submit_and_wait(unsigned wait_nr, int timeout_ms = -1);
+
+  // Calls fn(const io_uring_cqe &) for every ready completion, then
+  // releases them to the kernel. Returns the number seen.
+  template <typename Fn>
+  unsigned drain_cqes(Fn &&fn)
+  {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned seen = 0;
+    for (; head != tail; ++head, ++seen)
+      fn(cqes_[head & cq_mask_]);
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return seen;
+  }
+
+  // Provided buffers for multishot recv (buffer group BUF_GROUP).
+  static constexpr uint16_t BUF_GROUP = 0;
+  const uint8_t *buffer(uint16_t bid) const { return bufs_ + bid * buf_size_; }
+  void recycle_buffer(uint16_t bid);
+
+private:
+  bool setup_buf_ring(unsigned count, unsigned size);
+
+  int ring_fd_ = -1;
+
+  void *sq_ptr_ = nullptr;
+  size_t sq_map_len_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_map_len_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned sq_local_tail_ = 0;
+
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  unsigned cq_mask_ = 0;
+
+  // Viewed as a plain io_uring_buf array: the header's io_uring_buf_ring
+  // flex-array declaration is laid out differently when compiled as C++.
+  // The ring tail overlays bufs[0].resv.
+  io_uring_buf *buf_ring_ = nullptr;
+  size_t buf_ring_len_ = 0;
+  uint8_t *bufs_ = nullptr;
+  size_t bufs_len_ = 0;
+  unsigned buf_count_ = 0;
+  unsigned buf_size_ = 0;
+  unsigned buf_mask_ = 0;
+};
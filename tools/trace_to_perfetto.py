@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Turn a network_server trace ring file into a Chrome trace / Perfetto
+JSON timeline.
+
+    ./bin/network_server --trace-sample 100 --trace-file netlab.trace
+    python3 tools/trace_to_perfetto.py netlab.trace -o trace.json
+
+Open trace.json in https://ui.perfetto.dev or chrome://tracing. Each
+reactor is a process and each connection a thread; a traced frame is one
+slice with its stages nested under it:
+
+    kernel      socket receive to first byte read (SO_TIMESTAMPING, epoll)
+    reassembly  first byte read to frame complete
+    dispatch    frame complete to command handler returned
+    queued      handler returned to first byte of the reply written
+    flush       first byte written to last byte written
+
+The file may be read while the server is still writing it; records being
+overwritten at that moment are skipped. Layout: server/trace.h.
+"""
+
+import argparse
+import json
+import mmap
+import struct
+import sys
+
+HEADER = struct.Struct("<8sIIIIIIq24x")
+RING_HEADER = 64
+RECORD = struct.Struct("<QQQQQQQIIIHBBQ")
+SEQ = struct.Struct("<Q")
+KERNEL_TS = 1
+NO_REPLY = 2
+
+OPCODES = {
+    1: "PING", 2: "ECHO", 3: "STATS", 4: "CLOSE", 5: "SHUTDOWN", 6: "GET",
+    7: "SET", 8: "DEL", 9: "MGET", 10: "EXPIRE", 11: "BLOB",
+    12: "SUBSCRIBE", 13: "UNSUBSCRIBE", 14: "PUBLISH",
+}
+
+
+def read_records(data):
+    (magic, version, reactors, slots, record_size, sample, _,
+     realtime_offset) = HEADER.unpack_from(data, 0)
+    if magic != b"NLTRACE1" or version != 1 or record_size != RECORD.size:
+        sys.exit("not a version 1 netlab trace file")
+
+    ring_bytes = RING_HEADER + slots * record_size
+    records = []
+    for reactor in range(reactors):
+        base = HEADER.size + reactor * ring_bytes
+        (head,) = struct.unpack_from("<Q", data, base)
+        for pos in range(max(0, head - slots), head):
+            off = base + RING_HEADER + (pos % slots) * record_size
+            # The writer zeroes seq, rewrites the body, then stores seq:
+            # a body copied between two reads of pos + 1 is whole. data is
+            # the live mapping, so the second read sees a write since.
+            rec = RECORD.unpack_from(data, off)
+            (seq,) = SEQ.unpack_from(data, off)
+            if rec[0] == seq == pos + 1:
+                records.append(rec)
+    records.sort(key=lambda r: r[1])
+    return sample, realtime_offset, reactors, records
+
+
+def slice_event(name, pid, tid, start_ns, dur_ns, args=None):
+    ev = {"name": name, "ph": "X", "pid": pid, "tid": tid,
+          "ts": start_ns / 1000.0, "dur": dur_ns / 1000.0}
+    if args:
+        ev["args"] = args
+    return ev
+
+
+def to_events(reactors, records, realtime):
+    events = [{"name": "process_name", "ph": "M", "pid": r,
+               "args": {"name": "reactor %d" % r}} for r in range(reactors)]
+    for (_, first, kernel, reassembly, dispatch, queued, flush, fd, bytes_in,
+         bytes_out, reactor, opcode, flags, request_id) in records:
+        if realtime is not None:
+            first += realtime
+        start = first - kernel if flags & KERNEL_TS else first
+        total = (first - start) + reassembly + dispatch + queued + flush
+        name = OPCODES.get(opcode, "frame") if opcode else "frame"
+        args = {"fd": fd, "bytes_in": bytes_in, "bytes_out": bytes_out}
+        if opcode:
+            args["request_id"] = request_id
+        if flags & NO_REPLY:
+            args["reply"] = "none queued"
+        events.append(slice_event(name, reactor, fd, start, total, args))
+
+        stages = [("reassembly", reassembly), ("dispatch", dispatch)]
+        if not flags & NO_REPLY:
+            stages += [("queued", queued), ("flush", flush)]
+        t = first
+        if flags & KERNEL_TS:
+            events.append(slice_event("kernel", reactor, fd, start, kernel))
+        for stage, dur in stages:
+            events.append(slice_event(stage, reactor, fd, t, dur))
+            t += dur
+    return events
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("trace", help="ring file written by --trace-file")
+    ap.add_argument("-o", "--output", default="-",
+                    help="JSON output (default: stdout)")
+    ap.add_argument("--realtime", action="store_true",
+                    help="wall-clock timestamps instead of CLOCK_MONOTONIC")
+    args = ap.parse_args()
+
+    with open(args.trace, "rb") as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    sample, offset, reactors, records = read_records(data)
+    data.close()
+    events = to_events(reactors, records, offset if args.realtime else None)
+
+    out = sys.stdout if args.output == "-" else open(args.output, "w")
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns",
+               "metadata": {"sample": sample, "frames": len(records)}}, out)
+    if out is not sys.stdout:
+        out.close()
+    print("%d frames from %d reactors" % (len(records), reactors),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()